@@ -0,0 +1,127 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../cli.hpp"
+#include "../compiler.hpp"
+#include "../memory_utils.hpp"
+#include "../parameter.hpp"
+#include "../path_cache.hpp"
+
+using namespace std;
+
+// Microbenchmarks for the number of heap allocations made while parsing parameters and the line directives
+// of the preprocessor's output.  The allocations are counted by the replacement operator new of heap_hooks.cpp,
+// the same way as with 'alloc_stats=true'.  Each benchmark runs once before counting, so that buffers that are
+// reused (and caches) are warm, as they would be for all but the first line of a file.
+
+static const size_t ITERATIONS = 10000;
+
+/// <summary>
+/// Runs the function a number of times and reports the number of heap allocations made per iteration.
+/// </summary>
+/// <param name="name">The name of the benchmark.</param>
+/// <param name="units">The number of units (values, arguments, lines, etc) processed per iteration.</param>
+/// <param name="unit_name">The name of the unit, for the report.</param>
+/// <param name="iterations">The number of times the function should be run.</param>
+/// <param name="func">The function to benchmark.</param>
+template <typename Func>
+static void run_bench(const string& name, size_t units, const string& unit_name, size_t iterations, Func func)
+{
+	func();
+
+	enable_heap_stats(true);
+	for (size_t i = 0; i < iterations; ++i)
+		func();
+	enable_heap_stats(false);
+
+	auto stats = get_heap_stats();
+	auto per_iteration = (double)stats.allocation_count / iterations;
+	cout << left << setw(40) << name
+		<< right << fixed << setprecision(2) << setw(10) << per_iteration << " allocs/iteration"
+		<< setw(10) << per_iteration / units << " allocs/" << unit_name << endl;
+}
+
+/// <summary>
+/// Copies the sample output of the preprocessor to a stage directory, where parse_preprocessor_output expects it.
+/// </summary>
+/// <param name="sample_file">The sample output of the preprocessor.</param>
+/// <param name="out_line_count">Set to the number of lines in the sample.</param>
+/// <returns>The stage directory.</returns>
+static filesystem::path stage_sample(const filesystem::path& sample_file, size_t& out_line_count)
+{
+	ifstream sample(sample_file);
+	if (sample.fail())
+		throw runtime_error("unable to read " + sample_file.u8string());
+
+	out_line_count = 0;
+	string line;
+	while (getline(sample, line))
+		++out_line_count;
+
+	auto stage_path = filesystem::temp_directory_path() / "minlib_bench";
+	filesystem::create_directories(stage_path);
+	filesystem::copy_file(sample_file, stage_path / "preprocessor_output.txt", filesystem::copy_options::overwrite_existing);
+	return stage_path;
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		// parse_param on the lines of a config file, reusing the parameter as the line buffer is reused.
+		parameter param;
+		run_bench("parse_param", 1, "line", ITERATIONS, [&]() {
+			parameter::parse_param(string_view("include_dir = C:/boost/boost_1_76_0/include"), param);
+		});
+
+		// get_params on the arguments of the command line, which returns the parameters it parses.
+		char arg0[] = "config=C:/projects/minlib/boost.ini";
+		char arg1[] = "include_dir=C:/boost/boost_1_76_0/include";
+		char arg2[] = "lib_dir=C:/boost/boost_1_76_0/lib64-msvc-14.2";
+		char arg3[] = "defs=BOOST_ALL_NO_LIB BOOST_ALL_DYN_LINK=1";
+		char* args[] = { arg0, arg1, arg2, arg3 };
+		run_bench("get_params", size(args), "argument", ITERATIONS, [&]() {
+			auto params = parameter::get_params(size(args), args);
+		});
+
+		// get_param_values, copying the values and viewing them in place.
+		string values = "C:/boost/boost_1_76_0/include C:/qt/5.15.2/msvc2019_64/include C:/projects/minlib/include";
+		run_bench("get_param_values (copied)", 3, "value", ITERATIONS, [&]() {
+			auto copied = parameter::get_param_values(values);
+		});
+
+		vector<string_view> viewed;
+		run_bench("get_param_values (viewed)", 3, "value", ITERATIONS, [&]() {
+			parameter::get_param_values(values, viewed);
+		});
+
+		// parse_preprocessor_output on the checked-in sample, with the bundle allocated from a run arena, as for a run.
+		// The first pass isn't counted, so the header files are already in the path cache.
+		size_t line_count;
+		auto sample_file = filesystem::u8path(argc > 1 ? argv[1] : "preprocessor_output.txt");
+		auto stage_path = stage_sample(sample_file, line_count);
+
+		parameter_map param_map;
+		param_map[cli::STAGE_DIR_PARAM] = stage_path.u8string();
+
+		path_cache paths;
+		size_t include_count = 0;
+		run_bench("parse_preprocessor_output", line_count, "line", 100, [&]() {
+			run_arena arena;
+			include_count = compiler::parse_preprocessor_output(param_map, paths, &arena).include_files.size();
+		});
+		cout << "  (" << line_count << " lines, " << include_count << " header files; each pass allocates the arena's initial block)" << endl;
+
+		filesystem::remove_all(stage_path);
+		return 0;
+	}
+	catch (exception& ex)
+	{
+		cout << "ERROR: " << ex.what() << endl;
+		return -1;
+	}
+}
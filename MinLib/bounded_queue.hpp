@@ -0,0 +1,77 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/// <summary>
+/// A thread-safe FIFO queue with a fixed capacity, used to hand work from a producer to
+/// one or more consumers.  Producers block while the queue is full (backpressure) and
+/// consumers block while it is empty, until the queue is closed.
+/// </summary>
+template<typename T>
+class bounded_queue
+{
+private:
+	std::deque<T> items;
+	size_t capacity;
+	bool closed = false;
+	std::mutex mutex;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+
+public:
+	explicit bounded_queue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+	/// <summary>
+	/// Adds an item to the queue, waiting for room if the queue is full.
+	/// </summary>
+	/// <returns>Returns false if the queue was closed, in which case the item is discarded.</returns>
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+		if (closed) return false;
+
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+		return true;
+	}
+
+	/// <summary>
+	/// Removes the next item from the queue, waiting for one if the queue is empty.
+	/// </summary>
+	/// <returns>Returns false once the queue has been closed and all items have been removed.</returns>
+	bool pop(T& out_item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+		if (items.empty()) return false;
+
+		out_item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	/// <summary>
+	/// Checks whether the queue has been closed and all of its items have been removed, i.e. whether
+	/// pop() would return false straight away.
+	/// </summary>
+	bool is_drained()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return closed && items.empty();
+	}
+
+	/// <summary>
+	/// Signals that no more items will be added.  Items already in the queue can still be removed.
+	/// </summary>
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+};
@@ -1,14 +1,72 @@
 #include "bundler.hpp"
 #include <filesystem>
 #include <regex>
+#include <thread>
+#include <mutex>
+#include <set>
+#include <unordered_set>
+#include <fstream>
+#include <algorithm>
+#include <iostream>
 #include "file_utils.hpp"
+#include "header_utils.hpp"
 #include "string_utils.hpp"
 #include "cli.hpp"
 #include "errors.hpp"
+#include "compiler.hpp"
+#include "dep_reader.hpp"
+#include "elf_utils.hpp"
+#include "strip_utils.hpp"
+#include "parallel_utils.hpp"
+#include "path_filter.hpp"
+#include "stage_dir.hpp"
 
 using namespace std;
 using namespace minlib;
 
+// The maximum number of header files waiting to be copied to the include staging directory.
+static const size_t INCLUDE_QUEUE_CAPACITY = 256;
+
+// Thrown by a producer once a copy worker has failed and closed the queue, so that the rest of the
+// preprocessor output (or the dependency files) isn't parsed for nothing; the worker's error is reported instead.
+struct stage_includes_cancelled {};
+
+/// <summary>
+/// Gets the target library's include directories, with the relative ones made absolute.
+/// </summary>
+/// <param name="working_dir_path">The path to the working directory.</param>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <returns>The include directories, in the order they were given.</returns>
+vector<string> bundler::get_include_dirs(const filesystem::path& working_dir_path, const parameter_map& param_map)
+{
+	auto include_dirs = parameter::get_param_values(param_map.at(cli::INCLUDE_DIR_PARAM));
+	for (auto& id : include_dirs)
+	{
+		id = get_expanded_path(id);
+		if (filesystem::path(id).is_relative())
+			id = (working_dir_path / id).u8string();
+	}
+
+	return include_dirs;
+}
+
+/// <summary>
+/// Compiles the include directories and the filter patterns, which decide the header files that are bundled.
+/// </summary>
+/// <param name="include_dirs">The include directories, as returned by get_include_dirs().</param>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="paths">The cache used to canonicalize the include directories and header files.</param>
+/// <returns>The classifier.</returns>
+include_classifier bundler::get_include_classifier(const vector<string>& include_dirs, const parameter_map& param_map, path_cache& paths)
+{
+	auto get_patterns = [&param_map](const char* param_name) {
+		auto it = param_map.find(param_name);
+		return it == param_map.end() ? vector<string>() : parameter::get_param_values(it->second);
+	};
+
+	return include_classifier(paths, include_dirs, get_patterns(cli::INCLUDE_FILTER_PARAM), get_patterns(cli::EXCLUDE_FILTER_PARAM));
+}
+
 /// <summary>
 /// Ensures that the staging folders exist and are empty.
 /// </summary>
@@ -18,69 +76,264 @@ void bundler::prepare_stage(const string& stage_include_dir, const string& stage
 {
 	if (filesystem::exists(stage_include_dir) && filesystem::is_directory(stage_include_dir))
 		filesystem::remove_all(stage_include_dir);
-	filesystem::create_directory(stage_include_dir);
+	filesystem::create_directories(stage_include_dir);
 
 	if (filesystem::exists(stage_lib_dir) && filesystem::is_directory(stage_lib_dir))
 		filesystem::remove_all(stage_lib_dir);
-	filesystem::create_directory(stage_lib_dir);
+	filesystem::create_directories(stage_lib_dir);
 }
 
 /// <summary>
-/// Uses the bundle to copy the header files from the target library's include directory to the include staging directory.
+/// Copies the header files from the target library's include directory to the include staging directory.
+/// The header files are handed to a pool of copy workers through a bounded queue, so that they can be
+/// copied while the producer is still discovering them.  The producer is blocked whenever the workers
+/// fall behind, which keeps the number of pending copy operations in check.
 /// </summary>
-/// <param name="bundle">The bundle produced by the compiler.</param>
+/// <param name="produce">Pushes the paths of the header files onto the queue; runs on the calling thread.  It may throw
+/// stage_includes_cancelled once a push fails, i.e. once a copy worker has failed.</param>
 /// <param name="working_dir_path">The path to the working directory.</param>
 /// <param name="stage_include_dir">The path to the include staging directory.</param>
 /// <param name="param_map">The parameters passed into the program.</param>
-void bundler::set_stage_includes(lib_bundle& bundle, const filesystem::path& working_dir_path, const string& stage_include_dir, map<string, string> param_map)
+/// <param name="paths">The cache used to canonicalize the include directories and header files.</param>
+void bundler::set_stage_includes(const function<void(bounded_queue<string>&)>& produce, const filesystem::path& working_dir_path, const string& stage_include_dir, const parameter_map& param_map, path_cache& paths)
 {
-	auto include_dir_param = param_map.at(cli::INCLUDE_DIR_PARAM);
-	auto include_dirs = parameter::get_param_values(include_dir_param);
+	auto include_dirs = get_include_dirs(working_dir_path, param_map);
 
-	for (auto& id : include_dirs)
+	auto minify = cli::is_flag_set(param_map, cli::MINIFY_HEADERS_PARAM);
+	auto keep_license = cli::is_flag_set(param_map, cli::KEEP_LICENSE_PARAM);
+
+	// The pinned macros take on the value given in 'defs' (like the compiler's -D/'/D'),
+	// or are considered undefined if they are not listed there.
+	map<string, string> defined_macros;
+	set<string> undefined_macros;
+	if (auto it = param_map.find(cli::PIN_DEFS_PARAM); it != param_map.end())
 	{
-		id = get_expanded_path(id);
-		if (filesystem::path(id).is_relative())
-			id = (working_dir_path / id).u8string();
+		map<string, string> defs;
+		if (auto defs_it = param_map.find(cli::DEFS_PARAM); defs_it != param_map.end())
+		{
+			for (auto& d : parameter::get_param_values(defs_it->second))
+			{
+				auto separator_pos = d.find('=');
+				if (separator_pos == string::npos)
+					defs[d] = "";
+				else
+					defs[d.substr(0, separator_pos)] = d.substr(separator_pos + 1);
+			}
+		}
+
+		for (auto& macro : parameter::get_param_values(it->second))
+		{
+			if (auto def = defs.find(macro); def != defs.end())
+				defined_macros.insert(*def);
+			else
+				undefined_macros.insert(macro);
+		}
 	}
 
-	for (auto& include_from : bundle.include_files)
-	{
-		auto should_include = false;
-		for (auto& id : include_dirs)
+	auto transform_headers = minify || !defined_macros.empty() || !undefined_macros.empty();
+
+	bounded_queue<string> queue(INCLUDE_QUEUE_CAPACITY);
+	exception_ptr first_error;
+	mutex error_mutex;
+
+	// The include directories and filter patterns are compiled once, up front.
+	auto classifier = get_include_classifier(include_dirs, param_map, paths);
+	unordered_set<string> staged_files;
+	mutex staged_files_mutex;
+
+	auto copy_includes = [&]() {
+		string include_from;
+		while (queue.pop(include_from))
 		{
-			// We only want to include the header files that belong to the supplied include directories,
-			// that way we avoid including system headers.
-			if (size_t start_pos = include_from.find(id); start_pos == string::npos || start_pos != 0)
-				continue;
+			try
+			{
+				// We only want to include the header files that belong to the supplied include directories
+				// (and pass the filters), that way we avoid including system headers.  The paths are compared
+				// once canonicalized, so that headers reached through symlinks or '..' segments are matched,
+				// and staged only once.
+				size_t dir_index;
+				string relative_path;
+				if (!classifier.classify(include_from, dir_index, relative_path))
+					continue;
+
+				auto include_to = (filesystem::path(stage_include_dir) / get_rootless_path(include_dirs[dir_index]) / filesystem::u8path(relative_path)).u8string();
+
+				{
+					lock_guard<mutex> lock(staged_files_mutex);
+					if (!staged_files.insert(include_to).second) continue;
+				}
+
+				filesystem::create_directories(filesystem::path(include_to).parent_path());
+
+				if (transform_headers)
+				{
+					auto contents = get_file_contents(include_from.c_str());
+					if (!defined_macros.empty() || !undefined_macros.empty())
+						contents = resolve_conditionals(contents, defined_macros, undefined_macros);
+					if (minify)
+						contents = minify_header(contents, keep_license);
+
+					ofstream include_file(filesystem::u8path(include_to), ios::out | ios::binary);
+					include_file << contents;
+					include_file.close();
+					if (!include_file)
+						throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), include_to));
+				}
+				else
+				{
+					filesystem::copy(include_from, include_to);
+				}
+			}
+			catch (...)
+			{
+				// Stop accepting work, which also unblocks the producer.
+				lock_guard<mutex> lock(error_mutex);
+				if (!first_error) first_error = current_exception();
+				queue.close();
+			}
+		}
+	};
+
+	// The producer mostly waits for room in the queue, so the first worker shares the job MinLib was
+	// started with.  Under a make jobserver, the other workers wait for a token of their own and give
+	// up once there's nothing left to copy.
+	auto copy_includes_with_token = [&]() {
+		job_token token([&queue]() { return queue.is_drained(); });
+		if (token) copy_includes();
+	};
+
+	vector<thread> workers;
+	auto worker_count = cli::get_job_count(param_map);
+	for (size_t i = 0; i < worker_count; ++i)
+		workers.emplace_back(i == 0 ? function<void()>(copy_includes) : function<void()>(copy_includes_with_token));
+
+	try
+	{
+		produce(queue);
+	}
+	catch (const stage_includes_cancelled&)
+	{
+		// The queue was closed by a copy worker, whose error is rethrown below.
+	}
+	catch (...)
+	{
+		queue.close();
+		for (auto& w : workers) w.join();
+		throw;
+	}
+
+	queue.close();
+	for (auto& w : workers) w.join();
+
+	if (first_error)
+		rethrow_exception(first_error);
+}
+
+/// <summary>
+/// Finds the shared objects that the lib files depend on, by following the DT_NEEDED entries of their
+/// ELF dynamic sections.  Each dependency is looked up the way the dynamic linker would (DT_RPATH, the
+/// lib directories, then DT_RUNPATH), and only dependencies found within one of the lib directories
+/// are part of the closure; system libraries are left out.  Each level of the dependency tree is read
+/// in parallel.  Lib files that are not ELF shared objects (static libs, import libs) are skipped.
+/// </summary>
+/// <param name="lib_paths">The paths of the lib files within the lib directories.</param>
+/// <param name="lib_dirs">The lib directories.</param>
+/// <param name="jobs">The number of threads to read the lib files with.</param>
+/// <param name="out_sonames">Set to the SONAME of each shared object, keyed by the path to its real file.</param>
+/// <returns>The paths of the dependencies, not including the lib files passed in.</returns>
+vector<filesystem::path> bundler::get_lib_dependencies(const vector<filesystem::path>& lib_paths, const vector<string>& lib_dirs, size_t jobs, map<string, string>& out_sonames)
+{
+	vector<filesystem::path> canonical_lib_dirs;
+	for (auto& lib_dir : lib_dirs)
+	{
+		if (filesystem::is_directory(lib_dir))
+			canonical_lib_dirs.push_back(filesystem::canonical(lib_dir));
+	}
 
-			should_include = true;
-			break;
+	auto is_in_lib_dir = [&canonical_lib_dirs](const filesystem::path& path) {
+		auto dir = filesystem::weakly_canonical(path.parent_path());
+		return any_of(canonical_lib_dirs.begin(), canonical_lib_dirs.end(), [&dir](const filesystem::path& lib_dir) {
+			auto rel = dir.lexically_relative(lib_dir);
+			return !rel.empty() && *rel.begin() != "..";
+		});
+	};
+
+	// Returns the path the dynamic linker would load the dependency from, or an empty path if
+	// it's not found or if it would be loaded from outside the lib directories.
+	auto find_dependency = [&](const string& name, const elf_dynamic_info& info, const filesystem::path& origin) {
+		vector<filesystem::path> search_dirs;
+		auto add_search_dirs = [&](const vector<string>& dirs) {
+			for (auto dir : dirs)
+			{
+				dir = regex_replace(dir, regex("\\$(ORIGIN|\\{ORIGIN\\})"), origin.u8string());
+				search_dirs.push_back(filesystem::path(dir));
+			}
+		};
+
+		if (info.runpath.empty()) add_search_dirs(info.rpath);
+		search_dirs.insert(search_dirs.end(), lib_dirs.begin(), lib_dirs.end());
+		add_search_dirs(info.runpath);
+
+		for (auto& dir : search_dirs)
+		{
+			auto candidate = name.find('/') == string::npos ? dir / name : origin / name;
+			if (filesystem::is_regular_file(candidate))
+				return is_in_lib_dir(candidate) ? candidate.lexically_normal() : filesystem::path();
 		}
+		return filesystem::path();
+	};
+
+	vector<filesystem::path> result;
+	set<string> visited;
+	for (auto& lib_path : lib_paths)
+		visited.insert(lib_path.lexically_normal().u8string());
 
-		if (!should_include) continue;
+	auto pending = lib_paths;
+	while (!pending.empty())
+	{
+		vector<elf_dynamic_info> infos(pending.size());
+		vector<char> is_shared_object(pending.size());
+		parallel_for_each(pending.size(), jobs, [&](size_t i) {
+			is_shared_object[i] = filesystem::is_regular_file(pending[i]) && get_elf_dynamic_info(pending[i].u8string(), infos[i]);
+		});
+
+		vector<filesystem::path> next;
+		for (size_t i = 0; i < pending.size(); ++i)
+		{
+			if (!is_shared_object[i]) continue;
 
-		auto partition = include_from.substr(0, 2);
-		string include_to;
+			auto real_path = filesystem::canonical(pending[i]);
+			if (!infos[i].soname.empty())
+				out_sonames[real_path.u8string()] = infos[i].soname;
 
-		if (regex_match(partition, regex("[A-Za-z]:")))
-			include_to = (filesystem::path(stage_include_dir) / include_from.substr(3)).u8string(); // Windows
-		else
-			include_to = (filesystem::path(stage_include_dir) / include_from.substr(1)).u8string(); // *nix
+			for (auto& name : infos[i].needed)
+			{
+				auto dependency = find_dependency(name, infos[i], real_path.parent_path());
+				if (!dependency.empty() && visited.insert(dependency.u8string()).second)
+				{
+					next.push_back(dependency);
+					result.push_back(dependency);
+				}
+			}
+		}
 
-		filesystem::create_directories(filesystem::path(include_to).parent_path());
-		filesystem::copy(include_from, include_to);
+		pending = move(next);
 	}
+
+	return result;
 }
 
 /// <summary>
 /// Uses the bundle to copy the lib files from the target library's lib directory to the lib staging directory.
+/// Shared objects are bundled along with the shared objects they depend on within the lib directories.  Each
+/// real file is copied once; the symlinks leading to it (e.g. libfoo.so -> libfoo.so.1 -> libfoo.so.1.2.3)
+/// are recreated in the staging directory, as is the link named after its SONAME.
 /// </summary>
 /// <param name="bundle">The bundle produced by the compiler.</param>
 /// <param name="working_dir_path">The path to the working directory.</param>
 /// <param name="stage_include_dir">The path to the lib staging directory.</param>
 /// <param name="param_map">The parameters passed into the program.</param>
-void bundler::set_stage_libs(lib_bundle& bundle, const filesystem::path& working_dir_path, const string& stage_lib_dir, map<string, string> param_map)
+void bundler::set_stage_libs(const lib_bundle& bundle, const filesystem::path& working_dir_path, const string& stage_lib_dir, const parameter_map& param_map)
 {
 	const auto& lib_dir_param = param_map.at(cli::LIB_DIR_PARAM);
 	auto lib_dirs = parameter::get_param_values(lib_dir_param);
@@ -92,24 +345,87 @@ void bundler::set_stage_libs(lib_bundle& bundle, const filesystem::path& working
 			ld = (working_dir_path / ld).u8string();
 	}
 
-	if (map<string, string>::iterator it = param_map.find(cli::LIBS_PARAM); it != param_map.end())
+	// The libs found by the compiler plus the ones passed in; the bundle itself is left as is, so that
+	// it can be bundled again.
+	vector<string> libs(bundle.lib_files.begin(), bundle.lib_files.end());
+	if (parameter_map::const_iterator it = param_map.find(cli::LIBS_PARAM); it != param_map.end())
 	{
-		auto libs = parameter::get_param_values(it->second);
-		bundle.lib_files.insert(bundle.lib_files.end(), libs.begin(), libs.end());
+		for (auto& lib : parameter::get_param_values(it->second))
+			if (find(libs.begin(), libs.end(), lib) == libs.end())
+				libs.push_back(lib);
 	}
 
-	for (auto& lib : bundle.lib_files)
+	vector<filesystem::path> lib_paths;
+	for (auto& lib : libs)
 	{
 		for (auto& lib_dir : lib_dirs)
 		{
 			auto lib_from = filesystem::path(lib_dir) / lib;
 			if (filesystem::exists(lib_from))
 			{
-				filesystem::copy(lib_from, stage_lib_dir);
+				lib_paths.push_back(lib_from);
 				break;
 			}
 		}
 	}
+
+	auto jobs = cli::get_job_count(param_map);
+	map<string, string> sonames;
+	auto dependencies = get_lib_dependencies(lib_paths, lib_dirs, jobs, sonames);
+	lib_paths.insert(lib_paths.end(), dependencies.begin(), dependencies.end());
+
+	// Everything is flattened into the staging directory, so files and links are keyed by their file names.
+	map<string, filesystem::path> real_files;
+	map<string, string> links;
+	for (auto& lib_path : lib_paths)
+	{
+		auto current = lib_path;
+		while (filesystem::is_symlink(current))
+		{
+			auto target = filesystem::read_symlink(current);
+			auto next = target.is_absolute() ? target : current.parent_path() / target;
+			links.insert({ current.filename().u8string(), next.filename().u8string() });
+			current = next;
+		}
+
+		auto real_path = filesystem::canonical(current);
+		auto real_name = real_path.filename().u8string();
+		real_files.insert({ real_name, real_path });
+
+		if (auto it = sonames.find(real_path.u8string()); it != sonames.end() && it->second != real_name)
+			links.insert({ it->second, real_name });
+	}
+
+	// With 'strip_libs' set, the debug sections are left out while the libs are being copied.
+	auto strip = cli::is_flag_set(param_map, cli::STRIP_LIBS_PARAM);
+	vector<pair<string, filesystem::path>> copies(real_files.begin(), real_files.end());
+	parallel_for_each(copies.size(), jobs, [&](size_t i) {
+		auto lib_from = copies[i].second;
+		auto lib_to = filesystem::path(stage_lib_dir) / copies[i].first;
+
+		if (strip && strip_debug_info(lib_from.u8string(), lib_to.u8string()))
+			filesystem::permissions(lib_to, filesystem::status(lib_from).permissions());
+		else
+			filesystem::copy_file(lib_from, lib_to, filesystem::copy_options::overwrite_existing);
+	});
+
+	for (auto& [name, target] : links)
+	{
+		if (real_files.count(name) > 0) continue;
+
+		auto link_path = filesystem::path(stage_lib_dir) / name;
+		error_code ec;
+		filesystem::create_symlink(target, link_path, ec);
+		if (ec)
+		{
+			// Symlinks may not be supported (e.g. on Windows without the privilege), so copy the real file instead.
+			auto real_name = target;
+			for (size_t hops = 0; real_files.count(real_name) == 0 && links.count(real_name) > 0 && hops < links.size(); ++hops)
+				real_name = links[real_name];
+			if (auto it = real_files.find(real_name); it != real_files.end())
+				filesystem::copy_file(it->second, link_path, filesystem::copy_options::overwrite_existing);
+		}
+	}
 }
 
 /// <summary>
@@ -118,7 +434,7 @@ void bundler::set_stage_libs(lib_bundle& bundle, const filesystem::path& working
 /// <param name="working_dir_path">The path to the working directory.</param>
 /// <param name="stage_include_dir">The path to the include staging directory.</param>
 /// <param name="param_map">The parameters passed into the program.</param>
-void bundler::set_target_includes(const filesystem::path& working_dir_path, const string& stage_include_dir, map<string, string> param_map)
+void bundler::set_target_includes(const filesystem::path& working_dir_path, const string& stage_include_dir, const parameter_map& param_map)
 {
 	auto include_out_dir = get_expanded_path(param_map.at(cli::INCLUDE_OUT_DIR_PARAM));
 
@@ -135,7 +451,7 @@ void bundler::set_target_includes(const filesystem::path& working_dir_path, cons
 /// <param name="working_dir_path">The path to the working directory.</param>
 /// <param name="stage_include_dir">The path to the lib staging directory.</param>
 /// <param name="param_map">The parameters passed into the program.</param>
-void bundler::set_target_libs(const filesystem::path& working_dir_path, const string& stage_lib_dir, map<string, string> param_map)
+void bundler::set_target_libs(const filesystem::path& working_dir_path, const string& stage_lib_dir, const parameter_map& param_map)
 {
 	auto lib_out_dir = get_expanded_path(param_map.at(cli::LIB_OUT_DIR_PARAM));
 
@@ -143,7 +459,27 @@ void bundler::set_target_libs(const filesystem::path& working_dir_path, const st
 		lib_out_dir = (filesystem::path(working_dir_path) / lib_out_dir).u8string();
 
 	if (!filesystem::exists(lib_out_dir)) filesystem::create_directories(lib_out_dir);
-	filesystem::copy(stage_lib_dir, lib_out_dir, filesystem::copy_options::overwrite_existing | filesystem::copy_options::recursive);
+
+	// Symlinks are copied as symlinks, replacing whatever is at the destination, rather than
+	// being followed, which would leave a full copy of the shared object under each name.
+	for (auto& entry : filesystem::recursive_directory_iterator(stage_lib_dir))
+	{
+		auto target = filesystem::path(lib_out_dir) / entry.path().lexically_relative(stage_lib_dir);
+		if (entry.is_symlink())
+		{
+			if (filesystem::is_symlink(target) || filesystem::exists(target)) filesystem::remove(target);
+			filesystem::copy_symlink(entry.path(), target);
+		}
+		else if (entry.is_directory())
+		{
+			filesystem::create_directories(target);
+		}
+		else
+		{
+			if (filesystem::is_symlink(target)) filesystem::remove(target);
+			filesystem::copy_file(entry.path(), target, filesystem::copy_options::overwrite_existing);
+		}
+	}
 }
 
 /// <summary>
@@ -151,7 +487,7 @@ void bundler::set_target_libs(const filesystem::path& working_dir_path, const st
 /// </summary>
 /// <param name="working_dir_path">The path to the working directory.</param>
 /// <param name="param_map">The parameters passed into the program.</param>
-void bundler::copy_files(const std::filesystem::path& working_dir_path, std::map<std::string, std::string> param_map)
+void bundler::copy_files(const std::filesystem::path& working_dir_path, const parameter_map& param_map)
 {
 	auto copy_operations_str = param_map.at(cli::COPY_FILES_PARAM);
 	auto copy_operations_arr = str_split(copy_operations_str, ' ');
@@ -200,25 +536,205 @@ void bundler::copy_files(const std::filesystem::path& working_dir_path, std::map
 /// Uses the bundle to copy the header/lib files from the target library to the staging
 /// directories and then subsequently to the final target directories.
 /// </summary>
-/// <param name="bundle">The bundle produced by the compiler.</param>
+/// <param name="bundle">The bundle produced by the compiler; it's left as is (see set_stage_libs).</param>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="paths">The cache used to canonicalize the include directories and header files.</param>
+void bundler::bundle_library(const lib_bundle& bundle, const parameter_map& param_map, path_cache& paths)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = (filesystem::current_path() / working_dir_path).u8string();
+
+	auto stage_path = filesystem::u8path(param_map.at(cli::STAGE_DIR_PARAM));
+	auto stage_include_dir = (stage_path / "include").u8string();
+	auto stage_lib_dir = (stage_path / "lib").u8string();
+
+	prepare_stage(stage_include_dir, stage_lib_dir);
+
+	set_stage_includes([&bundle](bounded_queue<string>& queue) {
+		for (auto& include_file : bundle.include_files)
+		{
+			if (!queue.push(string(include_file)))
+				break;
+		}
+	}, working_dir_path, stage_include_dir, param_map, paths);
+
+	set_stage_libs(bundle, working_dir_path, stage_lib_dir, param_map);
+
+	set_target_includes(working_dir_path, stage_include_dir, param_map);
+	set_target_libs(working_dir_path, stage_lib_dir, param_map);
+
+	copy_files(working_dir_path, param_map);
+}
+
+/// <summary>
+/// Parses the output of the preprocessor (or the project's dependency files, if 'compile_commands' is set)
+/// and bundles the library in a single pipelined pass: each header file is copied to the include staging
+/// directory as soon as the parser comes across it, rather than after the whole output has been parsed.
+/// </summary>
 /// <param name="param_map">The parameters passed into the program.</param>
-void bundler::bundle_library(lib_bundle& bundle, map<string, string> param_map)
+/// <param name="paths">The cache used to canonicalize the include directories and header files.</param>
+/// <param name="resource">The memory resource to allocate the bundle from, e.g. the run's arena.</param>
+/// <returns>The bundle, as produced by compiler::parse_preprocessor_output() or dep_reader::read_dependencies().</returns>
+lib_bundle bundler::bundle_library(const parameter_map& param_map, path_cache& paths, pmr::memory_resource* resource)
 {
 	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
 	if (working_dir_path.is_relative())
 		working_dir_path = (filesystem::current_path() / working_dir_path).u8string();
 
-	auto stage_path = working_dir_path / filesystem::path("minlib_stage");
+	auto stage_path = filesystem::u8path(param_map.at(cli::STAGE_DIR_PARAM));
 	auto stage_include_dir = (stage_path / "include").u8string();
 	auto stage_lib_dir = (stage_path / "lib").u8string();
 
 	prepare_stage(stage_include_dir, stage_lib_dir);
 
-	set_stage_includes(bundle, working_dir_path, stage_include_dir, param_map);
+	lib_bundle bundle(resource);
+	set_stage_includes([&bundle, &param_map, &paths, resource](bounded_queue<string>& queue) {
+		auto on_include_file = [&queue](string_view include_file) {
+			if (!queue.push(string(include_file)))
+				throw stage_includes_cancelled();
+		};
+
+		if (param_map.find(cli::COMPILE_COMMANDS_PARAM) != param_map.end())
+			bundle = dep_reader::read_dependencies(param_map, paths, resource, on_include_file);
+		else
+			bundle = compiler::parse_preprocessor_output(param_map, paths, resource, on_include_file);
+	}, working_dir_path, stage_include_dir, param_map, paths);
+
 	set_stage_libs(bundle, working_dir_path, stage_lib_dir, param_map);
 
 	set_target_includes(working_dir_path, stage_include_dir, param_map);
 	set_target_libs(working_dir_path, stage_lib_dir, param_map);
 
 	copy_files(working_dir_path, param_map);
+
+	return bundle;
+}
+
+/// <summary>
+/// Narrows a bundle, as produced by compiler::parse_preprocessor_output() or dep_reader::read_dependencies(), down
+/// to the header files that set_stage_includes() stages: those within the include directories that pass the filters.
+/// The preprocessor's copies of the input file in the staging directories and pseudo-files such as &lt;built-in&gt;
+/// are dropped along with the rest.  The include graph is restricted to the remaining header files.
+/// </summary>
+/// <param name="bundle">The bundle.</param>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="paths">The cache used to canonicalize the include directories and header files.</param>
+/// <returns>The narrowed bundle, allocated from the default memory resource.</returns>
+lib_bundle bundler::select_includes(const lib_bundle& bundle, const parameter_map& param_map, path_cache& paths)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = filesystem::current_path() / working_dir_path;
+
+	auto include_dirs = get_include_dirs(working_dir_path, param_map);
+	auto classifier = get_include_classifier(include_dirs, param_map, paths);
+	auto stage_prefix = stage_dir::get_root(working_dir_path).lexically_normal().u8string() + (char)filesystem::path::preferred_separator;
+
+	lib_bundle result;
+	unordered_set<string_view> selected; // Refers to the strings of the original bundle.
+	size_t dir_index;
+	string relative_path;
+
+	for (auto& include_file : bundle.include_files)
+	{
+		string path(include_file);
+		if (!filesystem::path(path).is_absolute() || path.compare(0, stage_prefix.size(), stage_prefix) == 0)
+			continue;
+
+		if (classifier.classify(path, dir_index, relative_path))
+		{
+			result.include_files.push_back(include_file);
+			selected.insert(include_file);
+		}
+	}
+
+	result.lib_files.assign(bundle.lib_files.begin(), bundle.lib_files.end());
+
+	for (auto& [file, includes] : bundle.include_graph)
+	{
+		if (selected.find(file) == selected.end()) continue;
+
+		for (auto& include : includes)
+		{
+			if (selected.find(include) != selected.end())
+				result.include_graph[file].push_back(include);
+		}
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Maps each of the specified include directories to its counterpart within the include target
+/// directory, i.e. the directories that the consumer of the bundle would pass to the compiler.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <returns>The list of include directories within the bundle.</returns>
+vector<string> bundler::get_bundled_include_dirs(const parameter_map& param_map)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = (filesystem::current_path() / working_dir_path).u8string();
+
+	auto include_out_dir = get_expanded_path(param_map.at(cli::INCLUDE_OUT_DIR_PARAM));
+	if (filesystem::path(include_out_dir).is_relative())
+		include_out_dir = (working_dir_path / include_out_dir).u8string();
+
+	vector<string> result;
+	for (auto& id : get_include_dirs(working_dir_path, param_map))
+	{
+		// Header files are staged using their full path minus the root, see set_stage_includes().
+		result.push_back((filesystem::path(include_out_dir) / get_rootless_path(id)).u8string());
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Takes an exclusive lock on each of the output directories ('include_out_dir' and 'lib_out_dir'), waiting for
+/// the other runs that write to them to finish.  The lock files are kept next to the directories (e.g.
+/// '.include.minlib_lock' for 'include'), so that they aren't part of the bundle.  The locks are taken in
+/// the order of the paths, so that runs whose outputs overlap can't deadlock.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <returns>The locks, which are held until they're destroyed.</returns>
+vector<unique_ptr<file_lock>> bundler::lock_output_dirs(const parameter_map& param_map)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = (filesystem::current_path() / working_dir_path).u8string();
+
+	set<string> lock_filenames;
+	for (auto param_name : { cli::INCLUDE_OUT_DIR_PARAM, cli::LIB_OUT_DIR_PARAM })
+	{
+		auto out_dir = filesystem::path(get_expanded_path(param_map.at(param_name)));
+		if (out_dir.is_relative())
+			out_dir = working_dir_path / out_dir;
+
+		out_dir = out_dir.lexically_normal();
+		if (!out_dir.has_filename())
+			out_dir = out_dir.parent_path();
+
+		filesystem::create_directories(out_dir.parent_path());
+		lock_filenames.insert((out_dir.parent_path() / ("." + out_dir.filename().u8string() + ".minlib_lock")).u8string());
+	}
+
+	vector<unique_ptr<file_lock>> result;
+	auto waited = false;
+	for (auto& lock_filename : lock_filenames)
+	{
+		auto lock = make_unique<file_lock>(lock_filename);
+		if (!lock->try_lock())
+		{
+			// The run being waited for most likely holds the rest of the locks as well.
+			if (!waited)
+				cout << "Waiting for another run to release '" << lock_filename << "'..." << endl;
+			lock->lock();
+			waited = true;
+		}
+		result.push_back(move(lock));
+	}
+
+	return result;
 }
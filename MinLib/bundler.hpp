@@ -1,20 +1,35 @@
 #pragma once
 
 #include <map>
+#include <vector>
 #include <string>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include "parameter.hpp"
 #include "lib_bundle.hpp"
+#include "path_cache.hpp"
+#include "bounded_queue.hpp"
+#include "file_lock.hpp"
+#include "path_filter.hpp"
 
 class bundler
 {
 private:
 	static void prepare_stage(const std::string& include_dir, const std::string& lib_dir);
-	static void set_stage_includes(lib_bundle& bundle, const std::filesystem::path& working_dir_path, const std::string& stage_include_dir, std::map<std::string, std::string> param_map);
-	static void set_stage_libs(lib_bundle& bundle, const std::filesystem::path& working_dir_path, const std::string& stage_lib_dir, std::map<std::string, std::string> param_map);
-	static void set_target_includes(const std::filesystem::path& working_dir_path, const std::string& stage_include_dir, std::map<std::string, std::string> param_map);
-	static void set_target_libs(const std::filesystem::path& working_dir_path, const std::string& stage_lib_dir, std::map<std::string, std::string> param_map);
-	static void copy_files(const std::filesystem::path& working_dir_path, std::map<std::string, std::string> param_map);
+	static void set_stage_includes(const std::function<void(bounded_queue<std::string>&)>& produce, const std::filesystem::path& working_dir_path, const std::string& stage_include_dir, const parameter_map& param_map, path_cache& paths);
+	static std::vector<std::filesystem::path> get_lib_dependencies(const std::vector<std::filesystem::path>& lib_paths, const std::vector<std::string>& lib_dirs, size_t jobs, std::map<std::string, std::string>& out_sonames);
+	static void set_stage_libs(const lib_bundle& bundle, const std::filesystem::path& working_dir_path, const std::string& stage_lib_dir, const parameter_map& param_map);
+	static void set_target_includes(const std::filesystem::path& working_dir_path, const std::string& stage_include_dir, const parameter_map& param_map);
+	static void set_target_libs(const std::filesystem::path& working_dir_path, const std::string& stage_lib_dir, const parameter_map& param_map);
+	static void copy_files(const std::filesystem::path& working_dir_path, const parameter_map& param_map);
 
 public:
-	static void bundle_library(lib_bundle& bundle, std::map<std::string, std::string> param_map);
+	static std::vector<std::string> get_include_dirs(const std::filesystem::path& working_dir_path, const parameter_map& param_map);
+	static include_classifier get_include_classifier(const std::vector<std::string>& include_dirs, const parameter_map& param_map, path_cache& paths);
+	static void bundle_library(const lib_bundle& bundle, const parameter_map& param_map, path_cache& paths);
+	static lib_bundle bundle_library(const parameter_map& param_map, path_cache& paths, std::pmr::memory_resource* resource);
+	static lib_bundle select_includes(const lib_bundle& bundle, const parameter_map& param_map, path_cache& paths);
+	static std::vector<std::string> get_bundled_include_dirs(const parameter_map& param_map);
+	static std::vector<std::unique_ptr<file_lock>> lock_output_dirs(const parameter_map& param_map);
 };
\ No newline at end of file
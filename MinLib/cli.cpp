@@ -3,16 +3,19 @@
 #include <stdexcept>
 #include <regex>
 #include <filesystem>
+#include <algorithm>
+#include <thread>
 #include "errors.hpp"
 #include "config_template.hpp"
-#include "compiler.hpp"
-#include "bundler.hpp"
+#include "minlib.hpp"
+#include "server.hpp"
 
 using namespace std;
 using namespace minlib;
 
 vector<string> cli::REQUIRED_PARAMS{ "compiler", "input_file" };
 const char* cli::CONFIG_TEMPLATE_PARAM = "__config_template";
+const char* cli::STAGE_DIR_PARAM = "__stage_dir";
 const char* cli::COMPILER_PARAM = "compiler";
 const char* cli::INPUT_FILE_PARAM = "input_file";
 const char* cli::MSVC_BAT_PARAM = "msvc_vcvars32_bat";
@@ -24,10 +27,48 @@ const char* cli::LIBS_PARAM = "libs";
 const char* cli::INCLUDE_OUT_DIR_PARAM = "include_out_dir";
 const char* cli::LIB_OUT_DIR_PARAM = "lib_out_dir";
 const char* cli::COPY_FILES_PARAM = "copy_files";
+const char* cli::PRECOMPILED_HEADER_PARAM = "precompiled_header";
+const char* cli::PCH_FLAGS_PARAM = "pch_flags";
+const char* cli::HEADER_UNITS_PARAM = "header_units";
+const char* cli::HEADER_UNIT_FLAGS_PARAM = "header_unit_flags";
+const char* cli::JOBS_PARAM = "jobs";
+const char* cli::SOURCE_DIR_PARAM = "source_dir";
+const char* cli::INCLUDE_PREFIXES_PARAM = "include_prefixes";
+const char* cli::SCAN_CONDITIONALS_PARAM = "scan_conditionals";
+const char* cli::MINIFY_HEADERS_PARAM = "minify_headers";
+const char* cli::KEEP_LICENSE_PARAM = "keep_license";
+const char* cli::PIN_DEFS_PARAM = "pin_defs";
+const char* cli::ALLOC_STATS_PARAM = "alloc_stats";
+const char* cli::STRIP_LIBS_PARAM = "strip_libs";
+const char* cli::VERIFY_PARAM = "verify";
+const char* cli::COMPILE_COMMANDS_PARAM = "compile_commands";
+const char* cli::INCLUDE_FILTER_PARAM = "include_filter";
+const char* cli::EXCLUDE_FILTER_PARAM = "exclude_filter";
+const char* cli::SERVE_PARAM = "serve";
+const char* cli::SOCKET_PARAM = "socket";
+const char* cli::QUERY_PARAM = "query";
+const char* cli::MANIFEST_PARAM = "manifest";
+const char* cli::DELTA_BASE_PARAM = "delta_base";
+const char* cli::DELTA_PACK_PARAM = "delta_pack";
+const char* cli::APPLY_DELTA_PARAM = "apply_delta";
+
+/// <summary>
+/// Checks whether MinLib is run as a server, or to send a server a request that doesn't need
+/// the parameters of a run ('clear' or 'stop').
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+bool cli::is_server_command(const parameter_map& param_map)
+{
+	if (is_flag_set(param_map, SERVE_PARAM))
+		return true;
+
+	auto it = param_map.find(QUERY_PARAM);
+	return it != param_map.end() && (it->second == "clear" || it->second == "stop");
+}
 
-map<string, string> cli::compile_params(const vector<parameter>& params)
+parameter_map cli::compile_params(const vector<parameter>& params)
 {
-	map<string, string> param_map;
+	parameter_map param_map;
 
 	auto cfg_arg_found = false;
 	auto cfg_template_arg_found = false;
@@ -61,6 +102,28 @@ map<string, string> cli::compile_params(const vector<parameter>& params)
 					param_map.insert({ string("__config_template"), p.value });
 				}
 			}
+			else if (p.value == string("--verify"))
+			{
+				// Shorthand for 'verify=true'.
+				if (cfg_template_arg_found)
+					throw runtime_error(CONFIG_TEMPLATE_ARG_ERROR);
+
+				parameter verify_param;
+				verify_param.name = VERIFY_PARAM;
+				verify_param.value = "true";
+				add_param(verify_param);
+			}
+			else if (p.value == string("--serve"))
+			{
+				// Shorthand for 'serve=true'.
+				if (cfg_template_arg_found)
+					throw runtime_error(CONFIG_TEMPLATE_ARG_ERROR);
+
+				parameter serve_param;
+				serve_param.name = SERVE_PARAM;
+				serve_param.value = "true";
+				add_param(serve_param);
+			}
 			else  
 			{
 				if (cfg_arg_found) // Only the config file parameter is passed in without a name.
@@ -99,26 +162,52 @@ map<string, string> cli::compile_params(const vector<parameter>& params)
 	return param_map;
 }
 
-void cli::check_required_params(const map<string, string>& param_map)
+void cli::check_required_params(const parameter_map& param_map)
 {
 	// If the user passed in '--config' as a command-line arg, then no
 	// other parameters are required.
 	if (param_map.find("__config_template") != param_map.end())
 		return;
 
+	// The server takes the parameters of each run with the request.
+	if (is_server_command(param_map))
+		return;
+
+	// Applying a delta pack only needs the output directories.
+	if (param_map.find(APPLY_DELTA_PARAM) != param_map.end())
+		return;
+
+	// When the bundle is built from the project's dependency files, the input file
+	// is only needed by the steps that compile the top-level includes.
+	auto input_file_optional = param_map.find(COMPILE_COMMANDS_PARAM) != param_map.end()
+		&& !is_flag_set(param_map, VERIFY_PARAM)
+		&& !is_flag_set(param_map, HEADER_UNITS_PARAM)
+		&& !is_flag_set(param_map, PRECOMPILED_HEADER_PARAM);
+
 	for (auto& rp : REQUIRED_PARAMS)
 	{
+		if (rp == INPUT_FILE_PARAM && input_file_optional)
+			continue;
+
 		if (param_map.find(rp) == param_map.end())
 			throw runtime_error(regex_replace(MISSING_ARG_ERROR, regex("%s"), rp));
 	}
+
+	// A delta pack is made from a previous manifest, which is of no use otherwise.
+	auto is_set = [&param_map](const char* param_name) {
+		auto it = param_map.find(param_name);
+		return it != param_map.end() && it->second != "";
+	};
+	if (is_set(DELTA_BASE_PARAM) != is_set(DELTA_PACK_PARAM))
+		throw runtime_error(DELTA_PARAMS_ERROR);
 }
 
-void cli::set_default_param_values(map<string, string>& param_map)
+void cli::set_default_param_values(parameter_map& param_map)
 {
 	auto it = param_map.find("__config_template");
-	if (it != param_map.end()) return;
+	if (it != param_map.end() || is_server_command(param_map)) return;
 
-	auto set_param = [&param_map](map<string, string>::iterator it, string name, string value) {
+	auto set_param = [&param_map](parameter_map::iterator it, string name, string value) {
 		if (it == param_map.end())
 			param_map.insert({ name, value });
 		else
@@ -128,7 +217,7 @@ void cli::set_default_param_values(map<string, string>& param_map)
 	// Try to find the vcvars32.bat file, if the path to it wasn't specified using the 'msvc_vcvars32_bat' parameter.
 	auto set_msvc_vcvars32_bat = [&param_map, &set_param]() {
 		string param_name(MSVC_BAT_PARAM);
-		if (map<string, string>::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
+		if (parameter_map::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
 		{
 			string path_template("C:\\Program Files (x86)\\Microsoft Visual Studio\\@version@\\@edition@\\VC\\Auxiliary\\Build\\vcvars32.bat");
 			string path;
@@ -155,37 +244,36 @@ void cli::set_default_param_values(map<string, string>& param_map)
 
 	auto set_working_dir = [&param_map, &set_param]() {
 		string param_name(WORKING_DIR_PARAM);
-		if (map<string, string>::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
+		if (parameter_map::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
 			set_param(it, param_name, filesystem::current_path().u8string());
 	};
 
 	auto set_include_dir = [&param_map, &set_param]() {
 		string param_name(INCLUDE_DIR_PARAM);
-		if (map<string, string>::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
+		if (parameter_map::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
 			set_param(it, param_name, filesystem::current_path().u8string());
 	};
 
 	auto set_lib_dir = [&param_map, &set_param]() {
 		string param_name(LIB_DIR_PARAM);
-		if (map<string, string>::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
+		if (parameter_map::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
 			set_param(it, param_name, filesystem::current_path().u8string());
 	};
 
 	auto set_include_out_dir = [&param_map, &set_param]() {
 		string param_name(INCLUDE_OUT_DIR_PARAM);
-		if (map<string, string>::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
+		if (parameter_map::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
 			set_param(it, param_name, (filesystem::current_path() / "include").u8string());
 	};
 
 	auto set_lib_out_dir = [&param_map, &set_param]() {
 		string param_name(LIB_OUT_DIR_PARAM);
-		if (map<string, string>::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
+		if (parameter_map::iterator it = param_map.find(param_name); it == param_map.end() || it->second == "")
 			set_param(it, param_name, (filesystem::current_path() / "lib").u8string());
 	};
 
 	// Ensure that the vcvars32.bat file is found if MSVC was the chosen compiler.
-	auto compiler_param = param_map.at(cli::COMPILER_PARAM);
-	if (compiler_param == "msvc")
+	if (auto it = param_map.find(cli::COMPILER_PARAM); it != param_map.end() && it->second == "msvc")
 		set_msvc_vcvars32_bat();
 
 	set_working_dir();
@@ -195,7 +283,50 @@ void cli::set_default_param_values(map<string, string>& param_map)
 	set_lib_out_dir();
 }
 
-map<string, string> cli::process_params(const vector<parameter>& params)
+/// <summary>
+/// Checks whether an optional on/off parameter was enabled.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="param_name">The name of the parameter.</param>
+/// <returns>Returns true if the parameter was set to 'true', 'yes', 'on' or '1'.</returns>
+bool cli::is_flag_set(const parameter_map& param_map, const char* param_name)
+{
+	auto it = param_map.find(param_name);
+	if (it == param_map.end())
+		return false;
+
+	auto value = it->second;
+	transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return (char)tolower(c); });
+
+	return value == "true" || value == "yes" || value == "on" || value == "1";
+}
+
+/// <summary>
+/// Gets the maximum number of jobs (threads or compiler processes) that MinLib may run in parallel.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <returns>The value of the 'jobs' parameter, if set, otherwise the number of hardware threads.</returns>
+size_t cli::get_job_count(const parameter_map& param_map)
+{
+	if (auto it = param_map.find(JOBS_PARAM); it != param_map.end() && it->second != "")
+	{
+		try
+		{
+			// The whole value has to be a number, so that e.g. '4x' or '2.5' are rejected.
+			size_t end;
+			auto jobs = stoi(it->second, &end);
+			if (jobs > 0 && end == it->second.size()) return (size_t)jobs;
+		}
+		catch (...) {}
+
+		throw runtime_error(regex_replace(INVALID_JOBS_ARG_ERROR, regex("%s"), it->second));
+	}
+
+	auto hardware_threads = thread::hardware_concurrency();
+	return hardware_threads > 0 ? hardware_threads : 1;
+}
+
+parameter_map cli::process_params(const vector<parameter>& params)
 {
 	if (params.size() == 0)
 		throw runtime_error(NO_ARGS_ERROR);
@@ -214,27 +345,41 @@ map<string, string> cli::process_params(const vector<parameter>& params)
 	return param_map;
 }
 
-int cli::run_command(map<string, string>& param_map)
+/// <summary>
+/// Runs MinLib as the executable does, printing the config template if '--config' was passed.
+/// </summary>
+/// <param name="params">The parameters passed into the program.</param>
+/// <returns>The exit code.</returns>
+int cli::run_command(const vector<parameter>& params)
 {
-	if (map<string, string>::iterator it = param_map.find(cli::CONFIG_TEMPLATE_PARAM); it != param_map.end())
+	minlib::configuration config(params);
+
+	if (config.is_config_template())
 	{
 		// Print the config template to stdout, then exit the program.
 		cout << CONFIG_TEMPLATE << endl;
 		return 0;
 	}
 
-	cout << "MinLib is running..." << endl;
+	// Run as a server, or send a request to one.
+	auto& param_map = config.get_params();
+	if (is_flag_set(param_map, SERVE_PARAM))
+		return server(param_map).run();
+	if (param_map.find(QUERY_PARAM) != param_map.end())
+		return server::query(param_map);
 
-	// Invoke the compiler's preprocessor to have it evaluate all
-	// the specified header files listed in the input file.
-	compiler::run_preprocessor(param_map);
+	minlib::session session;
 
-	// Comb through the output of the preprocessor, building a 
-	// list of all the header and lib files to be bundled.
-	auto bundle = compiler::parse_preprocessor_output(param_map);
+	// Patch the bundle in the output directories instead of bundling.
+	if (param_map.find(APPLY_DELTA_PARAM) != param_map.end())
+	{
+		session.apply_delta(config);
+		return 0;
+	}
+
+	cout << "MinLib is running..." << endl;
 
-	// Create the bundle and save to the specified output directories.
-	bundler::bundle_library(bundle, param_map);
+	session.run(config);
 
 	cout << "MinLib completed successfully." << endl;
 
@@ -11,6 +11,7 @@ private:
 
 public:
 	static const char* CONFIG_TEMPLATE_PARAM;
+	static const char* STAGE_DIR_PARAM;
 	static const char* COMPILER_PARAM;
 	static const char* INPUT_FILE_PARAM;
 	static const char* MSVC_BAT_PARAM;
@@ -22,13 +23,40 @@ public:
 	static const char* INCLUDE_OUT_DIR_PARAM; 
 	static const char* LIB_OUT_DIR_PARAM;
 	static const char* COPY_FILES_PARAM;
+	static const char* PRECOMPILED_HEADER_PARAM;
+	static const char* PCH_FLAGS_PARAM;
+	static const char* HEADER_UNITS_PARAM;
+	static const char* HEADER_UNIT_FLAGS_PARAM;
+	static const char* JOBS_PARAM;
+	static const char* SOURCE_DIR_PARAM;
+	static const char* INCLUDE_PREFIXES_PARAM;
+	static const char* SCAN_CONDITIONALS_PARAM;
+	static const char* MINIFY_HEADERS_PARAM;
+	static const char* KEEP_LICENSE_PARAM;
+	static const char* PIN_DEFS_PARAM;
+	static const char* ALLOC_STATS_PARAM;
+	static const char* STRIP_LIBS_PARAM;
+	static const char* VERIFY_PARAM;
+	static const char* COMPILE_COMMANDS_PARAM;
+	static const char* INCLUDE_FILTER_PARAM;
+	static const char* EXCLUDE_FILTER_PARAM;
+	static const char* SERVE_PARAM;
+	static const char* SOCKET_PARAM;
+	static const char* QUERY_PARAM;
+	static const char* MANIFEST_PARAM;
+	static const char* DELTA_BASE_PARAM;
+	static const char* DELTA_PACK_PARAM;
+	static const char* APPLY_DELTA_PARAM;
 
 private:
-	static std::map<std::string, std::string> compile_params(const std::vector<parameter>& params);
-	static void check_required_params(const std::map<std::string, std::string>& param_map);
-	static void set_default_param_values(std::map<std::string, std::string>& param_map);
+	static bool is_server_command(const parameter_map& param_map);
+	static parameter_map compile_params(const std::vector<parameter>& params);
+	static void check_required_params(const parameter_map& param_map);
+	static void set_default_param_values(parameter_map& param_map);
 
 public:
-	static std::map<std::string, std::string> process_params(const std::vector<parameter>& params);
-	static int run_command(std::map<std::string, std::string>& param_map);
+	static bool is_flag_set(const parameter_map& param_map, const char* param_name);
+	static size_t get_job_count(const parameter_map& param_map);
+	static parameter_map process_params(const std::vector<parameter>& params);
+	static int run_command(const std::vector<parameter>& params);
 };
\ No newline at end of file
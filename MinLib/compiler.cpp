@@ -1,24 +1,55 @@
 #include "compiler.hpp"
 #include <regex>
+#include <iostream>
 #include <numeric>
 #include <fstream>
-#include <sstream>
 #include <filesystem>
+#include <set>
+#include <unordered_set>
 #include "file_utils.hpp"
+#include "parallel_utils.hpp"
 #include "string_utils.hpp"
 #include "cli.hpp"
+#include "bundler.hpp"
+#include "errors.hpp"
+#include "path_cache.hpp"
 
 using namespace std;
+using namespace minlib;
 
 // CL.exe should be run in either the Developer Command Prompt for Visual Studio
 // or a regular command prompt but only after the vcvars32.bat file has been run.
 const char* compiler::msvc_template = "@echo off\r\n\
 call \"@msvc_vcvars32_bat@\"\r\n\
-cd \"@working_dir@\\minlib_stage\"\r\n\
+cd \"@stage_dir@\"\r\n\
 cl /P /MP /Fi:preprocessor_output.txt @includes@ @defs@ @input_file@\r\n\
 ";
 
-const char* compiler::gcc_template = "cd \"@working_dir@\\minlib_stage\" && g++ -E -Wall -x c++ -o preprocessor_output.txt @includes@ @defs@ @input_file@";
+const char* compiler::gcc_template = "cd \"@stage_dir@\" && g++ -E -Wall -x c++ -o preprocessor_output.txt @includes@ @defs@ @input_file@";
+
+// The precompiled header is built from a stub source file, as CL.exe can only
+// create a PCH (/Yc) while compiling a translation unit.
+const char* compiler::msvc_pch_template = "@echo off\r\n\
+call \"@msvc_vcvars32_bat@\"\r\n\
+cd \"@include_out_dir@\"\r\n\
+cl /c /nologo /EHsc @flags@ @includes@ @defs@ /Yc\"@header_file@\" /Fp\"@pch_file@\" /Fo\"@obj_file@\" \"@source_file@\"\r\n\
+";
+
+const char* compiler::gcc_pch_template = "cd \"@include_out_dir@\" && g++ -x c++-header @flags@ @includes@ @defs@ -o \"@pch_file@\" \"@header_file@\"";
+
+// The module mapper tells GCC where to write the compiled header unit and where to find
+// the ones it depends on, as includes of other header units are translated into imports.
+const char* compiler::gcc_header_unit_template = "cd \"@include_out_dir@\" && g++ -std=c++20 -fmodules-ts -fmodule-mapper=\"@mapper_file@\" -x c++-header @flags@ @includes@ @defs@ \"@header_file@\"";
+
+// The verification checks run concurrently, so each one gets its own batch file, source and output files.
+// The compiler's diagnostics (including the chain of includes) are captured for the report.
+const char* compiler::msvc_verify_template = "@echo off\r\n\
+call \"@msvc_vcvars32_bat@\" > nul\r\n\
+cd \"@verify_dir@\"\r\n\
+cl /P /nologo /showIncludes /Fi\"@output_file@\" @includes@ @defs@ \"@source_file@\" > \"@diagnostics_file@\" 2>&1\r\n\
+";
+
+const char* compiler::gcc_verify_template = "cd \"@verify_dir@\" && g++ -E -x c++ -o \"@output_file@\" @includes@ @defs@ \"@source_file@\" 2> \"@diagnostics_file@\"";
 
 
 /// <summary>
@@ -30,15 +61,15 @@ const char* compiler::gcc_template = "cd \"@working_dir@\\minlib_stage\" && g++
 /// directives precede the content of the file they represent.
 /// </summary>
 /// <param name="param_map">The parameters passed into the program.</param>
-void compiler::run_preprocessor(map<string, string> param_map)
+void compiler::run_preprocessor(const parameter_map& param_map)
 {
 	// Set the working directory.
 	auto working_dir_path = get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM));
 	if (filesystem::path(working_dir_path).is_relative())
 		working_dir_path = (filesystem::current_path() / filesystem::path(working_dir_path)).u8string();
 
-	// Create the main staging directory.
-	auto stage_path = filesystem::path(working_dir_path) / filesystem::path("minlib_stage");
+	// Empty the run's staging directory (see stage_dir), in case the configuration is reused.
+	auto stage_path = filesystem::u8path(param_map.at(cli::STAGE_DIR_PARAM));
 	if (filesystem::exists(stage_path) && filesystem::is_directory(stage_path))
 		filesystem::remove_all(stage_path);
 	filesystem::create_directory(stage_path);
@@ -53,11 +84,11 @@ void compiler::run_preprocessor(map<string, string> param_map)
 
 	auto preprocess_msvc = [&]() {
 		auto bat = regex_replace(msvc_template, regex("\\@msvc_vcvars32_bat\\@"), get_expanded_path(param_map.at(cli::MSVC_BAT_PARAM)));
-		bat = regex_replace(bat, regex("\\@working_dir\\@"), working_dir_path);
+		bat = regex_replace(bat, regex("\\@stage_dir\\@"), stage_path.u8string());
 		bat = regex_replace(bat, regex("\\@input_file\\@"), get_full_path(param_map.at(cli::INPUT_FILE_PARAM)));
 
 		string includes; // Additional include directories for the compiler to consider.
-		if (map<string, string>::iterator it = param_map.find(cli::INCLUDE_DIR_PARAM); it != param_map.end())
+		if (parameter_map::const_iterator it = param_map.find(cli::INCLUDE_DIR_PARAM); it != param_map.end())
 		{
 			auto includes_param = it->second;
 			auto includes_vec = parameter::get_param_values(includes_param);
@@ -68,7 +99,7 @@ void compiler::run_preprocessor(map<string, string> param_map)
 		bat = regex_replace(bat, regex("\\@includes\\@"), includes);
 
 		string defs; // Additional definitions for the compiler to define.
-		if (map<string, string>::iterator it = param_map.find(cli::DEFS_PARAM); it != param_map.end())
+		if (parameter_map::const_iterator it = param_map.find(cli::DEFS_PARAM); it != param_map.end())
 		{
 			auto defs_param = it->second;
 			auto defs_vec = parameter::get_param_values(defs_param);
@@ -87,15 +118,17 @@ void compiler::run_preprocessor(map<string, string> param_map)
 	};
 
 	auto preprocess_gcc = [&]() {
-		auto cmd = regex_replace(gcc_template, regex("\\@working_dir\\@"), working_dir_path);
+		auto cmd = regex_replace(gcc_template, regex("\\@stage_dir\\@"), stage_path.u8string());
 		auto input_file = param_map.at(cli::INPUT_FILE_PARAM);
-		auto input_file_new_name = input_file.substr(0, input_file.find_last_of('.')) + ".cpp";
+		// Only the name is kept, so that an input file given by an absolute path or within a subdirectory
+		// is still copied into the staging directory.
+		auto input_file_new_name = filesystem::u8path(input_file).stem().u8string() + ".cpp";
 		auto input_file_path = stage_path / input_file_new_name;
 		filesystem::copy(get_full_path(input_file), input_file_path);
 		cmd = regex_replace(cmd, regex("\\@input_file\\@"), input_file_path.u8string());
 
 		string includes; // Additional include directories for the compiler to consider.
-		if (map<string, string>::iterator it = param_map.find(cli::INCLUDE_DIR_PARAM); it != param_map.end())
+		if (parameter_map::const_iterator it = param_map.find(cli::INCLUDE_DIR_PARAM); it != param_map.end())
 		{
 			auto includes_param = it->second;
 			auto includes_vec = parameter::get_param_values(includes_param);
@@ -106,7 +139,7 @@ void compiler::run_preprocessor(map<string, string> param_map)
 		cmd = regex_replace(cmd, regex("\\@includes\\@"), includes);
 
 		string defs; // Additional definitions for the compiler to define.
-		if (map<string, string>::iterator it = param_map.find(cli::DEFS_PARAM); it != param_map.end())
+		if (parameter_map::const_iterator it = param_map.find(cli::DEFS_PARAM); it != param_map.end())
 		{
 			auto defs_param = it->second;
 			auto defs_vec = parameter::get_param_values(defs_param);
@@ -135,58 +168,739 @@ void compiler::run_preprocessor(map<string, string> param_map)
 /// specified lib directories.  
 /// </summary>
 /// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="paths">The cache used to canonicalize the paths of the header files.</param>
+/// <param name="resource">The memory resource to allocate the bundle from, e.g. the run's arena.</param>
+/// <param name="on_include_file">Optional callback, invoked as soon as a header file is found for the first time.</param>
 /// <returns>Returns the list of header/lib files that should be bundled.</returns>
-lib_bundle compiler::parse_preprocessor_output(map<string, string> param_map)
+lib_bundle compiler::parse_preprocessor_output(const parameter_map& param_map, path_cache& paths, pmr::memory_resource* resource, const function<void(string_view)>& on_include_file)
 {
-	lib_bundle result;
+	lib_bundle result(resource);
 
-	auto working_dir_path = get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM));
-	auto stage_path = filesystem::path(working_dir_path) / filesystem::path("minlib_stage");
+	auto stage_path = filesystem::u8path(param_map.at(cli::STAGE_DIR_PARAM));
 	auto filename = stage_path / "preprocessor_output.txt";
 
 	ifstream file_stream(filename);
 	string line;
 
+	// The chain of files currently being processed, used to build the include graph.
+	pmr::vector<pmr::string> file_stack(resource);
+	pmr::unordered_set<pmr::string> seen_files(resource);
+	pmr::unordered_set<pmr::string> seen_canonical_paths(resource);
+
 	while (getline(file_stream, line))
 	{
-		line = str_trim(line);
-		if (line.substr(0, 1) == "#") // Line directives begin with the pound sign.
+		auto directive = sv_trim(line);
+		if (!directive.empty() && directive[0] == '#') // Line directives begin with the pound sign.
 		{
-			istringstream ss(line);
-			string ignored, line_num, path;
-			ss >> ignored >> line_num; // Line directives have multiple parts separated by spaces.
+			sv_tokenizer tokens(directive);
+			string_view ignored, line_num;
+			tokens.next(ignored);
+			tokens.next(line_num); // Line directives have multiple parts separated by spaces.
 
 			if (find_if(line_num.begin(), line_num.end(), [](unsigned char c) {
 					return !isdigit(c); // 'include' line directives have a line number as the second part, 'lib' line directives do not.
 				}) != line_num.end())
 			{
-				if (line.rfind("#pragma comment(lib,", 0) == 0)
+				if (directive.substr(0, 20) == "#pragma comment(lib,")
 				{
-					auto lib_name = line.substr(20);
-					lib_name = regex_replace(lib_name, regex("[\\\"\\ \\)]"), "");
-					if (find(result.lib_files.begin(), result.lib_files.end(), lib_name) == result.lib_files.end())
-						result.lib_files.push_back(lib_name);
+					auto lib_name = regex_replace(string(directive.substr(20)), regex("[\\\"\\ \\)]"), "");
+					if (find(result.lib_files.begin(), result.lib_files.end(), string_view(lib_name)) == result.lib_files.end())
+						result.lib_files.emplace_back(lib_name);
 				}
 
 				continue;
 			}
 
-			ss >> path;
-	
-			path = regex_replace(path, regex("\\\\\\\\"), "\\");  // Replace double-slashes with single-slashes.
-			path = regex_replace(path, regex("/"), "\\");  // If environment variables are used in the paths, the slashes may not be correct/consistent.
-			path = regex_replace(path, regex("\\\""), ""); // Remove double-quotes.
-
-			auto partition = path.substr(0, 2);
-			string include_to;
+			// The path is quoted and may contain spaces; the quotes are removed when it is normalized.
+			auto rest = sv_ltrim(tokens.rest());
+			auto path_end = rest.find_first_of(SV_WHITESPACE);
+			if (!rest.empty() && rest[0] == '"')
+			{
+				path_end = 1;
+				while (path_end < rest.size() && rest[path_end] != '"')
+					path_end += rest[path_end] == '\\' ? 2 : 1;
+				path_end = min(path_end + 1, rest.size());
+			}
+			if (path_end == string_view::npos) path_end = rest.size();
 
-			if (!regex_match(partition, regex("[A-Za-z]:")))
-				path = regex_replace(path, regex("\\"), "/"); // Correct the slash type if on *nix.
+			auto path = normalize_path(rest.substr(0, path_end), resource);
 
-			if (find(result.include_files.begin(), result.include_files.end(), path) == result.include_files.end())
+			// The same header may be reached through different paths (symlinks, '..' segments, etc).
+			string canonical_path;
+			if (seen_files.insert(path).second && (!paths.get_canonical_path(string(path), canonical_path) || seen_canonical_paths.emplace(canonical_path.data(), canonical_path.size()).second))
+			{
 				result.include_files.push_back(path);
+				if (on_include_file) on_include_file(path);
+			}
+
+			// GCC's line markers end with flags indicating that a file is being entered (1)
+			// or that processing has returned to a file (2).
+			auto entering = false, returning = false;
+			for (auto flag : sv_split(rest.substr(path_end)))
+			{
+				if (flag == "1") entering = true;
+				else if (flag == "2") returning = true;
+			}
+
+			if (entering && !file_stack.empty())
+			{
+				auto& children = result.include_graph[file_stack.back()];
+				if (find(children.begin(), children.end(), path) == children.end())
+					children.push_back(path);
+				file_stack.push_back(path);
+			}
+			else if (returning)
+			{
+				while (file_stack.size() > 1 && file_stack.back() != path)
+					file_stack.pop_back();
+			}
+			else if (file_stack.empty())
+			{
+				file_stack.push_back(path);
+			}
+			else
+			{
+				file_stack.back() = path;
+			}
 		}
 	}
 	
 	return result;
 }
+
+/// <summary>
+/// Normalizes a path found in a line directive, so that the same file is always referred to using the same string.
+/// </summary>
+/// <param name="path">The path, as written by the preprocessor.</param>
+/// <param name="resource">The memory resource to allocate the normalized path from.</param>
+/// <returns>The normalized path.</returns>
+pmr::string compiler::normalize_path(string_view path, pmr::memory_resource* resource)
+{
+	// Replace double-slashes with single-slashes.  If environment variables are used in the paths, the
+	// slashes may not be correct/consistent, so forward slashes are replaced as well.  Double-quotes are removed.
+	pmr::string result(resource);
+	result.reserve(path.size());
+	for (size_t i = 0; i < path.size(); ++i)
+	{
+		auto c = path[i];
+		if (c == '"') continue;
+		if (c == '\\' && i + 1 < path.size() && path[i + 1] == '\\') ++i;
+		result += c == '/' ? '\\' : c;
+	}
+
+	auto has_drive = result.size() >= 2 && isalpha((unsigned char)result[0]) && result[1] == ':';
+
+	if (!has_drive)
+		replace(result.begin(), result.end(), '\\', '/'); // Correct the slash type if on *nix.
+
+	return result;
+}
+
+/// <summary>
+/// Gets the names of the header files included by the input file, as written in the
+/// #include statements (e.g. 'boost/thread.hpp').
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <returns>The list of top-level includes, in order of appearance.</returns>
+vector<string> compiler::get_top_level_includes(const parameter_map& param_map)
+{
+	auto working_dir_path = get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM));
+	auto input_file = filesystem::path(get_expanded_path(param_map.at(cli::INPUT_FILE_PARAM)));
+	if (input_file.is_relative())
+		input_file = filesystem::path(working_dir_path) / input_file;
+
+	ifstream file_stream(input_file);
+	string line;
+	smatch match;
+	regex include_regex("^\\s*#\\s*include\\s*[<\"]([^>\"]+)[>\"]");
+	vector<string> result;
+
+	while (getline(file_stream, line))
+	{
+		if (regex_search(line, match, include_regex))
+		{
+			auto header = match.str(1);
+			if (find(result.begin(), result.end(), header) == result.end())
+				result.push_back(header);
+		}
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Builds a precompiled header from the input file, compiled against the bundled header files
+/// (rather than the target library's include directories) using the same definitions.  The
+/// header, the precompiled header and a response file containing the flags needed to use it
+/// are written to the include target directory, next to the bundle.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+void compiler::build_precompiled_header(const parameter_map& param_map)
+{
+	auto working_dir_path = get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM));
+	if (filesystem::path(working_dir_path).is_relative())
+		working_dir_path = (filesystem::current_path() / filesystem::path(working_dir_path)).u8string();
+
+	auto get_full_path = [&](const string& path) {
+		filesystem::path p(get_expanded_path(path));
+		if (p.is_relative())
+			return (filesystem::path(working_dir_path) / p).u8string();
+		else
+			return p.u8string();
+	};
+
+	auto include_out_dir = get_full_path(param_map.at(cli::INCLUDE_OUT_DIR_PARAM));
+	auto input_file = get_full_path(param_map.at(cli::INPUT_FILE_PARAM));
+	auto stem = filesystem::path(input_file).stem().u8string();
+
+	// The header that consumers force-include is simply a copy of the input file,
+	// placed within the include target directory so the bundle is self-contained.
+	auto header_path = filesystem::path(include_out_dir) / (stem + ".pch.hpp");
+	filesystem::create_directories(include_out_dir);
+	filesystem::copy(input_file, header_path, filesystem::copy_options::overwrite_existing);
+
+	auto bundled_include_dirs = bundler::get_bundled_include_dirs(param_map);
+	auto defs_vec = vector<string>();
+	if (parameter_map::const_iterator it = param_map.find(cli::DEFS_PARAM); it != param_map.end())
+		defs_vec = parameter::get_param_values(it->second);
+
+	string flags; // Additional flags, which must match those used by the consumer for the PCH to be valid.
+	if (parameter_map::const_iterator it = param_map.find(cli::PCH_FLAGS_PARAM); it != param_map.end())
+		flags = it->second;
+
+	auto run = [&](const string& cmd, const filesystem::path& pch_path) {
+		if (system(cmd.c_str()) != 0 || !filesystem::exists(pch_path))
+			throw runtime_error(regex_replace(PCH_BUILD_ERROR, regex("%s"), header_path.u8string()));
+	};
+
+	auto build_msvc = [&]() {
+		auto pch_path = filesystem::path(include_out_dir) / (stem + ".pch");
+		auto obj_path = filesystem::path(include_out_dir) / (stem + ".pch.obj");
+		auto source_path = filesystem::path(include_out_dir) / (stem + ".pch.cpp");
+
+		ofstream source_file(source_path);
+		source_file << "#include \"" << header_path.filename().u8string() << "\"" << endl;
+		source_file.close();
+
+		string includes, defs;
+		for (auto& i : bundled_include_dirs)
+			includes += "/I\"" + i + "\" ";
+		for (auto& d : defs_vec)
+			defs += "/D " + d + " ";
+
+		auto bat = regex_replace(msvc_pch_template, regex("\\@msvc_vcvars32_bat\\@"), get_expanded_path(param_map.at(cli::MSVC_BAT_PARAM)));
+		bat = regex_replace(bat, regex("\\@include_out_dir\\@"), include_out_dir);
+		bat = regex_replace(bat, regex("\\@flags\\@"), flags);
+		bat = regex_replace(bat, regex("\\@includes\\@"), includes);
+		bat = regex_replace(bat, regex("\\@defs\\@"), defs);
+		bat = regex_replace(bat, regex("\\@header_file\\@"), header_path.filename().u8string());
+		bat = regex_replace(bat, regex("\\@pch_file\\@"), pch_path.u8string());
+		bat = regex_replace(bat, regex("\\@obj_file\\@"), obj_path.u8string());
+		bat = regex_replace(bat, regex("\\@source_file\\@"), source_path.u8string());
+
+		auto bat_path = filesystem::path(include_out_dir) / (stem + ".pch.bat");
+		ofstream bat_file(bat_path);
+		bat_file << bat;
+		bat_file.close();
+
+		run(bat_path.u8string(), pch_path);
+		filesystem::remove(bat_path);
+
+		// Translation units must use the PCH via /Yu and the object file created
+		// alongside it has to be linked into the consuming project.
+		ofstream rsp_file(filesystem::path(include_out_dir) / (stem + ".pch.rsp"));
+		rsp_file << flags << " " << includes << defs
+			<< "/FI\"" << header_path.u8string() << "\" "
+			<< "/Yu\"" << header_path.u8string() << "\" "
+			<< "/Fp\"" << pch_path.u8string() << "\"" << endl;
+	};
+
+	auto build_gcc = [&]() {
+		// GCC automatically picks up 'header.gch' when 'header' is included.
+		auto pch_path = filesystem::path(include_out_dir) / (header_path.filename().u8string() + ".gch");
+
+		string includes, defs;
+		for (auto& i : bundled_include_dirs)
+			includes += "-I\"" + i + "\" ";
+		for (auto& d : defs_vec)
+			defs += "-D " + d + " ";
+
+		auto cmd = regex_replace(gcc_pch_template, regex("\\@include_out_dir\\@"), include_out_dir);
+		cmd = regex_replace(cmd, regex("\\@flags\\@"), flags);
+		cmd = regex_replace(cmd, regex("\\@includes\\@"), includes);
+		cmd = regex_replace(cmd, regex("\\@defs\\@"), defs);
+		cmd = regex_replace(cmd, regex("\\@pch_file\\@"), pch_path.u8string());
+		cmd = regex_replace(cmd, regex("\\@header_file\\@"), header_path.u8string());
+
+		run(cmd, pch_path);
+
+		ofstream rsp_file(filesystem::path(include_out_dir) / (stem + ".pch.rsp"));
+		rsp_file << "-Winvalid-pch " << flags << " " << includes << defs
+			<< "-include \"" << header_path.u8string() << "\"" << endl;
+	};
+
+	auto compiler_param = param_map.at(cli::COMPILER_PARAM);
+	if (compiler_param == "msvc")
+		build_msvc();
+	else if (compiler_param == "gcc")
+		build_gcc();
+}
+
+/// <summary>
+/// Builds the bundled header files that are included directly by the input file as C++20 header
+/// units, along with a module mapper file that maps each header to its compiled module interface.
+/// A header unit can only be built once the header units it (transitively) includes are built,
+/// so the headers are built in waves, as ordered by the include graph, with the headers of each
+/// wave being built in parallel.
+/// </summary>
+/// <param name="bundle">The bundle produced by the compiler.</param>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="paths">The cache used to canonicalize the include directories and header files.</param>
+void compiler::build_header_units(const lib_bundle& bundle, const parameter_map& param_map, path_cache& paths)
+{
+	if (param_map.at(cli::COMPILER_PARAM) != "gcc")
+		throw runtime_error(HEADER_UNITS_COMPILER_ERROR);
+
+	auto working_dir_path = get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM));
+	if (filesystem::path(working_dir_path).is_relative())
+		working_dir_path = (filesystem::current_path() / filesystem::path(working_dir_path)).u8string();
+
+	auto get_full_path = [&](const string& path) {
+		filesystem::path p(get_expanded_path(path));
+		if (p.is_relative())
+			return (filesystem::path(working_dir_path) / p).u8string();
+		else
+			return p.u8string();
+	};
+
+	auto include_out_dir = get_full_path(param_map.at(cli::INCLUDE_OUT_DIR_PARAM));
+	auto stem = filesystem::path(get_full_path(param_map.at(cli::INPUT_FILE_PARAM))).stem().u8string();
+	auto cache_dir = filesystem::path(include_out_dir) / "gcm.cache";
+	auto mapper_path = filesystem::path(include_out_dir) / (stem + ".modmap");
+
+	auto include_dirs = bundler::get_include_dirs(filesystem::u8path(working_dir_path), param_map);
+	auto classifier = bundler::get_include_classifier(include_dirs, param_map, paths);
+
+	// Only the top-level headers that belong to the target library, and were bundled (i.e. pass the
+	// filters), are built.  The paths are resolved the same way the preprocessor does, so they match
+	// those in the include graph.
+	vector<string> units;
+	size_t dir_index;
+	string relative_path;
+	for (auto& header : get_top_level_includes(param_map))
+	{
+		for (auto& id : include_dirs)
+		{
+			auto path = string(normalize_path((filesystem::path(id) / header).u8string()));
+			if (filesystem::is_regular_file(path))
+			{
+				if (classifier.classify(path, dir_index, relative_path) && find(units.begin(), units.end(), path) == units.end())
+					units.push_back(path);
+				break;
+			}
+		}
+	}
+
+	// Find the other header units that each header unit depends on, by walking the include graph.
+	set<string> unit_set(units.begin(), units.end());
+	map<string, set<string>> unit_deps;
+	for (auto& unit : units)
+	{
+		set<string> visited;
+		vector<string> pending{ unit };
+
+		while (!pending.empty())
+		{
+			auto file = pending.back();
+			pending.pop_back();
+
+			auto it = bundle.include_graph.find(string_view(file));
+			if (it == bundle.include_graph.end()) continue;
+
+			for (auto& child_path : it->second)
+			{
+				auto child = string(child_path);
+				if (!visited.insert(child).second) continue;
+				if (child != unit && unit_set.count(child) > 0) unit_deps[unit].insert(child);
+				pending.push_back(child);
+			}
+		}
+	}
+
+	auto get_bundled_path = [&](const string& header) {
+		return (filesystem::path(include_out_dir) / get_rootless_path(header)).u8string();
+	};
+
+	auto get_cmi_path = [&](const string& header) {
+		return (cache_dir / (get_rootless_path(header) + ".gcm")).u8string();
+	};
+
+	ofstream mapper_file(mapper_path);
+	for (auto& unit : units)
+	{
+		filesystem::create_directories(filesystem::path(get_cmi_path(unit)).parent_path());
+		mapper_file << get_bundled_path(unit) << " " << get_cmi_path(unit) << endl;
+	}
+	mapper_file.close();
+
+	string includes; // The bundled include directories.
+	for (auto& i : bundler::get_bundled_include_dirs(param_map))
+		includes += "-I\"" + i + "\" ";
+
+	string defs; // Additional definitions for the compiler to define.
+	if (parameter_map::const_iterator it = param_map.find(cli::DEFS_PARAM); it != param_map.end())
+	{
+		for (auto& d : parameter::get_param_values(it->second))
+			defs += "-D " + d + " ";
+	}
+
+	string flags;
+	if (parameter_map::const_iterator it = param_map.find(cli::HEADER_UNIT_FLAGS_PARAM); it != param_map.end())
+		flags = it->second;
+
+	auto cmd_template = regex_replace(gcc_header_unit_template, regex("\\@include_out_dir\\@"), include_out_dir);
+	cmd_template = regex_replace(cmd_template, regex("\\@mapper_file\\@"), mapper_path.u8string());
+	cmd_template = regex_replace(cmd_template, regex("\\@flags\\@"), flags);
+	cmd_template = regex_replace(cmd_template, regex("\\@includes\\@"), includes);
+	cmd_template = regex_replace(cmd_template, regex("\\@defs\\@"), defs);
+
+	auto jobs = cli::get_job_count(param_map);
+	set<string> built;
+
+	while (built.size() < units.size())
+	{
+		// The next wave consists of all header units whose dependencies have been built.
+		vector<string> wave;
+		for (auto& unit : units)
+		{
+			if (built.count(unit) > 0) continue;
+
+			auto& deps = unit_deps[unit];
+			if (all_of(deps.begin(), deps.end(), [&built](const string& d) { return built.count(d) > 0; }))
+				wave.push_back(unit);
+		}
+
+		// Headers that include each other cannot be ordered, so build them anyway
+		// and let the compiler report the problem.
+		if (wave.empty())
+		{
+			for (auto& unit : units)
+				if (built.count(unit) == 0) wave.push_back(unit);
+		}
+
+		parallel_for_each(wave.size(), jobs, [&](size_t i) {
+			auto header = get_bundled_path(wave[i]);
+			auto cmd = regex_replace(cmd_template, regex("\\@header_file\\@"), header);
+
+			if (system(cmd.c_str()) != 0 || !filesystem::exists(get_cmi_path(wave[i])))
+				throw runtime_error(regex_replace(HEADER_UNIT_BUILD_ERROR, regex("%s"), header));
+		});
+
+		built.insert(wave.begin(), wave.end());
+	}
+
+	ofstream rsp_file(filesystem::path(include_out_dir) / (stem + ".modules.rsp"));
+	rsp_file << "-std=c++20 -fmodules-ts -fmodule-mapper=\"" << mapper_path.u8string() << "\" "
+		<< flags << " " << includes << defs << endl;
+}
+
+
+/// <summary>
+/// Checks that the bundle is self-contained, by preprocessing each of the top-level includes of the input
+/// file against the bundled include directories alone (the target library's include directories are not
+/// passed to the compiler), using the same definitions.  Each check preprocesses a copy of the input file
+/// in which all other #include statements are blanked out, so that conditional includes are only checked
+/// if they were part of the bundle to begin with.  The checks run concurrently.  For every top-level
+/// include that fails, the missing header and the chain of includes leading to it are reported.
+///
+/// The compiler still searches its default include directories (and those listed in CPATH and the like),
+/// which may well include the target library's, e.g. '/usr/include'.  So the line markers of the output are
+/// checked as well: a header of the bundle's file list that was read from one of the target library's include
+/// directories, rather than from the bundle, is reported as missing from the bundle.  Other headers read from
+/// there are those that '#include_next' finds once the bundled include directories have been searched, and
+/// the bundle doesn't need them.
+/// </summary>
+/// <param name="bundle">The bundle, whose file list is the headers read when the bundle was built.</param>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="paths">The cache used to canonicalize the include directories and header files.</param>
+/// <returns>The number of top-level includes that could not be preprocessed against the bundle.</returns>
+size_t compiler::verify_bundle(const lib_bundle& bundle, const parameter_map& param_map, path_cache& paths)
+{
+	auto working_dir_path = get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM));
+	if (filesystem::path(working_dir_path).is_relative())
+		working_dir_path = (filesystem::current_path() / filesystem::path(working_dir_path)).u8string();
+
+	auto input_file = filesystem::path(get_expanded_path(param_map.at(cli::INPUT_FILE_PARAM)));
+	if (input_file.is_relative())
+		input_file = filesystem::path(working_dir_path) / input_file;
+
+	auto verify_dir = filesystem::u8path(param_map.at(cli::STAGE_DIR_PARAM)) / "verify";
+	if (filesystem::exists(verify_dir))
+		filesystem::remove_all(verify_dir);
+	filesystem::create_directories(verify_dir);
+
+	vector<string> lines;
+	{
+		ifstream file_stream(input_file);
+		string line;
+		while (getline(file_stream, line))
+			lines.push_back(line);
+	}
+
+	smatch match;
+	regex include_regex("^\\s*#\\s*include\\s*[<\"]([^>\"]+)[>\"]");
+	vector<size_t> include_lines;
+	vector<string> headers;
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		if (regex_search(lines[i], match, include_regex) && find(headers.begin(), headers.end(), match.str(1)) == headers.end())
+		{
+			include_lines.push_back(i);
+			headers.push_back(match.str(1));
+		}
+	}
+
+	auto compiler_param = param_map.at(cli::COMPILER_PARAM);
+	auto is_msvc = compiler_param == "msvc";
+
+	string includes, defs;
+	auto bundled_dirs = bundler::get_bundled_include_dirs(param_map);
+	for (auto& i : bundled_dirs)
+		includes += (is_msvc ? "/I\"" : "-I\"") + i + "\" ";
+	if (parameter_map::const_iterator it = param_map.find(cli::DEFS_PARAM); it != param_map.end())
+	{
+		for (auto& d : parameter::get_param_values(it->second))
+			defs += (is_msvc ? "/D " : "-D ") + d + " ";
+	}
+
+	auto cmd_template = string(is_msvc ? msvc_verify_template : gcc_verify_template);
+	if (is_msvc)
+		cmd_template = regex_replace(cmd_template, regex("\\@msvc_vcvars32_bat\\@"), get_expanded_path(param_map.at(cli::MSVC_BAT_PARAM)));
+	cmd_template = regex_replace(cmd_template, regex("\\@verify_dir\\@"), verify_dir.u8string());
+	cmd_template = regex_replace(cmd_template, regex("\\@includes\\@"), includes);
+	cmd_template = regex_replace(cmd_template, regex("\\@defs\\@"), defs);
+
+	// The bundled include directories are added first, so that they win if they're within one of
+	// the target library's include directories (see include_dir_trie).
+	include_dir_trie dirs;
+	auto add_dirs = [&dirs, &paths](const vector<string>& include_dirs, size_t first_index) {
+		for (size_t i = 0; i < include_dirs.size(); ++i)
+		{
+			string canonical_dir;
+			if (paths.get_canonical_dir(include_dirs[i], canonical_dir))
+				dirs.add(canonical_dir, first_index + i);
+		}
+	};
+
+	auto include_dirs = parameter::get_param_values(param_map.at(cli::INCLUDE_DIR_PARAM));
+	for (auto& id : include_dirs)
+	{
+		id = get_expanded_path(id);
+		if (filesystem::path(id).is_relative())
+			id = (filesystem::path(working_dir_path) / id).u8string();
+	}
+
+	add_dirs(bundled_dirs, 0);
+	add_dirs(include_dirs, bundled_dirs.size());
+
+	unordered_set<string> bundle_files;
+	for (auto& include_file : bundle.include_files)
+	{
+		string canonical_path;
+		if (paths.get_canonical_path(string(include_file), canonical_path))
+			bundle_files.insert(canonical_path);
+	}
+
+	vector<string> failures(headers.size());
+	parallel_for_each(headers.size(), cli::get_job_count(param_map), [&](size_t k) {
+		auto name = "verify_" + to_string(k);
+		auto source_path = verify_dir / (name + ".cpp");
+		auto output_path = verify_dir / (name + ".i");
+		auto diagnostics_path = verify_dir / (name + ".txt");
+
+		ofstream source_file(source_path);
+		for (size_t i = 0, next = 0; i < lines.size(); ++i)
+		{
+			auto is_other_include = next < include_lines.size() && include_lines[next] == i && next++ != k;
+			source_file << (is_other_include ? "" : lines[i]) << "\n";
+		}
+		source_file.close();
+
+		auto cmd = regex_replace(cmd_template, regex("\\@source_file\\@"), source_path.u8string());
+		cmd = regex_replace(cmd, regex("\\@output_file\\@"), output_path.u8string());
+		cmd = regex_replace(cmd, regex("\\@diagnostics_file\\@"), diagnostics_path.u8string());
+
+		if (is_msvc)
+		{
+			auto bat_path = verify_dir / (name + ".bat");
+			ofstream bat_file(bat_path);
+			bat_file << cmd;
+			bat_file.close();
+			cmd = bat_path.u8string();
+		}
+
+		if (system(cmd.c_str()) != 0)
+			failures[k] = describe_verify_failure(headers[k], get_file_contents(diagnostics_path.u8string().c_str()));
+		else
+			failures[k] = find_unbundled_header(headers[k], output_path.u8string(), dirs, bundled_dirs.size(), bundle_files, paths);
+
+		// Only the line markers are of interest; the preprocessed output can be large.
+		error_code ec;
+		filesystem::remove(output_path, ec);
+	});
+
+	size_t failure_count = 0;
+	for (auto& failure : failures)
+	{
+		if (failure.empty()) continue;
+		cout << failure;
+		++failure_count;
+	}
+
+	return failure_count;
+}
+
+/// <summary>
+/// Checks the line markers of a successful verification check for a header file of the bundle's file list
+/// that was read from one of the target library's include directories rather than from the bundle (i.e.
+/// through the compiler's default include directories), and reports the first one found, along with the
+/// chain of includes leading to it (only known with GCC, whose line markers tell when a file is entered).
+/// </summary>
+/// <param name="header">The top-level include that was checked.</param>
+/// <param name="output_file">The output of the preprocessor.</param>
+/// <param name="dirs">The bundled include directories, followed by the target library's include directories.</param>
+/// <param name="bundled_dir_count">The number of bundled include directories in 'dirs'.</param>
+/// <param name="bundle_files">The canonical paths of the headers in the bundle's file list.</param>
+/// <param name="paths">The cache used to canonicalize the paths of the header files.</param>
+/// <returns>The report, or an empty string if only the bundle was read from.</returns>
+string compiler::find_unbundled_header(const string& header, const string& output_file, const include_dir_trie& dirs, size_t bundled_dir_count, const unordered_set<string>& bundle_files, path_cache& paths)
+{
+	ifstream file_stream(filesystem::u8path(output_file));
+	string line;
+	vector<string> chain;   // The headers being included, outermost first.
+	unordered_set<string> checked_files;
+
+	while (getline(file_stream, line))
+	{
+		// GCC writes '# 12 "file" 1', CL.exe writes '#line 12 "file"'.
+		auto directive = sv_trim(line);
+		if (directive.empty() || directive[0] != '#') continue;
+
+		sv_tokenizer tokens(directive.substr(directive.substr(0, 5) == "#line" ? 5 : 1));
+		string_view line_num;
+		if (!tokens.next(line_num) || line_num.find_first_not_of("0123456789") != string_view::npos) continue;
+
+		auto rest = sv_ltrim(tokens.rest());
+		if (rest.empty() || rest[0] != '"') continue;
+
+		size_t path_end = 1;
+		while (path_end < rest.size() && rest[path_end] != '"')
+			path_end += rest[path_end] == '\\' ? 2 : 1;
+		if (path_end >= rest.size()) continue;
+
+		auto file = string(normalize_path(rest.substr(0, path_end + 1)));
+
+		auto entering = false, returning = false;
+		for (auto flag : sv_split(rest.substr(path_end + 1)))
+		{
+			if (flag == "1") entering = true;
+			else if (flag == "2") returning = true;
+		}
+
+		if (entering) chain.push_back(file);
+		else if (returning)
+		{
+			while (!chain.empty() && chain.back() != file) chain.pop_back();
+		}
+
+		if (file.empty() || file[0] == '<' || !checked_files.insert(file).second) continue;
+
+		string canonical_path;
+		size_t dir_index, prefix_length;
+		if (!paths.get_canonical_path(file, canonical_path) || !dirs.find(canonical_path, dir_index, prefix_length) || dir_index < bundled_dir_count
+			|| bundle_files.find(canonical_path) == bundle_files.end())
+			continue;
+
+		string report = "  " + header + ": '" + canonical_path.substr(prefix_length) + "' is not in the bundle, but was found in '" + canonical_path.substr(0, prefix_length) + "'\n";
+		if (entering) chain.pop_back();
+		for (auto& c : chain)
+			report += "      via " + c + "\n";
+		return report;
+	}
+
+	return string();
+}
+
+/// <summary>
+/// Turns the diagnostics of a failed verification check into a report of the missing header
+/// and the chain of includes leading to it.  Both GCC's "In file included from" notes and
+/// the output of CL.exe's /showIncludes are understood.
+/// </summary>
+/// <param name="header">The top-level include that was checked.</param>
+/// <param name="diagnostics">The output of the compiler.</param>
+/// <returns>The report.</returns>
+string compiler::describe_verify_failure(const string& header, const string& diagnostics)
+{
+	regex gcc_missing_regex("^(.+?):(\\d+):(?:\\d+:)? fatal error: (.+?): No such file or directory");
+	regex msvc_missing_regex("^(.+?)\\((\\d+)\\): fatal error C1083: Cannot open include file: '(.+?)'");
+	const string msvc_note = "Note: including file:";
+
+	vector<string> chain;   // The files being included, outermost first.
+	string first_error;
+	smatch match;
+
+	for (auto& line : sv_split(diagnostics, "\r\n"))
+	{
+		auto text = string(line);
+		auto trimmed = sv_trim(line);
+
+		if (text.rfind("In file included from ", 0) == 0)
+		{
+			chain.clear();
+			chain.insert(chain.begin(), string(sv_trim(line.substr(22))));
+		}
+		else if (!chain.empty() && text.size() > 0 && isspace((unsigned char)text[0]) && trimmed.substr(0, 5) == "from ")
+		{
+			chain.insert(chain.begin(), string(sv_trim(trimmed.substr(5))));
+		}
+		else if (text.rfind(msvc_note, 0) == 0)
+		{
+			// The nesting depth is given by the number of spaces in front of the path.
+			auto rest = line.substr(msvc_note.size());
+			auto depth = rest.find_first_not_of(' ');
+			if (depth == string_view::npos) continue;
+			chain.resize(min(chain.size(), depth > 0 ? depth - 1 : 0));
+			chain.push_back(string(rest.substr(depth)));
+		}
+		else if (regex_search(text, match, gcc_missing_regex) || regex_search(text, match, msvc_missing_regex))
+		{
+			auto file = match.str(1);
+			auto missing = match.str(3);
+
+			// CL.exe lists every file as it's entered, so only keep the ones leading to the file with the error.
+			auto it = find(chain.begin(), chain.end(), file);
+			if (it != chain.end()) chain.erase(it, chain.end());
+
+			// Drop the trailing separators of GCC's notes, and the verification source itself.
+			for (auto& c : chain)
+			{
+				while (!c.empty() && (c.back() == ',' || c.back() == ':')) c.pop_back();
+			}
+			if (!chain.empty() && chain.front().find("verify_") != string::npos && chain.front().find(".cpp") != string::npos)
+				chain.erase(chain.begin());
+
+			string report = "  " + header + ": missing '" + missing + "'\n";
+			for (auto& c : chain)
+				report += "      via " + c + "\n";
+			if (file.find("verify_") == string::npos || file.find(".cpp") == string::npos)
+				report += "      via " + file + ":" + match.str(2) + "\n";
+			return report;
+		}
+		else if (first_error.empty() && text.find("error") != string::npos)
+		{
+			first_error = text;
+		}
+	}
+
+	return "  " + header + ": " + (first_error.empty() ? string("could not be preprocessed") : first_error) + "\n";
+}
@@ -3,7 +3,13 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <functional>
+#include <unordered_set>
+#include "parameter.hpp"
 #include "lib_bundle.hpp"
+#include "path_cache.hpp"
+#include "path_filter.hpp"
 
 
 class compiler
@@ -11,8 +17,22 @@ class compiler
 private:
 	static const char* msvc_template;
 	static const char* gcc_template;
+	static const char* msvc_pch_template;
+	static const char* gcc_pch_template;
+	static const char* gcc_header_unit_template;
+	static const char* msvc_verify_template;
+	static const char* gcc_verify_template;
+
+private:
+	static std::string describe_verify_failure(const std::string& header, const std::string& diagnostics);
+	static std::string find_unbundled_header(const std::string& header, const std::string& output_file, const include_dir_trie& dirs, size_t bundled_dir_count, const std::unordered_set<std::string>& bundle_files, path_cache& paths);
 
 public:
-	static void run_preprocessor(std::map<std::string, std::string> param_map);
-	static lib_bundle parse_preprocessor_output(std::map<std::string, std::string> param_map);
+	static std::pmr::string normalize_path(std::string_view path, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+	static void run_preprocessor(const parameter_map& param_map);
+	static lib_bundle parse_preprocessor_output(const parameter_map& param_map, path_cache& paths, std::pmr::memory_resource* resource, const std::function<void(std::string_view)>& on_include_file = nullptr);
+	static std::vector<std::string> get_top_level_includes(const parameter_map& param_map);
+	static void build_precompiled_header(const parameter_map& param_map);
+	static void build_header_units(const lib_bundle& bundle, const parameter_map& param_map, path_cache& paths);
+	static size_t verify_bundle(const lib_bundle& bundle, const parameter_map& param_map, path_cache& paths);
 };
\ No newline at end of file
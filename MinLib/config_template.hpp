@@ -5,7 +5,7 @@ namespace minlib
 	static const char* CONFIG_TEMPLATE = "# *Required.  Specifies whether to use the MS Visual C++ (msvc) or GCC (g++) compiler. \r\n \
 compiler = \r\n \
 \r\n \
-# *Required.  The file that contains all of the top-level includes. \r\n \
+# *Required.  The file that contains all of the top-level includes.  Only required with 'compile_commands' if the bundle is verified or header units or a precompiled header are built. \r\n \
 input_file = \r\n \
 \r\n \
 # MinLib will attempt to find 'vcvars32.bat' automatically, however if that fails you can specify the full path here.  This batch file is only needed when compiling using the MSVC compiler. \r\n \
@@ -23,9 +23,18 @@ include_dir = \r\n \
 # A space-delimited list of additional library directories.  Defaults to the working directory. \r\n \
 lib_dir = \r\n \
 \r\n \
-# A space-delimited list of additional library files.  If the target library uses '#pragma comment(lib, \"some_lib\")' in the header files then you don't need to specify the libraries here. \r\n \
+# A space-delimited list of additional library files.  If the target library uses '#pragma comment(lib, \"some_lib\")' in the header files then you don't need to specify the libraries here.  Shared objects (.so) are bundled along with the shared objects they depend on that are found in the library directories. \r\n \
 libs = \r\n \
 \r\n \
+# Set to 'true' to leave out the debug sections (.debug_*) of the ELF objects in the bundled static libs (.a) and shared objects (.so), which usually make up most of their size.  The symbols needed for linking are kept. \r\n \
+strip_libs = \r\n \
+\r\n \
+# A space-delimited list of patterns; if set, only the header files whose path (relative to their include directory) matches one of them are bundled.  Globs are supported (*, ?, [...] and ** to match any number of directories), as are regular expressions prefixed with 're:'.  Example: boost/asio/** boost/*.hpp \r\n \
+include_filter = \r\n \
+\r\n \
+# A space-delimited list of patterns, in the same format as 'include_filter'; the header files whose path matches one of them are left out of the bundle.  Example: boost/test/** detail/*_win32.hpp \r\n \
+exclude_filter = \r\n \
+\r\n \
 # The directory that the extracted header files should be copied to.  Defaults to 'minlib_stage/include' within the working directory. \r\n \
 include_out_dir = \r\n \
 \r\n \
@@ -34,5 +43,68 @@ lib_out_dir = \r\n \
 \r\n \
 # A space-delimited, double-quote encapsulated list of copy operations in the format: src>dst.  Example: \"SrcDir/FileA.txt>DstDir/FileA.txt\" \r\n \
 copy_files = \r\n \
+\r\n \
+# Set to 'true' to build a precompiled header from the input file, compiled against the bundled header files.  The header, the precompiled header and a response file (.pch.rsp) containing the flags needed to use it are written to the include output directory. \r\n \
+precompiled_header = \r\n \
+\r\n \
+# Additional compiler flags used when building the precompiled header (e.g. -std=c++17 -O2).  These must match the flags used by the consuming project, otherwise the compiler will reject the precompiled header. \r\n \
+pch_flags = \r\n \
+\r\n \
+# Set to 'true' to build the bundled headers included by the input file as C++20 header units (GCC only).  A module mapper file (.modmap) and a response file (.modules.rsp) containing the flags needed to import them are written to the include output directory. \r\n \
+header_units = \r\n \
+\r\n \
+# Additional compiler flags used when building the header units.  These must match the flags used by the consuming project. \r\n \
+header_unit_flags = \r\n \
+\r\n \
+# The maximum number of jobs (compiler processes or file copy threads) MinLib may run in parallel.  Defaults to the number of hardware threads.  When run from make, jobs are also limited by make's jobserver. \r\n \
+jobs = \r\n \
+\r\n \
+# A space-delimited list of the project's source directories.  If set, MinLib scans the source files within these directories for #include statements and writes them to the input file, replacing its contents. \r\n \
+source_dir = \r\n \
+\r\n \
+# A space-delimited list of prefixes that the target library's header names begin with (e.g. boost/).  Only #include statements matching one of these prefixes are written to the input file.  Defaults to all #include <...> statements. \r\n \
+include_prefixes = \r\n \
+\r\n \
+# Set to 'true' to keep the #if/#ifdef conditions around #include statements that only appear within conditional sections of the source files. \r\n \
+scan_conditionals = \r\n \
+\r\n \
+# The path to the project's compilation database (compile_commands.json).  If set, the bundle is built from the dependency files (-MD/-MMD) that the project's build wrote for each translation unit, instead of running the preprocessor on the input file.  The project must have been built first. \r\n \
+compile_commands = \r\n \
+\r\n \
+# Set to 'true' to strip the comments and redundant whitespace from the bundled header files.  Line numbers are preserved. \r\n \
+minify_headers = \r\n \
+\r\n \
+# Set to 'true' to keep the comments at the top of each header file (typically the license) when minifying the header files. \r\n \
+keep_license = \r\n \
+\r\n \
+# A space-delimited list of macros whose value is fixed for the bundle.  Conditional sections (#if, #ifdef, etc.) in the bundled header files that only depend on these macros are resolved and the branches that can never be taken are removed.  The macros take on the value given in 'defs', or are considered undefined if they are not listed there. \r\n \
+pin_defs = \r\n \
+\r\n \
+# Set to 'true' (or pass '--verify' on the command-line) to check that each of the top-level includes in the input file can be preprocessed using only the bundled header files, with the same definitions.  Missing headers are reported along with the chain of includes that needs them, and MinLib exits with an error. \r\n \
+verify = \r\n \
+\r\n \
+# Set to 'true' to print the number of memory allocations made during the run, for profiling. \r\n \
+alloc_stats = \r\n \
+\r\n \
+# Set to 'true' (or pass '--serve' on the command-line) to keep MinLib running as a server that answers queries over a local socket, with the results cached in memory until the files they were derived from change.  The other parameters are passed with each query. \r\n \
+serve = \r\n \
+\r\n \
+# The path to the server's socket.  Defaults to 'minlib.sock' in $XDG_RUNTIME_DIR, or 'minlib-<uid>.sock' in the temp directory. \r\n \
+socket = \r\n \
+\r\n \
+# Sends a query to a running server instead of bundling: 'resolve' prints the header and lib files that the bundle is made of, 'bundle' bundles the library as usual, 'clear' drops the server's caches and 'stop' shuts the server down. \r\n \
+query = \r\n \
+\r\n \
+# The path to the manifest to write after bundling, which lists the files in the output directories along with their SHA-256 digests (and the signatures of the blocks of large files, such as libs).  Pass it as 'delta_base' to a later run to get a delta pack. \r\n \
+manifest = \r\n \
+\r\n \
+# The path to the manifest of a previous version of the bundle.  Requires 'delta_pack'. \r\n \
+delta_base = \r\n \
+\r\n \
+# The path to the delta pack to write after bundling, which holds the changes from the bundle described by 'delta_base' to the new one: the files that were added or removed, and the changed blocks of the files that changed. \r\n \
+delta_pack = \r\n \
+\r\n \
+# The path to a delta pack to apply to the bundle in 'include_out_dir' and 'lib_out_dir' instead of bundling.  The bundle is only modified if it matches the version the pack was made from and every patched file matches its digest. \r\n \
+apply_delta = \r\n \
 ";
 }
\ No newline at end of file
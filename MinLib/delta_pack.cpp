@@ -0,0 +1,908 @@
+#include "delta_pack.hpp"
+#include <cmath>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "cli.hpp"
+#include "errors.hpp"
+#include "file_utils.hpp"
+#include "hash_utils.hpp"
+#include "mapped_file.hpp"
+#include "parallel_utils.hpp"
+#include "string_utils.hpp"
+
+using namespace std;
+using namespace minlib;
+
+// Smaller files are sent whole when they change, as their block signatures would hardly save anything.
+static const uint64_t MIN_SIGNED_SIZE = 64 * 1024;
+static const uint64_t MIN_BLOCK_SIZE = 2 * 1024;
+static const uint64_t MAX_BLOCK_SIZE = 64 * 1024;
+
+static const char* MANIFEST_HEADER = "minlib_manifest 1";
+static const char* PACK_HEADER = "minlib_delta 2";
+
+// The base digest of a path that didn't exist in the version a pack was made from, and the prefix of the
+// base digest of a symlink (the digest of its target).
+static const char* NO_BASE_DIGEST = "-";
+static const char* LINK_DIGEST_PREFIX = "link:";
+
+/// <summary>
+/// Picks the block size of a file, which grows with the square root of its size (as in rsync), so that the
+/// number of signatures and the amount of data sent for each change are balanced.
+/// </summary>
+static uint32_t get_block_size(uint64_t size)
+{
+	auto block_size = (uint64_t)sqrt((double)size);
+	block_size = (block_size + 1023) / 1024 * 1024;
+	return (uint32_t)clamp(block_size, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+}
+
+/// <summary>
+/// Gets the strong checksum of a block: the first 8 bytes of its SHA-256 digest.
+/// </summary>
+static uint64_t get_strong_hash(const uint8_t* data, size_t size)
+{
+	sha256 hash;
+	hash.update(data, size);
+
+	uint8_t digest[32];
+	hash.finish(digest);
+
+	uint64_t result = 0;
+	for (int i = 0; i < 8; ++i)
+		result = result << 8 | digest[i];
+	return result;
+}
+
+/// <summary>
+/// Parses a (decimal or hexadecimal) number.
+/// </summary>
+/// <returns>Returns false if the token isn't a number.</returns>
+static bool parse_number(string_view token, uint64_t& out_value, int base = 10)
+{
+	auto end = token.data() + token.size();
+	auto result = from_chars(token.data(), end, out_value, base);
+	return !token.empty() && result.ec == errc() && result.ptr == end;
+}
+
+/// <summary>
+/// Gets the output directories that make up the bundle, along with the prefix of their files' paths in
+/// manifests and packs.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+vector<pair<string, filesystem::path>> delta_pack::get_bundle_dirs(const parameter_map& param_map)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = filesystem::current_path() / working_dir_path;
+
+	vector<pair<string, filesystem::path>> result;
+	for (auto [prefix, param_name] : { make_pair("include/", cli::INCLUDE_OUT_DIR_PARAM), make_pair("lib/", cli::LIB_OUT_DIR_PARAM) })
+	{
+		auto dir = filesystem::u8path(get_expanded_path(param_map.at(param_name)));
+		result.emplace_back(prefix, (dir.is_relative() ? working_dir_path / dir : dir).lexically_normal());
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Checks that a relative path stays within the directory it's relative to: it must not be absolute, have a root
+/// name (e.g. a drive) or go up a directory.
+/// </summary>
+static bool is_contained_path(const filesystem::path& path)
+{
+	auto result = !path.empty() && path.is_relative() && !path.has_root_name() && !path.has_root_directory();
+	for (auto& segment : path)
+		result = result && segment != "..";
+	return result;
+}
+
+/// <summary>
+/// Checks that a symlink stays within the output directory it's in: its target, resolved against the directory
+/// of the link, must not be absolute or go up past the output directory (e.g. 'lib/sub/libfoo.so' may point to
+/// '../libfoo.so.1', but 'lib/libfoo.so' may not).
+/// </summary>
+/// <param name="link_path">The path of the link, starting with 'include/' or 'lib/'.</param>
+/// <param name="link_target">The target of the link.</param>
+static bool is_contained_link(const string& link_path, const string& link_target)
+{
+	auto target = filesystem::u8path(link_target);
+	auto separator = link_path.find('/');
+	if (target.empty() || target.is_absolute() || target.has_root_name() || target.has_root_directory() || separator == string::npos)
+		return false;
+
+	auto resolved = (filesystem::u8path(link_path.substr(separator + 1)).parent_path() / target).lexically_normal();
+	return is_contained_path(resolved);
+}
+
+/// <summary>
+/// Gets the digest of a path in the version a pack is made from: the digest of the file, or of the target of the symlink.
+/// </summary>
+/// <param name="entry">The manifest entry of the path, or null if the path didn't exist.</param>
+static string get_base_digest(const delta_pack::manifest_entry* entry)
+{
+	if (entry == nullptr)
+		return NO_BASE_DIGEST;
+	if (entry->link_target.empty())
+		return entry->hash;
+	return LINK_DIGEST_PREFIX + sha256::get_hex(entry->link_target.data(), entry->link_target.size());
+}
+
+/// <summary>
+/// Gets the digest of a path in the bundle a pack is applied to, the same way as get_base_digest().
+/// </summary>
+/// <param name="path">The path in the bundle.</param>
+/// <returns>The digest, or an empty string if the path is neither a file nor a symlink (e.g. a directory).</returns>
+static string get_current_digest(const filesystem::path& path)
+{
+	error_code ec;
+	auto status = filesystem::symlink_status(path, ec);
+	if (filesystem::is_symlink(status))
+	{
+		auto target = filesystem::read_symlink(path, ec).generic_u8string();
+		return LINK_DIGEST_PREFIX + sha256::get_hex(target.data(), target.size());
+	}
+
+	if (filesystem::is_regular_file(status))
+	{
+		mapped_file file(path.u8string());
+		return sha256::get_hex(file.data(), file.size());
+	}
+
+	return filesystem::exists(status) ? "" : NO_BASE_DIGEST;
+}
+
+/// <summary>
+/// Maps the path of a file in a manifest or pack to its path in the bundle.
+/// </summary>
+/// <param name="path">The path of the file, starting with 'include/' or 'lib/'.</param>
+/// <param name="bundle_dirs">The output directories, as returned by get_bundle_dirs().</param>
+filesystem::path delta_pack::get_bundle_path(const string& path, const vector<pair<string, filesystem::path>>& bundle_dirs)
+{
+	for (auto& [prefix, dir] : bundle_dirs)
+	{
+		if (path.compare(0, prefix.size(), prefix) != 0)
+			continue;
+
+		// A pack must not reach outside of the bundle.
+		auto relative_path = filesystem::u8path(path.substr(prefix.size()));
+		if (is_contained_path(relative_path))
+			return dir / relative_path;
+		break;
+	}
+
+	throw runtime_error(regex_replace(DELTA_PATH_ERROR, regex("%s"), path));
+}
+
+/// <summary>
+/// Computes the digest of a file and, if it's large enough, the signatures of its blocks.
+/// </summary>
+/// <param name="entry">The manifest entry of the file.</param>
+/// <param name="file_path">The path to the file.</param>
+void delta_pack::sign_file(manifest_entry& entry, const filesystem::path& file_path)
+{
+	mapped_file file(file_path.u8string());
+	auto data = (const uint8_t*)file.data();
+
+	entry.size = file.size();
+	entry.hash = sha256::get_hex(data, file.size());
+
+	if (entry.size < MIN_SIGNED_SIZE)
+		return;
+
+	entry.block_size = get_block_size(entry.size);
+	for (uint64_t offset = 0; offset < entry.size; offset += entry.block_size)
+	{
+		auto length = (size_t)min<uint64_t>(entry.block_size, entry.size - offset);
+		entry.blocks.push_back({ rolling_checksum(data + offset, length).get(), get_strong_hash(data + offset, length) });
+	}
+}
+
+/// <summary>
+/// Finds the blocks of the previous version of a file within its new version, as rsync does: the weak
+/// checksum is rolled along the new version one byte at a time, and wherever it matches the checksum of
+/// a block, the strong checksums are compared.  The data between the blocks found is sent as is.
+/// </summary>
+/// <param name="base">The manifest entry of the previous version, which has the signatures of its blocks.</param>
+/// <param name="data">The contents of the new version.</param>
+/// <param name="size">The size of the new version.</param>
+/// <returns>The instructions to rebuild the new version from the previous one.</returns>
+vector<delta_pack::delta_op> delta_pack::get_delta(const manifest_entry& base, const char* data, size_t size)
+{
+	auto bytes = (const uint8_t*)data;
+	size_t block_size = base.block_size;
+
+	// The last block may be shorter than the others, in which case it can only be found at the end.
+	auto last_block_size = (size_t)(base.size - (base.blocks.size() - 1) * block_size);
+	auto full_block_count = last_block_size == block_size ? base.blocks.size() : base.blocks.size() - 1;
+
+	unordered_map<uint32_t, vector<size_t>> blocks_by_checksum;
+	for (size_t i = 0; i < full_block_count; ++i)
+		blocks_by_checksum[base.blocks[i].weak].push_back(i);
+
+	vector<delta_op> result;
+	size_t data_start = 0;
+
+	auto add_data = [&](size_t end) {
+		if (end > data_start)
+			result.push_back({ false, data_start, end - data_start });
+	};
+
+	auto add_copy = [&](size_t block) {
+		if (!result.empty() && result.back().is_copy && result.back().first + result.back().count == block)
+			++result.back().count;
+		else
+			result.push_back({ true, block, 1 });
+	};
+
+	// Finds the block with the given checksums, preferring the one that follows the block copied last.
+	auto find_block = [&](uint32_t weak, size_t position) {
+		auto it = blocks_by_checksum.find(weak);
+		if (it == blocks_by_checksum.end())
+			return string::npos;
+
+		auto strong = get_strong_hash(bytes + position, block_size);
+		auto found = string::npos;
+		for (auto block : it->second)
+		{
+			if (base.blocks[block].strong != strong) continue;
+			if (found == string::npos) found = block;
+			if (!result.empty() && result.back().is_copy && result.back().first + result.back().count == block)
+				return block;
+		}
+		return found;
+	};
+
+	if (full_block_count > 0 && size >= block_size)
+	{
+		size_t position = 0;
+		rolling_checksum checksum(bytes, block_size);
+
+		while (true)
+		{
+			if (auto block = find_block(checksum.get(), position); block != string::npos)
+			{
+				add_data(position);
+				add_copy(block);
+				position += block_size;
+				data_start = position;
+
+				if (position + block_size > size) break;
+				checksum = rolling_checksum(bytes + position, block_size);
+				continue;
+			}
+
+			if (position + block_size >= size) break;
+			checksum.roll(bytes[position], bytes[position + block_size]);
+			++position;
+		}
+	}
+
+	if (last_block_size != block_size && size - data_start >= last_block_size)
+	{
+		auto position = size - last_block_size;
+		auto& last_block = base.blocks.back();
+		if (rolling_checksum(bytes + position, last_block_size).get() == last_block.weak
+			&& get_strong_hash(bytes + position, last_block_size) == last_block.strong)
+		{
+			add_data(position);
+			add_copy(base.blocks.size() - 1);
+			data_start = size;
+		}
+	}
+
+	add_data(size);
+	return result;
+}
+
+/// <summary>
+/// Lists the files of the bundle, i.e. the contents of the output directories, sorted by path.  The files
+/// are hashed and signed in parallel.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+vector<delta_pack::manifest_entry> delta_pack::build_manifest(const parameter_map& param_map)
+{
+	vector<pair<manifest_entry, filesystem::path>> files;
+
+	for (auto& [prefix, dir] : get_bundle_dirs(param_map))
+	{
+		if (!filesystem::is_directory(dir))
+			continue;
+
+		for (auto& entry : filesystem::recursive_directory_iterator(dir))
+		{
+			if (!entry.is_symlink() && !entry.is_regular_file())
+				continue;
+
+			manifest_entry file;
+			file.path = prefix + entry.path().lexically_relative(dir).generic_u8string();
+			if (entry.is_symlink())
+				file.link_target = filesystem::read_symlink(entry.path()).generic_u8string();
+			files.emplace_back(move(file), entry.path());
+		}
+	}
+
+	sort(files.begin(), files.end(), [](auto& a, auto& b) { return a.first.path < b.first.path; });
+
+	parallel_for_each(files.size(), cli::get_job_count(param_map), [&files](size_t i) {
+		if (files[i].first.link_target.empty())
+			sign_file(files[i].first, files[i].second);
+	});
+
+	vector<manifest_entry> result;
+	for (auto& file : files)
+		result.push_back(move(file.first));
+	return result;
+}
+
+/// <summary>
+/// Reads a manifest written by write_manifest().
+/// </summary>
+/// <param name="filename">The name of the manifest file.</param>
+vector<delta_pack::manifest_entry> delta_pack::read_manifest(const string& filename)
+{
+	auto contents = get_file_contents(filename.c_str());
+	auto format_error = runtime_error(regex_replace(MANIFEST_FORMAT_ERROR, regex("%s"), filename));
+
+	vector<manifest_entry> result;
+	auto header_found = false;
+
+	for (auto line : sv_split(contents, "\r\n"))
+	{
+		if (!header_found)
+		{
+			if (line != MANIFEST_HEADER) throw format_error;
+			header_found = true;
+			continue;
+		}
+
+		auto tokens = sv_split(line, "\t");
+		string_view kind, token;
+		tokens.next(kind);
+
+		// The path comes last, as it's the only field that may contain spaces.
+		auto get_path = [&tokens, &format_error]() {
+			auto rest = tokens.rest();
+			if (rest.size() < 2) throw format_error;
+			return string(rest.substr(1));
+		};
+
+		if (kind == "file")
+		{
+			manifest_entry entry;
+			uint64_t block_size;
+			if (!tokens.next(token)) throw format_error;
+			entry.hash = string(token);
+			if (!tokens.next(token) || !parse_number(token, entry.size)) throw format_error;
+			if (!tokens.next(token) || !parse_number(token, block_size)) throw format_error;
+			entry.block_size = (uint32_t)block_size;
+			entry.path = get_path();
+			result.push_back(move(entry));
+		}
+		else if (kind == "block")
+		{
+			block_signature block;
+			uint64_t weak;
+			if (result.empty() || result.back().block_size == 0) throw format_error;
+			if (!tokens.next(token) || !parse_number(token, weak, 16)) throw format_error;
+			if (!tokens.next(token) || !parse_number(token, block.strong, 16)) throw format_error;
+			block.weak = (uint32_t)weak;
+			result.back().blocks.push_back(block);
+		}
+		else if (kind == "link")
+		{
+			manifest_entry entry;
+			if (!tokens.next(token)) throw format_error;
+			entry.link_target = string(token);
+			entry.path = get_path();
+			result.push_back(move(entry));
+		}
+		else
+		{
+			throw format_error;
+		}
+	}
+
+	if (!header_found) throw format_error;
+	return result;
+}
+
+/// <summary>
+/// Writes a manifest: a 'file' line (digest, size, block size and path) for each file, followed by a 'block'
+/// line (weak and strong checksum) for each of its blocks, and a 'link' line (target and path) for each symlink.
+/// </summary>
+/// <param name="manifest">The files of the bundle.</param>
+/// <param name="filename">The name of the manifest file.</param>
+void delta_pack::write_manifest(const vector<manifest_entry>& manifest, const string& filename)
+{
+	ofstream file(filesystem::u8path(filename), ios::binary);
+	file << MANIFEST_HEADER << "\n";
+
+	char block_line[64];
+	for (auto& entry : manifest)
+	{
+		if (!entry.link_target.empty())
+		{
+			file << "link\t" << entry.link_target << "\t" << entry.path << "\n";
+			continue;
+		}
+
+		file << "file\t" << entry.hash << "\t" << entry.size << "\t" << entry.block_size << "\t" << entry.path << "\n";
+		for (auto& block : entry.blocks)
+		{
+			snprintf(block_line, sizeof(block_line), "block\t%08x\t%016llx\n", (unsigned)block.weak, (unsigned long long)block.strong);
+			file << block_line;
+		}
+	}
+
+	file.close();
+	if (!file)
+		throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), filename));
+}
+
+/// <summary>
+/// Writes a delta pack from the previous version of the bundle to the current one.  The pack is made of
+/// lines, with the contents of the files inserted after the 'data' lines that give their length:
+///   remove  base_hash  path                                           A file or symlink was removed.
+///   link    base_hash  target  path                                   A symlink was added or changed.
+///   file    base_hash  block_size  hash  size  op_count  path         A file was added or changed, followed by
+///   copy    first_block  block_count                                  the instructions to rebuild it, in order.
+///   data    length
+/// The base digest is that of the path in the previous version (see get_base_digest()), or '-' if it was added,
+/// so that a pack is only applied to the version it was made from.  The block size is zero if no blocks are copied.
+/// </summary>
+/// <param name="base">The manifest of the previous version.</param>
+/// <param name="manifest">The manifest of the current version.</param>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="filename">The name of the pack file.</param>
+void delta_pack::write_pack(const vector<manifest_entry>& base, const vector<manifest_entry>& manifest, const parameter_map& param_map, const string& filename)
+{
+	struct changed_file
+	{
+		const manifest_entry* entry;
+		const manifest_entry* base;
+		bool diff; // Whether the base has block signatures to diff against.
+		vector<delta_op> ops;
+	};
+
+	unordered_map<string_view, const manifest_entry*> base_entries;
+	for (auto& entry : base)
+		base_entries[entry.path] = &entry;
+
+	vector<pair<const manifest_entry*, const manifest_entry*>> links; // Along with their base entry.
+	vector<changed_file> files;
+	size_t added_count = 0, changed_count = 0, removed_count = 0;
+	unordered_set<string_view> paths;
+
+	for (auto& entry : manifest)
+	{
+		paths.insert(entry.path);
+
+		auto it = base_entries.find(entry.path);
+		auto base_entry = it != base_entries.end() ? it->second : nullptr;
+		if (base_entry != nullptr && base_entry->link_target == entry.link_target && base_entry->hash == entry.hash)
+			continue;
+
+		++(base_entry == nullptr ? added_count : changed_count);
+		if (!entry.link_target.empty())
+			links.push_back({ &entry, base_entry });
+		else
+			files.push_back({ &entry, base_entry, base_entry != nullptr && base_entry->link_target.empty() && !base_entry->blocks.empty(), {} });
+	}
+
+	// The changed files are diffed against the signatures of their previous version in parallel.  The new
+	// contents are only read again when the pack is written.
+	auto bundle_dirs = get_bundle_dirs(param_map);
+	parallel_for_each(files.size(), cli::get_job_count(param_map), [&](size_t i) {
+		auto& file = files[i];
+		if (!file.diff)
+			return;
+
+		mapped_file contents(get_bundle_path(file.entry->path, bundle_dirs).u8string());
+		file.ops = get_delta(*file.base, contents.data(), contents.size());
+
+		// If none of the blocks were found, the file is sent whole, and the previous version isn't needed.
+		if (none_of(file.ops.begin(), file.ops.end(), [](const delta_op& op) { return op.is_copy; }))
+			file.ops.clear();
+	});
+
+	// The links are checked as they would be when the pack is applied, so that a pack that can't be applied isn't written.
+	for (auto& [link, link_base] : links)
+	{
+		if (!is_contained_link(link->path, link->link_target))
+			throw runtime_error(regex_replace(DELTA_PATH_ERROR, regex("%s"), link->path + " -> " + link->link_target));
+	}
+
+	ofstream pack(filesystem::u8path(filename), ios::binary);
+	pack << PACK_HEADER << "\n";
+
+	for (auto& entry : base)
+	{
+		if (paths.count(entry.path) == 0)
+		{
+			pack << "remove\t" << get_base_digest(&entry) << "\t" << entry.path << "\n";
+			++removed_count;
+		}
+	}
+
+	for (auto& [link, link_base] : links)
+		pack << "link\t" << get_base_digest(link_base) << "\t" << link->link_target << "\t" << link->path << "\n";
+
+	uint64_t data_size = 0;
+	for (auto& file : files)
+	{
+		mapped_file contents(get_bundle_path(file.entry->path, bundle_dirs).u8string());
+		if (file.ops.empty() && contents.size() > 0)
+			file.ops.push_back({ false, 0, contents.size() });
+
+		auto copies_blocks = any_of(file.ops.begin(), file.ops.end(), [](const delta_op& op) { return op.is_copy; });
+
+		pack << "file\t" << get_base_digest(file.base) << "\t" << (copies_blocks ? file.base->block_size : 0) << "\t"
+			<< file.entry->hash << "\t" << contents.size() << "\t" << file.ops.size() << "\t" << file.entry->path << "\n";
+
+		for (auto& op : file.ops)
+		{
+			if (op.is_copy)
+			{
+				pack << "copy\t" << op.first << "\t" << op.count << "\n";
+				continue;
+			}
+
+			pack << "data\t" << op.count << "\n";
+			pack.write(contents.data() + op.first, (streamsize)op.count);
+			data_size += op.count;
+		}
+	}
+
+	pack << "end\n";
+	auto pack_size = (uint64_t)pack.tellp();
+	pack.close();
+	if (!pack)
+		throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), filename));
+
+	cout << "Delta pack: " << added_count << " added, " << changed_count << " changed, " << removed_count << " removed ("
+		<< pack_size << " bytes, of which " << data_size << " bytes of file contents)." << endl;
+}
+
+/// <summary>
+/// Writes the manifest of the bundle ('manifest') and/or the delta pack from the version of the bundle
+/// described by a previous manifest ('delta_base') to the current one ('delta_pack'), if requested.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+void delta_pack::write(const parameter_map& param_map)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = filesystem::current_path() / working_dir_path;
+
+	auto get_filename = [&](const char* param_name) {
+		auto it = param_map.find(param_name);
+		if (it == param_map.end() || it->second == "")
+			return string();
+
+		auto p = filesystem::u8path(get_expanded_path(it->second));
+		return (p.is_relative() ? working_dir_path / p : p).u8string();
+	};
+
+	auto manifest_filename = get_filename(cli::MANIFEST_PARAM);
+	auto base_filename = get_filename(cli::DELTA_BASE_PARAM);
+	auto pack_filename = get_filename(cli::DELTA_PACK_PARAM);
+
+	if (manifest_filename.empty() && pack_filename.empty())
+		return;
+
+	// The previous manifest is read first, as it may well be the file the new one is written to.
+	vector<manifest_entry> base;
+	if (!pack_filename.empty())
+		base = read_manifest(base_filename);
+
+	auto manifest = build_manifest(param_map);
+
+	if (!pack_filename.empty())
+		write_pack(base, manifest, param_map, pack_filename);
+	if (!manifest_filename.empty())
+		write_manifest(manifest, manifest_filename);
+}
+
+/// <summary>
+/// Applies the delta pack given by 'apply_delta' to the bundle in the output directories.  Nothing may stand in
+/// the way of the files and symlinks to be written (e.g. a directory), and every path the pack touches is checked
+/// against the version the pack was made from (the files and symlinks that are changed or removed against their
+/// digests, and those that are added for not existing yet); then the new files are written
+/// to the staging directory and checked against their digests, in parallel.  Only then are the files of the
+/// bundle replaced, so a pack that doesn't fit the bundle leaves it unchanged.  The new files are moved into
+/// place (or copied, if the staging directory is on another file system).
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+void delta_pack::apply(const parameter_map& param_map)
+{
+	struct pack_record
+	{
+		string kind;
+		filesystem::path path;
+		string link_target;
+		string base_hash;
+		uint64_t block_size = 0;
+		string hash;
+		uint64_t size = 0;
+		vector<delta_op> ops; // The offsets of the data are within the pack.
+	};
+
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = filesystem::current_path() / working_dir_path;
+
+	auto pack_path = filesystem::u8path(get_expanded_path(param_map.at(cli::APPLY_DELTA_PARAM)));
+	auto pack_filename = (pack_path.is_relative() ? working_dir_path / pack_path : pack_path).u8string();
+
+	mapped_file pack(pack_filename);
+	string_view contents(pack.data() != nullptr ? pack.data() : "", pack.size());
+	auto format_error = runtime_error(regex_replace(DELTA_PACK_FORMAT_ERROR, regex("%s"), pack_filename));
+
+	size_t position = 0;
+	auto next_line = [&](string_view& out_line) {
+		auto end = contents.find('\n', position);
+		if (end == string_view::npos) return false;
+		out_line = contents.substr(position, end - position);
+		position = end + 1;
+		return true;
+	};
+
+	string_view line;
+	if (!next_line(line) || line != PACK_HEADER)
+		throw format_error;
+
+	auto bundle_dirs = get_bundle_dirs(param_map);
+	vector<pack_record> records;
+	auto end_found = false;
+
+	while (!end_found && next_line(line))
+	{
+		auto tokens = sv_split(line, "\t");
+		string_view kind, token;
+		tokens.next(kind);
+
+		auto get_pack_path = [&]() {
+			auto rest = tokens.rest();
+			if (rest.size() < 2) throw format_error;
+			return string(rest.substr(1));
+		};
+		auto get_path = [&]() { return get_bundle_path(get_pack_path(), bundle_dirs); };
+
+		pack_record record;
+		record.kind = string(kind);
+
+		if (kind == "end")
+		{
+			end_found = true;
+			continue;
+		}
+		else if (kind == "remove")
+		{
+			if (!tokens.next(token) || token == NO_BASE_DIGEST) throw format_error;
+			record.base_hash = string(token);
+			record.path = get_path();
+		}
+		else if (kind == "link")
+		{
+			if (!tokens.next(token)) throw format_error;
+			record.base_hash = string(token);
+			if (!tokens.next(token)) throw format_error;
+			record.link_target = string(token);
+			auto link_path = get_pack_path();
+			record.path = get_bundle_path(link_path, bundle_dirs);
+
+			// Symlinks must not point outside of the bundle either.
+			if (!is_contained_link(link_path, record.link_target))
+				throw runtime_error(regex_replace(DELTA_PATH_ERROR, regex("%s"), link_path + " -> " + record.link_target));
+		}
+		else if (kind == "file")
+		{
+			uint64_t op_count;
+			if (!tokens.next(token)) throw format_error;
+			record.base_hash = string(token);
+			if (!tokens.next(token) || !parse_number(token, record.block_size)) throw format_error;
+			if (!tokens.next(token)) throw format_error;
+			record.hash = string(token);
+			if (!tokens.next(token) || !parse_number(token, record.size)) throw format_error;
+			if (!tokens.next(token) || !parse_number(token, op_count)) throw format_error;
+			record.path = get_path();
+
+			// Blocks can only be copied from a file.
+			if (record.block_size != 0 && (record.base_hash == NO_BASE_DIGEST || record.base_hash.compare(0, strlen(LINK_DIGEST_PREFIX), LINK_DIGEST_PREFIX) == 0))
+				throw format_error;
+
+			for (uint64_t i = 0; i < op_count; ++i)
+			{
+				string_view op_line, op_kind;
+				if (!next_line(op_line)) throw format_error;
+
+				auto op_tokens = sv_split(op_line, "\t");
+				op_tokens.next(op_kind);
+
+				delta_op op;
+				if (op_kind == "copy")
+				{
+					op.is_copy = true;
+					if (!op_tokens.next(token) || !parse_number(token, op.first)) throw format_error;
+					if (!op_tokens.next(token) || !parse_number(token, op.count)) throw format_error;
+					if (record.block_size == 0) throw format_error;
+				}
+				else if (op_kind == "data")
+				{
+					if (!op_tokens.next(token) || !parse_number(token, op.count)) throw format_error;
+					if (op.count > contents.size() - position) throw format_error;
+					op.first = position;
+					position += op.count;
+				}
+				else
+				{
+					throw format_error;
+				}
+
+				record.ops.push_back(op);
+			}
+		}
+		else
+		{
+			throw format_error;
+		}
+
+		records.push_back(move(record));
+	}
+
+	if (!end_found)
+		throw format_error;
+
+	// Check that nothing is in the way of the files and symlinks, so that the last step doesn't fail halfway
+	// through: they may replace files and symlinks, but not directories, and their parent directories must
+	// either be directories or not exist yet.
+	for (auto& record : records)
+	{
+		error_code ec;
+		auto blocker = record.path;
+		auto in_the_way = filesystem::is_directory(filesystem::symlink_status(record.path, ec));
+
+		for (auto parent = record.path.parent_path(); !in_the_way && record.kind != "remove"; parent = parent.parent_path())
+		{
+			auto status = filesystem::status(parent, ec);
+			if (filesystem::exists(status))
+			{
+				in_the_way = !filesystem::is_directory(status);
+				blocker = parent;
+				break;
+			}
+
+			if (parent == parent.parent_path())
+				break;
+		}
+
+		if (in_the_way)
+			throw runtime_error(regex_replace(DELTA_TARGET_ERROR, regex("%s"), blocker.u8string()));
+	}
+
+	// The new files are written to the staging directory, named after their record.
+	auto temp_dir = filesystem::u8path(param_map.at(cli::STAGE_DIR_PARAM)) / "delta";
+	auto get_temp_path = [&temp_dir](size_t i) {
+		return temp_dir / to_string(i);
+	};
+
+	auto jobs = cli::get_job_count(param_map);
+	try
+	{
+		// Check that every path the pack touches is the version the pack was made from: the files and symlinks
+		// that are changed or removed match their base digest, and those that are added don't exist yet.
+		parallel_for_each(records.size(), jobs, [&](size_t i) {
+			auto& record = records[i];
+			if (get_current_digest(record.path) != record.base_hash)
+				throw runtime_error(regex_replace(DELTA_BASE_ERROR, regex("%s"), record.path.u8string()));
+		});
+
+		// Write the new files to the staging directory.
+		filesystem::remove_all(temp_dir);
+		filesystem::create_directories(temp_dir);
+		parallel_for_each(records.size(), jobs, [&](size_t i) {
+			auto& record = records[i];
+			if (record.kind != "file")
+				return;
+
+			unique_ptr<mapped_file> base;
+			if (record.block_size != 0)
+				base = make_unique<mapped_file>(record.path.u8string());
+
+			auto temp_path = get_temp_path(i);
+			ofstream file(temp_path, ios::binary);
+
+			sha256 hash;
+			uint64_t written = 0;
+			auto write = [&](const char* data, uint64_t size) {
+				file.write(data, (streamsize)size);
+				hash.update(data, (size_t)size);
+				written += size;
+			};
+
+			for (auto& op : record.ops)
+			{
+				if (!op.is_copy)
+				{
+					write(contents.data() + op.first, op.count);
+					continue;
+				}
+
+				auto offset = op.first * record.block_size;
+				if (op.count == 0 || offset >= base->size())
+					throw format_error;
+				write(base->data() + offset, min<uint64_t>(op.count * record.block_size, base->size() - offset));
+			}
+
+			file.close();
+			if (!file)
+				throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), temp_path.u8string()));
+
+			if (written != record.size || hash.finish_hex() != record.hash)
+				throw runtime_error(regex_replace(DELTA_VERIFY_ERROR, regex("%s"), record.path.u8string()));
+		});
+	}
+	catch (...)
+	{
+		error_code ec;
+		filesystem::remove_all(temp_dir, ec);
+		throw;
+	}
+
+	// Replace the files of the bundle.
+	size_t added_count = 0, changed_count = 0, removed_count = 0;
+	try
+	{
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			auto& record = records[i];
+			auto exists = filesystem::is_symlink(record.path) || filesystem::exists(record.path);
+
+			if (record.kind == "remove")
+			{
+				if (exists) filesystem::remove(record.path);
+				++removed_count;
+				continue;
+			}
+
+			++(exists ? changed_count : added_count);
+			if (exists && (record.kind != "file" || filesystem::is_symlink(record.path)))
+				filesystem::remove(record.path);
+			filesystem::create_directories(record.path.parent_path());
+
+			if (record.kind == "file")
+			{
+				error_code ec;
+				filesystem::rename(get_temp_path(i), record.path, ec);
+				if (ec)
+				{
+					filesystem::copy_file(get_temp_path(i), record.path, filesystem::copy_options::overwrite_existing);
+					filesystem::remove(get_temp_path(i));
+				}
+			}
+			else
+			{
+				filesystem::create_symlink(filesystem::u8path(record.link_target), record.path);
+			}
+		}
+	}
+	catch (...)
+	{
+		error_code ec;
+		filesystem::remove_all(temp_dir, ec);
+		throw;
+	}
+
+	filesystem::remove_all(temp_dir);
+
+	cout << "Delta pack applied: " << added_count << " added, " << changed_count << " changed, " << removed_count << " removed." << endl;
+}
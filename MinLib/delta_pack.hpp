@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "parameter.hpp"
+
+/// <summary>
+/// Distributes new versions of a bundle as deltas.  A manifest lists the files of a bundle (the contents of
+/// the include and lib output directories) with their SHA-256 digest and, for files of 64 KiB or more, the
+/// signatures of their blocks, as in rsync: a weak rolling checksum and a truncated SHA-256 digest per block.
+/// A delta pack is made from the manifest of the previous version and the files of the new version alone:
+/// it lists the files that were removed, the symlinks that changed and the files that were added or
+/// changed, the latter as instructions to copy blocks of the previous version of the file and data to be
+/// inserted between them.  Applying a pack checks every path it touches against the version it was made from,
+/// and the digest of every file it writes, before anything in the bundle is replaced.
+/// </summary>
+class delta_pack
+{
+public:
+	struct block_signature
+	{
+		uint32_t weak = 0;
+		uint64_t strong = 0;
+	};
+
+	struct manifest_entry
+	{
+		std::string path; // Relative to the bundle, i.e. starting with 'include/' or 'lib/'.
+		std::string link_target; // Set for symlinks, which have no contents.
+		uint64_t size = 0;
+		std::string hash;
+		uint32_t block_size = 0; // Zero if the blocks have no signatures.
+		std::vector<block_signature> blocks;
+	};
+
+private:
+	struct delta_op
+	{
+		bool is_copy = false;
+		uint64_t first = 0; // The first block (copy), or the offset within the new file (data).
+		uint64_t count = 0; // The number of blocks (copy), or the number of bytes (data).
+	};
+
+	static std::vector<std::pair<std::string, std::filesystem::path>> get_bundle_dirs(const parameter_map& param_map);
+	static std::filesystem::path get_bundle_path(const std::string& path, const std::vector<std::pair<std::string, std::filesystem::path>>& bundle_dirs);
+	static void sign_file(manifest_entry& entry, const std::filesystem::path& file_path);
+	static std::vector<delta_op> get_delta(const manifest_entry& base, const char* data, size_t size);
+
+	static std::vector<manifest_entry> build_manifest(const parameter_map& param_map);
+	static std::vector<manifest_entry> read_manifest(const std::string& filename);
+	static void write_manifest(const std::vector<manifest_entry>& manifest, const std::string& filename);
+	static void write_pack(const std::vector<manifest_entry>& base, const std::vector<manifest_entry>& manifest, const parameter_map& param_map, const std::string& filename);
+
+public:
+	static void write(const parameter_map& param_map);
+	static void apply(const parameter_map& param_map);
+};
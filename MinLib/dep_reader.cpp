@@ -0,0 +1,531 @@
+#include "dep_reader.hpp"
+#include <filesystem>
+#include <stdexcept>
+#include <regex>
+#include <unordered_set>
+#include <cctype>
+#include "mapped_file.hpp"
+#include "string_utils.hpp"
+#include "file_utils.hpp"
+#include "parallel_utils.hpp"
+#include "compiler.hpp"
+#include "bundler.hpp"
+#include "path_cache.hpp"
+#include "errors.hpp"
+#include "cli.hpp"
+
+using namespace std;
+using namespace minlib;
+
+namespace
+{
+	/// <summary>
+	/// Reads the subset of JSON used by compilation databases: an array of objects whose members are
+	/// strings or arrays of strings.  Members of any other type are skipped.
+	/// </summary>
+	class json_reader
+	{
+	private:
+		const char* p;
+		const char* end;
+		const string& filename;
+
+		[[noreturn]] void fail() const
+		{
+			throw runtime_error(regex_replace(COMPILE_COMMANDS_FORMAT_ERROR, regex("%s"), filename));
+		}
+
+		static void append_utf8(string& out, uint32_t cp)
+		{
+			if (cp < 0x80) out += (char)cp;
+			else if (cp < 0x800) { out += (char)(0xc0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3f)); }
+			else if (cp < 0x10000) { out += (char)(0xe0 | (cp >> 12)); out += (char)(0x80 | ((cp >> 6) & 0x3f)); out += (char)(0x80 | (cp & 0x3f)); }
+			else { out += (char)(0xf0 | (cp >> 18)); out += (char)(0x80 | ((cp >> 12) & 0x3f)); out += (char)(0x80 | ((cp >> 6) & 0x3f)); out += (char)(0x80 | (cp & 0x3f)); }
+		}
+
+		uint32_t read_hex4()
+		{
+			if (end - p < 4) fail();
+			uint32_t value = 0;
+			for (int i = 0; i < 4; ++i, ++p)
+			{
+				auto c = (unsigned char)*p;
+				if (!isxdigit(c)) fail();
+				value = (value << 4) | (uint32_t)(isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+			}
+			return value;
+		}
+
+	public:
+		json_reader(const char* data, size_t size, const string& filename) : p(data), end(data + size), filename(filename) {}
+
+		void skip_whitespace()
+		{
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
+		}
+
+		bool at_end() { skip_whitespace(); return p == end; }
+
+		// Consumes the character if it's next, skipping any whitespace before it.
+		bool accept(char c)
+		{
+			skip_whitespace();
+			if (p < end && *p == c) { ++p; return true; }
+			return false;
+		}
+
+		void expect(char c)
+		{
+			if (!accept(c)) fail();
+		}
+
+		bool peek(char c)
+		{
+			skip_whitespace();
+			return p < end && *p == c;
+		}
+
+		string read_string()
+		{
+			expect('"');
+			string result;
+			while (true)
+			{
+				if (p == end) fail();
+				auto c = *p++;
+				if (c == '"') break;
+				if (c != '\\') { result += c; continue; }
+
+				if (p == end) fail();
+				switch (auto e = *p++)
+				{
+				case 'b': result += '\b'; break;
+				case 'f': result += '\f'; break;
+				case 'n': result += '\n'; break;
+				case 'r': result += '\r'; break;
+				case 't': result += '\t'; break;
+				case 'u':
+				{
+					auto cp = read_hex4();
+					if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+					{
+						p += 2;
+						auto low = read_hex4();
+						cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+					}
+					append_utf8(result, cp);
+					break;
+				}
+				default: result += e; break; // '"', '\\' and '/'.
+				}
+			}
+			return result;
+		}
+
+		vector<string> read_string_array()
+		{
+			vector<string> result;
+			expect('[');
+			if (accept(']')) return result;
+			do result.push_back(read_string()); while (accept(','));
+			expect(']');
+			return result;
+		}
+
+		void skip_value()
+		{
+			skip_whitespace();
+			if (p == end) fail();
+
+			if (*p == '"') { read_string(); return; }
+			if (*p == '[' || *p == '{')
+			{
+				auto close = *p == '[' ? ']' : '}';
+				++p;
+				if (accept(close)) return;
+				do
+				{
+					if (close == '}') { read_string(); expect(':'); }
+					skip_value();
+				} while (accept(','));
+				expect(close);
+				return;
+			}
+
+			// Numbers, true, false and null.
+			auto start = p;
+			while (p < end && (isalnum((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.')) ++p;
+			if (p == start) fail();
+		}
+	};
+
+	bool starts_with(string_view str, string_view prefix)
+	{
+		return str.substr(0, prefix.size()) == prefix;
+	}
+}
+
+/// <summary>
+/// Reads the entries of a compilation database (compile_commands.json).
+/// </summary>
+/// <param name="filename">The path to the compilation database.</param>
+/// <returns>The compile commands, in the order they appear in the file.</returns>
+vector<dep_reader::compile_command> dep_reader::read_compile_commands(const string& filename)
+{
+	if (!filesystem::exists(filename))
+		throw runtime_error(regex_replace(FILE_NOT_FOUND, regex("%s"), filename));
+
+	mapped_file file(filename);
+	json_reader reader(file.data(), file.size(), filename);
+	vector<compile_command> result;
+
+	reader.expect('[');
+	if (!reader.accept(']'))
+	{
+		do
+		{
+			compile_command command;
+			string command_line;
+
+			reader.expect('{');
+			if (!reader.peek('}'))
+			{
+				do
+				{
+					auto key = reader.read_string();
+					reader.expect(':');
+
+					if (key == "directory") command.directory = reader.read_string();
+					else if (key == "file") command.file = reader.read_string();
+					else if (key == "output") command.output = reader.read_string();
+					else if (key == "command") command_line = reader.read_string();
+					else if (key == "arguments") command.arguments = reader.read_string_array();
+					else reader.skip_value();
+				} while (reader.accept(','));
+			}
+			reader.expect('}');
+
+			// Either 'arguments' or 'command' must be present; 'arguments' takes precedence.
+			if (command.arguments.empty())
+				command.arguments = split_command(command_line);
+
+			result.push_back(move(command));
+		} while (reader.accept(','));
+
+		reader.expect(']');
+	}
+
+	if (!reader.at_end())
+		throw runtime_error(regex_replace(COMPILE_COMMANDS_FORMAT_ERROR, regex("%s"), filename));
+
+	return result;
+}
+
+/// <summary>
+/// Splits the 'command' of a compile command into its arguments, following the shell's quoting rules.
+/// A backslash only escapes whitespace, quotes and another backslash, so that Windows paths come through intact.
+/// </summary>
+/// <param name="command">The command line.</param>
+/// <returns>The arguments, starting with the compiler.</returns>
+vector<string> dep_reader::split_command(string_view command)
+{
+	vector<string> result;
+	string arg;
+	auto in_arg = false;
+	char quote = 0;
+
+	for (size_t i = 0; i < command.size(); ++i)
+	{
+		auto c = command[i];
+
+		if (quote == '\'')
+		{
+			if (c == '\'') quote = 0;
+			else arg += c;
+			continue;
+		}
+
+		if (c == '\\' && i + 1 < command.size())
+		{
+			auto next = command[i + 1];
+			if (next == '"' || next == '\\' || (quote == 0 && (next == '\'' || SV_WHITESPACE.find(next) != string_view::npos)))
+			{
+				arg += next;
+				in_arg = true;
+				++i;
+				continue;
+			}
+		}
+
+		if (quote == '"')
+		{
+			if (c == '"') quote = 0;
+			else arg += c;
+		}
+		else if (c == '"' || c == '\'')
+		{
+			quote = c;
+			in_arg = true;
+		}
+		else if (SV_WHITESPACE.find(c) != string_view::npos)
+		{
+			if (in_arg) result.push_back(move(arg));
+			arg.clear();
+			in_arg = false;
+		}
+		else
+		{
+			arg += c;
+			in_arg = true;
+		}
+	}
+
+	if (in_arg) result.push_back(move(arg));
+
+	return result;
+}
+
+/// <summary>
+/// Works out where the compiler writes the dependency file for a compile command, i.e. the path given
+/// by -MF (or -Wp,-MD,path), or for -MD/-MMD alone, the object file's path with a '.d' extension.
+/// </summary>
+/// <param name="command">The compile command.</param>
+/// <returns>The full path to the dependency file, or an empty string if the command doesn't write one.</returns>
+string dep_reader::get_dep_file_path(const compile_command& command)
+{
+	string dep_file, output = command.output;
+	auto writes_deps = false;
+	auto& args = command.arguments;
+
+	for (size_t i = 0; i < args.size(); ++i)
+	{
+		string_view arg = args[i];
+
+		if (arg == "-MD" || arg == "-MMD")
+			writes_deps = true;
+		else if (arg == "-MF" && i + 1 < args.size())
+			dep_file = args[++i];
+		else if (starts_with(arg, "-MF"))
+			dep_file = string(arg.substr(3));
+		else if (starts_with(arg, "-Wp,-MD,") || starts_with(arg, "-Wp,-MMD,"))
+			dep_file = string(arg.substr(arg.find(',', 4) + 1));
+		else if (arg == "-o" && i + 1 < args.size())
+			output = args[++i];
+		else if (starts_with(arg, "-o") && arg.size() > 2)
+			output = string(arg.substr(2));
+	}
+
+	if (dep_file.empty() && writes_deps)
+	{
+		auto object_path = filesystem::path(output.empty() ? filesystem::path(command.file).filename().u8string() : output);
+		dep_file = object_path.replace_extension(".d").u8string();
+	}
+
+	if (dep_file.empty())
+		return dep_file;
+
+	auto path = filesystem::path(dep_file);
+	if (path.is_relative())
+		path = filesystem::path(command.directory) / path;
+
+	return path.lexically_normal().u8string();
+}
+
+/// <summary>
+/// Parses a Makefile-style dependency file, as written by -MD/-MMD, returning the prerequisites of its rules
+/// (the phony targets added by -MP have none).  Backslash-newline continues a rule on the next line,
+/// '\ ' and '\#' stand for a space and a '#' within a path and '$$' for a '$'; any other backslash is
+/// part of the path.  A target ends with an unescaped ':' that is followed by whitespace.
+/// </summary>
+/// <param name="filename">The path to the dependency file.</param>
+/// <returns>The prerequisites, as written in the file (relative paths are relative to the compile command's directory).</returns>
+vector<string> dep_reader::parse_dep_file(const string& filename)
+{
+	if (!filesystem::exists(filename))
+		throw runtime_error(regex_replace(DEP_FILE_NOT_FOUND_ERROR, regex("%s"), filename));
+
+	mapped_file file(filename);
+	auto p = file.data();
+	auto end = p + file.size();
+
+	vector<string> result;
+	string token;
+	auto in_prerequisites = false;
+
+	auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+	auto is_continuation = [end](const char* q) {
+		return q[0] == '\\' && q + 1 < end && (q[1] == '\n' || (q[1] == '\r' && q + 2 < end && q[2] == '\n'));
+	};
+
+	while (p < end)
+	{
+		auto c = *p;
+
+		if (c == '\n')
+		{
+			in_prerequisites = false; // The end of the rule.
+			++p;
+			continue;
+		}
+
+		if (is_space(c))
+		{
+			++p;
+			continue;
+		}
+
+		if (is_continuation(p))
+		{
+			p += p[1] == '\n' ? 2 : 3; // Line continuation.
+			continue;
+		}
+
+		if (c == '#')
+		{
+			while (p < end && *p != '\n') ++p; // Comment.
+			continue;
+		}
+
+		// Read the next token.
+		token.clear();
+		while (p < end && !is_space(*p) && *p != '\n')
+		{
+			c = *p;
+			if (c == '\\' && p + 1 < end && (p[1] == ' ' || p[1] == '\t' || p[1] == '#'))
+			{
+				token += p[1];
+				p += 2;
+			}
+			else if (is_continuation(p))
+			{
+				break; // Handled above.
+			}
+			else if (c == '$' && p + 1 < end && p[1] == '$')
+			{
+				token += '$';
+				p += 2;
+			}
+			else
+			{
+				token += c;
+				++p;
+			}
+		}
+
+		if (!in_prerequisites)
+		{
+			// Targets; a ':' within a token (e.g. 'C:\...') doesn't end them.
+			if (!token.empty() && token.back() == ':')
+				in_prerequisites = true;
+			continue;
+		}
+
+		if (token != "|") // Order-only prerequisites are separated by '|'.
+			result.push_back(token);
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Gets the files that the bundle read by read_dependencies() is derived from: the compilation database
+/// and the dependency file of each of its compile commands.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <returns>The full paths to the files.</returns>
+vector<string> dep_reader::get_dep_files(const parameter_map& param_map)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = filesystem::current_path() / working_dir_path;
+
+	filesystem::path compile_commands_path(get_expanded_path(param_map.at(cli::COMPILE_COMMANDS_PARAM)));
+	if (compile_commands_path.is_relative())
+		compile_commands_path = working_dir_path / compile_commands_path;
+
+	vector<string> result{ compile_commands_path.lexically_normal().u8string() };
+	for (auto& command : read_compile_commands(result.front()))
+	{
+		auto dep_file = get_dep_file_path(command);
+		if (!dep_file.empty()) result.push_back(dep_file);
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Builds the bundle from the dependency files that the project's real build wrote for each translation unit
+/// in the compilation database (the 'compile_commands' parameter), rather than running the preprocessor.
+/// The dependency files are parsed in parallel; the header files that belong to one of the include directories
+/// are then reported in the order of the compilation database.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <param name="paths">The cache used to canonicalize the paths of the header files.</param>
+/// <param name="resource">The memory resource to allocate the bundle from, e.g. the run's arena.</param>
+/// <param name="on_include_file">Optional callback, invoked as soon as a header file is found for the first time.</param>
+/// <returns>Returns the list of header files that should be bundled.  The include graph is not available.</returns>
+lib_bundle dep_reader::read_dependencies(const parameter_map& param_map, path_cache& paths, pmr::memory_resource* resource, const function<void(string_view)>& on_include_file)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = filesystem::current_path() / working_dir_path;
+
+	auto get_full_path = [&](const filesystem::path& base, const string& path) {
+		filesystem::path p(path);
+		return (p.is_relative() ? base / p : p).lexically_normal().u8string();
+	};
+
+	auto compile_commands_file = get_full_path(working_dir_path, get_expanded_path(param_map.at(cli::COMPILE_COMMANDS_PARAM)));
+	auto commands = read_compile_commands(compile_commands_file);
+
+	// Filtered the same way as in set_stage_includes().
+	auto include_dirs = bundler::get_include_dirs(working_dir_path, param_map);
+	auto classifier = bundler::get_include_classifier(include_dirs, param_map, paths);
+
+	vector<string> dep_files;
+	for (auto& command : commands)
+	{
+		auto dep_file = get_dep_file_path(command);
+		if (dep_file.empty())
+			throw runtime_error(regex_replace(DEP_FILE_MISSING_ERROR, regex("%s"), command.file));
+		dep_files.push_back(dep_file);
+	}
+
+	// Each translation unit's headers, filtered and normalized the same way as the preprocessor output.
+	vector<vector<string>> headers(commands.size());
+	parallel_for_each(commands.size(), cli::get_job_count(param_map), [&](size_t i) {
+		auto& command = commands[i];
+		auto source_file = get_full_path(command.directory, command.file);
+		size_t dir_index;
+		string relative_path;
+
+		for (auto& prerequisite : parse_dep_file(dep_files[i]))
+		{
+			auto path = get_full_path(command.directory, prerequisite);
+			if (path == source_file) continue;
+
+			auto normalized = string(compiler::normalize_path(path));
+			if (classifier.classify(normalized, dir_index, relative_path))
+				headers[i].push_back(move(normalized));
+		}
+	});
+
+	lib_bundle result(resource);
+	unordered_set<string> seen_files;
+
+	// The same header may be reached through different paths (symlinks, '..' segments, etc).
+	for (auto& tu_headers : headers)
+	{
+		for (auto& header : tu_headers)
+		{
+			string canonical_path;
+			if (!paths.get_canonical_path(header, canonical_path)) canonical_path = header;
+			if (!seen_files.insert(canonical_path).second) continue;
+
+			result.include_files.emplace_back(header);
+			if (on_include_file) on_include_file(header);
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <functional>
+#include "parameter.hpp"
+#include "lib_bundle.hpp"
+#include "path_cache.hpp"
+
+class dep_reader
+{
+private:
+	struct compile_command
+	{
+		std::string directory;
+		std::string file;
+		std::string output;
+		std::vector<std::string> arguments;
+	};
+
+private:
+	static std::vector<compile_command> read_compile_commands(const std::string& filename);
+	static std::vector<std::string> split_command(std::string_view command);
+	static std::string get_dep_file_path(const compile_command& command);
+	static std::vector<std::string> parse_dep_file(const std::string& filename);
+
+public:
+	static std::vector<std::string> get_dep_files(const parameter_map& param_map);
+	static lib_bundle read_dependencies(const parameter_map& param_map, path_cache& paths, std::pmr::memory_resource* resource, const std::function<void(std::string_view)>& on_include_file = nullptr);
+};
@@ -0,0 +1,417 @@
+#include "elf_utils.hpp"
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "mapped_file.hpp"
+#include "string_utils.hpp"
+
+using namespace std;
+
+// The ELF structures are read field by field rather than through <elf.h>, which isn't available
+// on Windows, and so that both 32/64-bit and little/big-endian files can be read on any host.
+namespace
+{
+	const unsigned char ELF_CLASS_32 = 1;
+	const unsigned char ELF_CLASS_64 = 2;
+	const unsigned char ELF_DATA_LSB = 1;
+	const unsigned char ELF_DATA_MSB = 2;
+
+	const uint32_t SHT_NOBITS = 8;
+	const uint64_t SHF_ALLOC = 0x2;
+
+	const uint32_t PT_LOAD = 1;
+	const uint32_t PT_DYNAMIC = 2;
+
+	const int64_t DT_NULL = 0;
+	const int64_t DT_NEEDED = 1;
+	const int64_t DT_STRTAB = 5;
+	const int64_t DT_STRSZ = 10;
+	const int64_t DT_SONAME = 14;
+	const int64_t DT_RPATH = 15;
+	const int64_t DT_RUNPATH = 29;
+
+	class elf_reader
+	{
+	private:
+		const unsigned char* data;
+		size_t size;
+		bool is_64;
+		bool is_big_endian;
+
+	public:
+		elf_reader(const char* data, size_t size) : data((const unsigned char*)data), size(size)
+		{
+			is_64 = this->data[4] == ELF_CLASS_64;
+			is_big_endian = this->data[5] == ELF_DATA_MSB;
+		}
+
+		bool is_64_bit() const { return is_64; }
+
+		bool in_bounds(uint64_t offset, uint64_t length) const
+		{
+			return offset <= size && length <= size - offset;
+		}
+
+		// Reads an unsigned integer of 'length' bytes (1-8) at the offset, in the file's byte order.
+		uint64_t read(uint64_t offset, size_t length) const
+		{
+			uint64_t value = 0;
+			for (size_t i = 0; i < length; ++i)
+			{
+				auto byte = data[offset + (is_big_endian ? i : length - 1 - i)];
+				value = (value << 8) | byte;
+			}
+			return value;
+		}
+
+		// Reads a word whose size depends on the file's class (Elf32_Addr/Off vs. Elf64_Addr/Off, etc).
+		uint64_t read_word(uint64_t offset) const
+		{
+			return read(offset, is_64 ? 8 : 4);
+		}
+
+		// Writes an unsigned integer of 'length' bytes at the offset of the buffer, in the file's byte order.
+		void write(string& buffer, size_t offset, size_t length, uint64_t value) const
+		{
+			for (size_t i = 0; i < length; ++i)
+			{
+				buffer[offset + (is_big_endian ? length - 1 - i : i)] = (char)(value & 0xff);
+				value >>= 8;
+			}
+		}
+	};
+
+	struct load_segment
+	{
+		uint64_t offset;
+		uint64_t vaddr;
+		uint64_t filesz;
+	};
+}
+
+/// <summary>
+/// Checks whether the file starts with the ELF magic number.
+/// </summary>
+/// <param name="filename">The name of the file.</param>
+/// <returns>Returns true if the file is an ELF file.</returns>
+bool is_elf_file(const string& filename)
+{
+	mapped_file file(filename);
+	return file.size() >= 4 && memcmp(file.data(), "\x7f" "ELF", 4) == 0;
+}
+
+/// <summary>
+/// Reads the dynamic section of an ELF shared object (or executable).  The dynamic section is found
+/// via the program headers rather than the section headers, so stripped files can be read as well.
+/// </summary>
+/// <param name="filename">The name of the file.</param>
+/// <param name="out_info">Set to the dependencies and search paths listed in the dynamic section.</param>
+/// <returns>Returns false if the file is not an ELF file, or if it has no (valid) dynamic section.</returns>
+bool get_elf_dynamic_info(const string& filename, elf_dynamic_info& out_info)
+{
+	out_info = elf_dynamic_info();
+
+	mapped_file file(filename);
+	if (file.size() < 52 || memcmp(file.data(), "\x7f" "ELF", 4) != 0)
+		return false;
+
+	auto elf_class = (unsigned char)file.data()[4];
+	auto elf_data = (unsigned char)file.data()[5];
+	if ((elf_class != ELF_CLASS_32 && elf_class != ELF_CLASS_64) || (elf_data != ELF_DATA_LSB && elf_data != ELF_DATA_MSB))
+		return false;
+
+	elf_reader elf(file.data(), file.size());
+	if (elf.is_64_bit() && file.size() < 64)
+		return false;
+
+	// The offsets of the program header fields within the ELF header (Elf32_Ehdr/Elf64_Ehdr).
+	auto phoff = elf.read_word(elf.is_64_bit() ? 32 : 28);
+	auto phentsize = elf.read(elf.is_64_bit() ? 54 : 42, 2);
+	auto phnum = elf.read(elf.is_64_bit() ? 56 : 44, 2);
+	if (phentsize < (elf.is_64_bit() ? 56u : 32u) || !elf.in_bounds(phoff, phentsize * phnum))
+		return false;
+
+	vector<load_segment> loads;
+	uint64_t dynamic_offset = 0, dynamic_size = 0;
+	auto has_dynamic = false;
+
+	for (uint64_t i = 0; i < phnum; ++i)
+	{
+		auto ph = phoff + i * phentsize;
+		auto type = elf.read(ph, 4);
+
+		// Elf64_Phdr: type, flags, offset, vaddr, paddr, filesz, ...
+		// Elf32_Phdr: type, offset, vaddr, paddr, filesz, ...
+		auto offset = elf.is_64_bit() ? elf.read(ph + 8, 8) : elf.read(ph + 4, 4);
+		auto vaddr = elf.is_64_bit() ? elf.read(ph + 16, 8) : elf.read(ph + 8, 4);
+		auto filesz = elf.is_64_bit() ? elf.read(ph + 32, 8) : elf.read(ph + 16, 4);
+
+		if (type == PT_LOAD)
+			loads.push_back({ offset, vaddr, filesz });
+		else if (type == PT_DYNAMIC)
+		{
+			dynamic_offset = offset;
+			dynamic_size = filesz;
+			has_dynamic = true;
+		}
+	}
+
+	if (!has_dynamic || !elf.in_bounds(dynamic_offset, dynamic_size))
+		return false;
+
+	// The dynamic entries refer to the string table by its virtual address, which is
+	// translated to a file offset via the loadable segment that contains it.
+	auto to_file_offset = [&loads](uint64_t vaddr, uint64_t& out_offset) {
+		for (auto& load : loads)
+		{
+			if (vaddr >= load.vaddr && vaddr - load.vaddr < load.filesz)
+			{
+				out_offset = load.offset + (vaddr - load.vaddr);
+				return true;
+			}
+		}
+		return false;
+	};
+
+	auto entry_size = elf.is_64_bit() ? 16 : 8;
+	uint64_t strtab = 0, strsz = 0;
+	auto has_strtab = false;
+	vector<pair<int64_t, uint64_t>> entries;
+
+	for (uint64_t e = dynamic_offset; e + entry_size <= dynamic_offset + dynamic_size; e += entry_size)
+	{
+		auto tag = (int64_t)elf.read_word(e);
+		auto value = elf.read_word(e + entry_size / 2);
+		if (tag == DT_NULL) break;
+
+		if (tag == DT_STRTAB) { strtab = value; has_strtab = true; }
+		else if (tag == DT_STRSZ) strsz = value;
+		else if (tag == DT_NEEDED || tag == DT_SONAME || tag == DT_RPATH || tag == DT_RUNPATH)
+			entries.push_back({ tag, value });
+	}
+
+	uint64_t strtab_offset = 0;
+	if (!has_strtab || !to_file_offset(strtab, strtab_offset))
+		return false;
+	if (strsz == 0 || !elf.in_bounds(strtab_offset, strsz))
+		strsz = file.size() - strtab_offset;
+
+	auto get_string = [&](uint64_t index) {
+		if (index >= strsz) return string();
+		auto begin = file.data() + strtab_offset + index;
+		auto end = (const char*)memchr(begin, '\0', strsz - index);
+		return end == nullptr ? string() : string(begin, end);
+	};
+
+	auto split_paths = [](const string& paths, vector<string>& out_paths) {
+		for (auto path : sv_split(paths, ":"))
+			out_paths.emplace_back(path);
+	};
+
+	for (auto& [tag, value] : entries)
+	{
+		if (tag == DT_NEEDED) out_info.needed.push_back(get_string(value));
+		else if (tag == DT_SONAME) out_info.soname = get_string(value);
+		else if (tag == DT_RPATH) split_paths(get_string(value), out_info.rpath);
+		else if (tag == DT_RUNPATH) split_paths(get_string(value), out_info.runpath);
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Works out how to rewrite an ELF object (a relocatable object from a static lib, or a shared object)
+/// without its debug sections (.debug_*, .zdebug_* and their relocation sections).  Only sections that
+/// aren't loaded at run time are moved, so the contents of the segments stay at their original offsets.
+/// The section headers of the debug sections are kept with a size of zero, so that section indexes (as
+/// used by the symbol table, relocations, etc) remain valid and all symbols are kept.
+/// </summary>
+/// <param name="data">The contents of the ELF object.</param>
+/// <param name="size">The size of the ELF object.</param>
+/// <param name="out_plan">Set to the layout of the stripped object.</param>
+/// <returns>Returns false if the data is not an ELF object that can be stripped, or if it has no debug sections.</returns>
+bool get_elf_strip_plan(const char* data, size_t size, elf_strip_plan& out_plan)
+{
+	out_plan = elf_strip_plan();
+
+	if (size < 52 || memcmp(data, "\x7f" "ELF", 4) != 0)
+		return false;
+
+	auto elf_class = (unsigned char)data[4];
+	auto elf_data = (unsigned char)data[5];
+	if ((elf_class != ELF_CLASS_32 && elf_class != ELF_CLASS_64) || (elf_data != ELF_DATA_LSB && elf_data != ELF_DATA_MSB))
+		return false;
+
+	elf_reader elf(data, size);
+	auto is_64 = elf.is_64_bit();
+	if (is_64 && size < 64)
+		return false;
+
+	auto ehsize = elf.read(is_64 ? 52 : 40, 2);
+	auto phoff = elf.read_word(is_64 ? 32 : 28);
+	auto phentsize = elf.read(is_64 ? 54 : 42, 2);
+	auto phnum = elf.read(is_64 ? 56 : 44, 2);
+	auto shoff_field = is_64 ? 40 : 32;
+	auto shoff = elf.read_word(shoff_field);
+	auto shentsize = elf.read(is_64 ? 58 : 46, 2);
+	auto shnum = elf.read(is_64 ? 60 : 48, 2);
+	auto shstrndx = elf.read(is_64 ? 62 : 50, 2);
+
+	if (shoff == 0 || shentsize < (is_64 ? 64u : 40u) || ehsize > size || !elf.in_bounds(shoff, shentsize))
+		return false;
+
+	// With more than 0xff00 sections, the count and the index of the section name table are in section 0.
+	if (shnum == 0) shnum = is_64 ? elf.read(shoff + 32, 8) : elf.read(shoff + 20, 4);
+	if (shstrndx == 0xffff) shstrndx = elf.read(shoff + (is_64 ? 40 : 24), 4);
+	if (shnum == 0 || shstrndx >= shnum || !elf.in_bounds(shoff, shentsize * shnum))
+		return false;
+
+	struct section
+	{
+		uint64_t header;
+		uint64_t offset;
+		uint64_t size;
+		uint64_t align;
+		bool has_contents;
+		bool is_alloc;
+		bool is_debug = false;
+	};
+
+	vector<section> sections(shnum);
+	for (uint64_t i = 0; i < shnum; ++i)
+	{
+		auto sh = shoff + i * shentsize;
+		auto& sec = sections[i];
+		sec.header = sh;
+		auto type = elf.read(sh + 4, 4);
+		auto flags = is_64 ? elf.read(sh + 8, 8) : elf.read(sh + 8, 4);
+		sec.offset = is_64 ? elf.read(sh + 24, 8) : elf.read(sh + 16, 4);
+		sec.size = is_64 ? elf.read(sh + 32, 8) : elf.read(sh + 20, 4);
+		sec.align = is_64 ? elf.read(sh + 48, 8) : elf.read(sh + 32, 4);
+		sec.has_contents = i != 0 && type != SHT_NOBITS && sec.size > 0;
+		sec.is_alloc = (flags & SHF_ALLOC) != 0;
+
+		if (sec.has_contents && !elf.in_bounds(sec.offset, sec.size))
+			return false;
+	}
+
+	auto& names = sections[shstrndx];
+	if (!names.has_contents) return false;
+
+	auto has_prefix = [&](uint64_t name_index, const char* prefix) {
+		auto length = strlen(prefix);
+		return name_index < names.size && names.size - name_index >= length && memcmp(data + names.offset + name_index, prefix, length) == 0;
+	};
+
+	auto has_debug_sections = false;
+	for (uint64_t i = 1; i < shnum; ++i)
+	{
+		auto name_index = elf.read(sections[i].header, 4);
+		if (!sections[i].is_alloc && (has_prefix(name_index, ".debug") || has_prefix(name_index, ".zdebug") ||
+			has_prefix(name_index, ".rel.debug") || has_prefix(name_index, ".rela.debug")))
+		{
+			sections[i].is_debug = true;
+			has_debug_sections |= sections[i].has_contents;
+		}
+	}
+
+	if (!has_debug_sections) return false;
+
+	// Everything up to the end of the last segment (and the program header table) stays where it is.
+	uint64_t fixed_end = ehsize;
+	if (phnum > 0)
+	{
+		if (!elf.in_bounds(phoff, phentsize * phnum)) return false;
+		fixed_end = max(fixed_end, phoff + phentsize * phnum);
+
+		for (uint64_t i = 0; i < phnum; ++i)
+		{
+			auto ph = phoff + i * phentsize;
+			auto offset = is_64 ? elf.read(ph + 8, 8) : elf.read(ph + 4, 4);
+			auto filesz = is_64 ? elf.read(ph + 32, 8) : elf.read(ph + 16, 4);
+			fixed_end = max(fixed_end, offset + filesz);
+		}
+	}
+	if (fixed_end > size) return false;
+
+	// The sections after the fixed part are packed in their original order, leaving out the debug sections.
+	vector<uint64_t> order;
+	for (uint64_t i = 1; i < shnum; ++i)
+	{
+		auto& sec = sections[i];
+		if (sec.offset + (sec.has_contents ? sec.size : 0) <= fixed_end) continue;
+		if (sec.has_contents && sec.offset < fixed_end) return false; // Straddles the fixed part.
+		if (phnum > 0 && sec.is_alloc && sec.has_contents) return false; // Loaded, but outside of any segment.
+		order.push_back(i);
+	}
+	stable_sort(order.begin(), order.end(), [&sections](uint64_t a, uint64_t b) { return sections[a].offset < sections[b].offset; });
+
+	auto align_to = [](uint64_t offset, uint64_t align) {
+		return align > 1 ? (offset + align - 1) / align * align : offset;
+	};
+
+	string header(data, (size_t)ehsize);
+	string section_headers(data + shoff, (size_t)(shentsize * shnum));
+
+	out_plan.pieces.push_back({ 0, 0, ehsize, string() });
+	if (fixed_end > ehsize)
+		out_plan.pieces.push_back({ ehsize, ehsize, fixed_end - ehsize, string() });
+
+	auto position = fixed_end;
+	for (auto i : order)
+	{
+		auto& sec = sections[i];
+		uint64_t new_offset, new_size = sec.size;
+
+		if (sec.is_debug || !sec.has_contents)
+		{
+			new_offset = position;
+			if (sec.is_debug) new_size = 0;
+		}
+		else
+		{
+			new_offset = align_to(position, sec.align);
+			out_plan.pieces.push_back({ new_offset, sec.offset, sec.size, string() });
+			position = new_offset + sec.size;
+		}
+
+		auto sh = (size_t)(i * shentsize);
+		elf.write(section_headers, sh + (is_64 ? 24 : 16), is_64 ? 8 : 4, new_offset);
+		elf.write(section_headers, sh + (is_64 ? 32 : 20), is_64 ? 8 : 4, new_size);
+	}
+
+	auto new_shoff = align_to(position, is_64 ? 8 : 4);
+	elf.write(header, shoff_field, is_64 ? 8 : 4, new_shoff);
+	out_plan.pieces[0].bytes = move(header);
+	out_plan.pieces.push_back({ new_shoff, 0, section_headers.size(), move(section_headers) });
+	out_plan.size = new_shoff + out_plan.pieces.back().size;
+
+	return true;
+}
+
+/// <summary>
+/// Writes an ELF object according to the layout produced by get_elf_strip_plan().
+/// </summary>
+/// <param name="data">The contents of the original ELF object.</param>
+/// <param name="plan">The layout of the stripped object.</param>
+/// <param name="out">The stream to write the stripped object to.</param>
+void write_elf_strip_plan(const char* data, const elf_strip_plan& plan, ostream& out)
+{
+	static const char zeros[16] = {};
+	uint64_t position = 0;
+
+	for (auto& piece : plan.pieces)
+	{
+		for (; position < piece.offset; position += min<uint64_t>(sizeof(zeros), piece.offset - position))
+			out.write(zeros, (streamsize)min<uint64_t>(sizeof(zeros), piece.offset - position));
+
+		if (!piece.bytes.empty())
+			out.write(piece.bytes.data(), (streamsize)piece.bytes.size());
+		else
+			out.write(data + piece.source_offset, (streamsize)piece.size);
+		position = piece.offset + piece.size;
+	}
+
+	for (; position < plan.size; ++position)
+		out.put('\0');
+}
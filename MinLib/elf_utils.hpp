@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+
+/// <summary>
+/// The parts of an ELF shared object's dynamic section that determine which other shared objects
+/// it depends on and where the dynamic linker looks for them.
+/// </summary>
+struct elf_dynamic_info
+{
+	std::string soname;                // DT_SONAME
+	std::vector<std::string> needed;   // DT_NEEDED, in the order the dynamic linker loads them.
+	std::vector<std::string> rpath;    // DT_RPATH, split on ':'; ignored by the linker if 'runpath' is set.
+	std::vector<std::string> runpath;  // DT_RUNPATH, split on ':'.
+};
+
+bool is_elf_file(const std::string& filename);
+
+bool get_elf_dynamic_info(const std::string& filename, elf_dynamic_info& out_info);
+
+/// <summary>
+/// The layout of an ELF object with its debug sections removed, as a list of pieces to be written at
+/// increasing offsets.  A piece either refers to a range of the original file or holds its own bytes
+/// (the patched ELF header and section header table).  The gaps between the pieces are zero-filled.
+/// </summary>
+struct elf_strip_plan
+{
+	struct piece
+	{
+		uint64_t offset = 0;
+		uint64_t source_offset = 0;
+		uint64_t size = 0;
+		std::string bytes; // If not empty, written instead of the range of the original file.
+	};
+
+	std::vector<piece> pieces;
+	uint64_t size = 0;
+};
+
+bool get_elf_strip_plan(const char* data, size_t size, elf_strip_plan& out_plan);
+
+void write_elf_strip_plan(const char* data, const elf_strip_plan& plan, std::ostream& out);
@@ -12,8 +12,33 @@ namespace minlib
 	static const char* MSVC_BAT_NOT_FOUND_ERROR = "Could not find the 'vcvars32.bat' batch file; please supply the path to this file via 'msvc_vcvars32_bat' parameter.";
 	static const char* FILE_NOT_FOUND = "File '%s' not found.";
 	static const char* FILE_READ_ERROR = "File '%s' could not be opened.";
+	static const char* FILE_WRITE_ERROR = "File '%s' could not be written.";
 	static const char* STRING_RESIZE_ERROR = "Could not resize string to %s bytes.";
 	static const char* COPY_FILES_INVALID_ARG_ERROR = "The 'copy_files' parameter is malformed.";
 	static const char* COPY_FILES_SRC_MISSING_ERROR = "Cannot copy '%s', as it could not be found.";
 	static const char* COPY_FILES_ERROR = "Could not copy '%s' due to error: %e";
+	static const char* PCH_BUILD_ERROR = "Could not build the precompiled header for '%s'.";
+	static const char* HEADER_UNITS_COMPILER_ERROR = "Header units can only be built when using the GCC compiler.";
+	static const char* HEADER_UNIT_BUILD_ERROR = "Could not build the header unit for '%s'.";
+	static const char* LIB_STRIP_FORMAT_ERROR = "Could not strip '%s', as the archive is malformed.";
+	static const char* VERIFY_ERROR = "The bundle is not self-contained: %s of the top-level includes could not be preprocessed against it.";
+	static const char* COMPILE_COMMANDS_FORMAT_ERROR = "The compilation database '%s' is malformed.";
+	static const char* DEP_FILE_MISSING_ERROR = "The compile command for '%s' does not write a dependency file; add -MD or -MMD to the project's compiler flags.";
+	static const char* DEP_FILE_NOT_FOUND_ERROR = "Dependency file '%s' not found; the project must be built before its dependency files can be read.";
+	static const char* FILTER_PATTERN_ERROR = "The filter pattern '%s' is malformed.";
+	static const char* QUERY_ARG_ERROR = "The 'query' parameter must be 'resolve', 'bundle', 'clear' or 'stop', but was '%s'.";
+	static const char* SOCKET_PATH_ERROR = "The socket path '%s' is too long.";
+	static const char* SERVER_RUNNING_ERROR = "A MinLib server is already listening on '%s'.";
+	static const char* SERVER_LISTEN_ERROR = "Could not listen on '%s'.";
+	static const char* SERVER_CONNECT_ERROR = "Could not connect to a MinLib server on '%s'; start one with 'minlib --serve'.";
+	static const char* SERVER_RESPONSE_ERROR = "The MinLib server sent back a malformed response.";
+	static const char* LOCK_FILE_ERROR = "Could not lock '%s'.";
+	static const char* MANIFEST_FORMAT_ERROR = "'%s' is not a MinLib manifest.";
+	static const char* DELTA_PACK_FORMAT_ERROR = "'%s' is not a MinLib delta pack, or it is truncated.";
+	static const char* DELTA_PARAMS_ERROR = "The 'delta_base' and 'delta_pack' parameters must be set together.";
+	static const char* DELTA_PATH_ERROR = "The delta pack contains a path outside of the bundle: '%s'.";
+	static const char* DELTA_BASE_ERROR = "'%s' does not match the version of the bundle that the delta pack was made from; the bundle was left unchanged.";
+	static const char* DELTA_VERIFY_ERROR = "'%s' does not match its digest after patching; the bundle was left unchanged.";
+	static const char* DELTA_TARGET_ERROR = "'%s' is in the way of the delta pack (e.g. a directory where a file is to be written, or a file where a directory is needed); the bundle was left unchanged.";
+	static const char* INVALID_JOBS_ARG_ERROR = "The 'jobs' parameter must be a positive number, but was '%s'.";
 }
\ No newline at end of file
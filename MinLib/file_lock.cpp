@@ -0,0 +1,128 @@
+#include "file_lock.hpp"
+#include <stdexcept>
+#include <regex>
+#include <filesystem>
+#include "errors.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+using namespace std;
+using namespace minlib;
+
+/// <summary>
+/// Opens (or creates) the lock file, without locking it.
+/// </summary>
+/// <param name="filename">The name of the lock file.</param>
+file_lock::file_lock(const string& filename) : filename(filename)
+{
+#ifdef _WIN32
+	auto handle = CreateFileW(filesystem::u8path(filename).wstring().c_str(), GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		throw runtime_error(regex_replace(LOCK_FILE_ERROR, regex("%s"), filename));
+	file_handle = handle;
+#else
+	file_descriptor = open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (file_descriptor < 0)
+		throw runtime_error(regex_replace(LOCK_FILE_ERROR, regex("%s"), filename));
+#endif
+}
+
+file_lock::~file_lock()
+{
+	unlock();
+
+#ifdef _WIN32
+	if (file_handle != nullptr) CloseHandle(file_handle);
+#else
+	if (file_descriptor >= 0) close(file_descriptor);
+#endif
+}
+
+/// <summary>
+/// Locks the file, replacing the lock already held by the instance, if any.
+/// </summary>
+/// <param name="exclusive">Whether to take an exclusive lock, rather than a shared one.</param>
+/// <param name="wait">Whether to wait for the lock, rather than failing if it's held by someone else.</param>
+/// <returns>Returns false if the lock is held by someone else and 'wait' is false.</returns>
+bool file_lock::acquire(bool exclusive, bool wait)
+{
+	// Windows doesn't allow a shared lock to overlap an exclusive one, even if the same handle holds both.
+	unlock();
+
+#ifdef _WIN32
+	OVERLAPPED overlapped{};
+	DWORD flags = (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0) | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+	if (!LockFileEx(file_handle, flags, 0, MAXDWORD, MAXDWORD, &overlapped))
+	{
+		if (!wait && GetLastError() == ERROR_LOCK_VIOLATION)
+			return false;
+		throw runtime_error(regex_replace(LOCK_FILE_ERROR, regex("%s"), filename));
+	}
+#else
+	auto operation = (exclusive ? LOCK_EX : LOCK_SH) | (wait ? 0 : LOCK_NB);
+	int result;
+	while ((result = flock(file_descriptor, operation)) != 0 && errno == EINTR);
+
+	if (result != 0)
+	{
+		if (!wait && errno == EWOULDBLOCK)
+			return false;
+		throw runtime_error(regex_replace(LOCK_FILE_ERROR, regex("%s"), filename));
+	}
+#endif
+
+	locked = true;
+	return true;
+}
+
+/// <summary>
+/// Takes an exclusive lock on the file, unless it's held by someone else.
+/// </summary>
+/// <returns>Returns false if the file is locked by someone else.</returns>
+bool file_lock::try_lock()
+{
+	return acquire(true, false);
+}
+
+/// <summary>
+/// Takes an exclusive lock on the file, waiting for the others to release theirs.
+/// </summary>
+void file_lock::lock()
+{
+	acquire(true, true);
+}
+
+/// <summary>
+/// Takes a shared lock on the file, waiting for an exclusive lock to be released.
+/// </summary>
+void file_lock::lock_shared()
+{
+	acquire(false, true);
+}
+
+/// <summary>
+/// Releases the lock, if held.
+/// </summary>
+void file_lock::unlock()
+{
+	if (!locked) return;
+
+#ifdef _WIN32
+	OVERLAPPED overlapped{};
+	UnlockFileEx(file_handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+#else
+	flock(file_descriptor, LOCK_UN);
+#endif
+
+	locked = false;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+
+/// <summary>
+/// An advisory lock on a file (flock() on POSIX, LockFileEx() on Windows), which is created if it doesn't
+/// exist.  The lock is held by the instance rather than the process, so two instances conflict even within
+/// the same process, and it's released when the instance is destroyed or the process ends.
+/// </summary>
+class file_lock
+{
+private:
+	std::string filename;
+	bool locked = false;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+
+	bool acquire(bool exclusive, bool wait);
+
+public:
+	explicit file_lock(const std::string& filename);
+	~file_lock();
+
+	file_lock(const file_lock&) = delete;
+	file_lock& operator=(const file_lock&) = delete;
+
+	bool try_lock();
+	void lock();
+	void lock_shared();
+	void unlock();
+
+	const std::string& get_filename() const { return filename; }
+};
@@ -80,3 +80,19 @@ string get_expanded_path(const string& path)
     return result;
 }
 
+
+/// <summary>
+/// Removes the root (drive letter or leading slash) from an absolute path, so that it
+/// can be appended to another path.
+/// </summary>
+/// <param name="path">The absolute path.</param>
+/// <returns>The path without its root.</returns>
+string get_rootless_path(const string& path)
+{
+    auto partition = path.substr(0, 2);
+
+    if (regex_match(partition, regex("[A-Za-z]:")))
+        return path.substr(3); // Windows
+    else
+        return path.substr(1); // *nix
+}
@@ -5,4 +5,6 @@
 
 std::string get_file_contents(const char* filename);
 
-std::string get_expanded_path(const std::string& path);
\ No newline at end of file
+std::string get_expanded_path(const std::string& path);
+
+std::string get_rootless_path(const std::string& path);
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "file_watcher.hpp"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+using namespace std;
+
+#ifdef __linux__
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+	| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+// How long the reader waits for events before checking whether the watcher is being destroyed.
+static const int POLL_INTERVAL_MS = 100;
+#endif
+
+/// <summary>
+/// Creates the watcher.
+/// </summary>
+/// <param name="ignored_prefix">The prefix of the names of entries whose changes are ignored (e.g. temporary directories).</param>
+file_watcher::file_watcher(const string& ignored_prefix) : ignored_prefix(ignored_prefix)
+{
+#ifdef __linux__
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd >= 0)
+		reader = thread([this]() { read_events(); });
+#endif
+}
+
+file_watcher::~file_watcher()
+{
+	stopping = true;
+	if (reader.joinable())
+		reader.join();
+
+#ifdef __linux__
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+/// <summary>
+/// Checks whether changes are reported, i.e. whether the platform supports watching directories.
+/// </summary>
+bool file_watcher::is_active() const
+{
+	return fd >= 0;
+}
+
+/// <summary>
+/// Gets the sequence number of the last change, to be recorded before a result is computed.
+/// </summary>
+uint64_t file_watcher::get_sequence()
+{
+	lock_guard<std::mutex> lock(mutex);
+	return sequence;
+}
+
+/// <summary>
+/// Starts watching a directory, unless it's already being watched.  Subdirectories are not watched.
+/// </summary>
+/// <param name="dir">The path to the directory.</param>
+/// <returns>Returns false if the directory can't be watched (it doesn't exist, or the watch limit was reached).</returns>
+bool file_watcher::watch(const string& dir)
+{
+#ifdef __linux__
+	if (fd < 0) return false;
+
+	lock_guard<std::mutex> lock(mutex);
+	if (dir_watches.find(dir) != dir_watches.end())
+		return true;
+
+	auto wd = inotify_add_watch(fd, dir.c_str(), WATCH_MASK | IN_ONLYDIR);
+	if (wd < 0) return false;
+
+	// The same directory may be reached through several paths, which share the watch descriptor.
+	watches.emplace(wd, watch_state());
+	dir_watches[dir] = wd;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/// <summary>
+/// Checks whether any of the directories' entries or any of the files changed after the given sequence number.
+/// Directories that aren't watched (any more) count as changed, as do files whose directory isn't watched.
+/// </summary>
+/// <param name="dirs">The paths to the directories, as passed to watch().</param>
+/// <param name="files">The paths to the files, each within a directory passed to watch().</param>
+/// <param name="since">The sequence number returned by get_sequence() before the result was computed.</param>
+bool file_watcher::has_changed(const vector<string>& dirs, const vector<string>& files, uint64_t since)
+{
+	lock_guard<std::mutex> lock(mutex);
+	if (overflow_sequence > since)
+		return true;
+
+	for (auto& dir : dirs)
+	{
+		auto it = dir_watches.find(dir);
+		if (it == dir_watches.end() || watches[it->second].entries_changed > since)
+			return true;
+	}
+
+	for (auto& file : files)
+	{
+		auto separator = file.find_last_of('/');
+		auto it = dir_watches.find(separator == 0 ? "/" : file.substr(0, separator));
+		if (separator == string::npos || it == dir_watches.end())
+			return true;
+
+		auto& files_changed = watches[it->second].files_changed;
+		if (auto fit = files_changed.find(file.substr(separator + 1)); fit != files_changed.end() && fit->second > since)
+			return true;
+	}
+
+	return false;
+}
+
+/// <summary>
+/// Checks whether directories were created, removed or renamed since the last call, in which case the
+/// cached canonical paths (see path_cache) may be stale.
+/// </summary>
+bool file_watcher::take_dirs_changed()
+{
+	lock_guard<std::mutex> lock(mutex);
+	auto result = dirs_changed;
+	dirs_changed = false;
+	return result;
+}
+
+/// <summary>
+/// Forgets the files that last changed at or before the given sequence number, so that the files changed in
+/// the watched directories (e.g. build output) don't pile up.  Afterwards, has_changed() is only accurate when
+/// called with a sequence number at or after that one.
+/// </summary>
+/// <param name="up_to">The oldest sequence number that has_changed() is still called with.</param>
+void file_watcher::forget_changes(uint64_t up_to)
+{
+	lock_guard<std::mutex> lock(mutex);
+	for (auto& [wd, state] : watches)
+	{
+		for (auto it = state.files_changed.begin(); it != state.files_changed.end();)
+			it = it->second <= up_to ? state.files_changed.erase(it) : next(it);
+	}
+}
+
+/// <summary>
+/// Reads the change events until the watcher is destroyed; runs on the reader thread.
+/// </summary>
+void file_watcher::read_events()
+{
+#ifdef __linux__
+	alignas(inotify_event) char buffer[64 * 1024];
+
+	while (!stopping)
+	{
+		pollfd pfd{ fd, POLLIN, 0 };
+		if (poll(&pfd, 1, POLL_INTERVAL_MS) <= 0)
+			continue;
+
+		auto length = read(fd, buffer, sizeof(buffer));
+		if (length <= 0)
+			continue;
+
+		lock_guard<std::mutex> lock(mutex);
+		for (char* p = buffer; p < buffer + length;)
+		{
+			auto event = (const inotify_event*)p;
+			p += sizeof(inotify_event) + event->len;
+
+			// Events were dropped, so any directory may have changed.
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				overflow_sequence = ++sequence;
+				dirs_changed = true;
+				continue;
+			}
+
+			auto it = watches.find(event->wd);
+			if (it == watches.end())
+				continue;
+
+			string name(event->len > 0 ? event->name : "");
+			if (!name.empty() && !ignored_prefix.empty() && name.compare(0, ignored_prefix.size(), ignored_prefix) == 0)
+				continue;
+
+			auto change = ++sequence;
+			if (!name.empty())
+				it->second.files_changed[name] = change;
+			if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+				it->second.entries_changed = change;
+
+			if ((event->mask & IN_ISDIR) || (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)))
+				dirs_changed = true;
+
+			// The directory is gone (or was renamed), so the watch is dropped; it's watched again
+			// when a result that depends on it is recomputed.
+			if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+			{
+				if (!(event->mask & IN_IGNORED))
+					inotify_rm_watch(fd, event->wd);
+
+				for (auto dit = dir_watches.begin(); dit != dir_watches.end();)
+					dit = dit->second == event->wd ? dir_watches.erase(dit) : next(dit);
+				watches.erase(it);
+			}
+		}
+	}
+#endif
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+/// <summary>
+/// Watches directories for changes, using inotify on Linux: entries created, removed or renamed, and files
+/// written to or whose attributes changed.  Every change bumps a sequence number, which is recorded for the
+/// file and, if the directory's entries changed, for the directory, so that a result derived from a set of
+/// files and directories can be checked for staleness without touching the file system: it's stale if any
+/// of them changed after the sequence number that was current when the result was computed.  On other
+/// platforms the watcher is inactive, and callers have to compare the files' timestamps instead.  Thread-safe.
+/// </summary>
+class file_watcher
+{
+private:
+	struct watch_state
+	{
+		uint64_t entries_changed = 0;
+		std::unordered_map<std::string, uint64_t> files_changed;
+	};
+
+	std::mutex mutex;
+	std::string ignored_prefix;
+	std::unordered_map<std::string, int> dir_watches;
+	std::unordered_map<int, watch_state> watches;
+	uint64_t sequence = 0;
+	uint64_t overflow_sequence = 0;
+	bool dirs_changed = false;
+
+	int fd = -1;
+	std::atomic<bool> stopping{ false };
+	std::thread reader;
+
+	void read_events();
+
+public:
+	explicit file_watcher(const std::string& ignored_prefix = "");
+	~file_watcher();
+
+	file_watcher(const file_watcher&) = delete;
+	file_watcher& operator=(const file_watcher&) = delete;
+
+	bool is_active() const;
+	uint64_t get_sequence();
+	bool watch(const std::string& dir);
+	bool has_changed(const std::vector<std::string>& dirs, const std::vector<std::string>& files, uint64_t since);
+	bool take_dirs_changed();
+	void forget_changes(uint64_t up_to);
+};
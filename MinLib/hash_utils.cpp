@@ -0,0 +1,174 @@
+#include "hash_utils.hpp"
+#include <cstring>
+
+using namespace std;
+
+static const uint32_t SHA256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotate_right(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+sha256::sha256()
+{
+	static const uint32_t initial_state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(state, initial_state, sizeof(state));
+}
+
+/// <summary>
+/// Processes a 64-byte block.
+/// </summary>
+void sha256::transform(const uint8_t* block)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; ++i)
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	for (int i = 16; i < 64; ++i)
+	{
+		auto s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		auto s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	auto a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; ++i)
+	{
+		auto s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+		auto choice = (e & f) ^ (~e & g);
+		auto t1 = h + s1 + choice + SHA256_K[i] + w[i];
+		auto s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+		auto majority = (a & b) ^ (a & c) ^ (b & c);
+		auto t2 = s0 + majority;
+
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/// <summary>
+/// Adds bytes to the stream.
+/// </summary>
+void sha256::update(const void* data, size_t size)
+{
+	auto bytes = (const uint8_t*)data;
+	total_size += size;
+
+	if (buffer_size > 0)
+	{
+		auto count = min(size, sizeof(buffer) - buffer_size);
+		memcpy(buffer + buffer_size, bytes, count);
+		buffer_size += count;
+		bytes += count;
+		size -= count;
+
+		if (buffer_size < sizeof(buffer)) return;
+		transform(buffer);
+		buffer_size = 0;
+	}
+
+	for (; size >= sizeof(buffer); bytes += sizeof(buffer), size -= sizeof(buffer))
+		transform(bytes);
+
+	memcpy(buffer, bytes, size);
+	buffer_size = size;
+}
+
+/// <summary>
+/// Pads the stream and gets the digest.  The instance can't be updated afterwards.
+/// </summary>
+void sha256::finish(uint8_t out_digest[32])
+{
+	auto bit_count = total_size * 8;
+
+	uint8_t padding[72] = { 0x80 };
+	auto padding_size = (buffer_size < 56 ? 56 : 120) - buffer_size;
+	for (int i = 0; i < 8; ++i)
+		padding[padding_size + i] = (uint8_t)(bit_count >> (56 - i * 8));
+	update(padding, padding_size + 8);
+
+	for (int i = 0; i < 8; ++i)
+	{
+		out_digest[i * 4] = (uint8_t)(state[i] >> 24);
+		out_digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+		out_digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+		out_digest[i * 4 + 3] = (uint8_t)state[i];
+	}
+}
+
+/// <summary>
+/// Pads the stream and gets the digest as a (lowercase) hexadecimal string.
+/// </summary>
+string sha256::finish_hex()
+{
+	uint8_t digest[32];
+	finish(digest);
+	return to_hex(digest, sizeof(digest));
+}
+
+/// <summary>
+/// Gets the SHA-256 digest of a buffer, as a hexadecimal string.
+/// </summary>
+string sha256::get_hex(const void* data, size_t size)
+{
+	sha256 hash;
+	hash.update(data, size);
+	return hash.finish_hex();
+}
+
+/// <summary>
+/// Formats bytes as a (lowercase) hexadecimal string.
+/// </summary>
+string to_hex(const uint8_t* data, size_t size)
+{
+	static const char* digits = "0123456789abcdef";
+
+	string result(size * 2, '0');
+	for (size_t i = 0; i < size; ++i)
+	{
+		result[i * 2] = digits[data[i] >> 4];
+		result[i * 2 + 1] = digits[data[i] & 0xf];
+	}
+	return result;
+}
+
+/// <summary>
+/// Computes the checksum of a block.
+/// </summary>
+/// <param name="data">The block.</param>
+/// <param name="size">The size of the block, i.e. of the window to be rolled.</param>
+rolling_checksum::rolling_checksum(const uint8_t* data, size_t size) : length(size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		a += data[i];
+		b += (uint32_t)(size - i) * data[i];
+	}
+	a &= 0xffff;
+	b &= 0xffff;
+}
+
+/// <summary>
+/// Moves the window one byte further.
+/// </summary>
+/// <param name="removed">The byte that leaves the window, i.e. its first byte.</param>
+/// <param name="added">The byte that enters the window, i.e. the byte following it.</param>
+void rolling_checksum::roll(uint8_t removed, uint8_t added)
+{
+	a = (a - removed + added) & 0xffff;
+	b = (b - (uint32_t)length * removed + a) & 0xffff;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/// <summary>
+/// Computes the SHA-256 digest of a stream of bytes, fed in pieces of any size.
+/// </summary>
+class sha256
+{
+private:
+	uint32_t state[8];
+	uint8_t buffer[64];
+	size_t buffer_size = 0;
+	uint64_t total_size = 0;
+
+	void transform(const uint8_t* block);
+
+public:
+	sha256();
+
+	void update(const void* data, size_t size);
+	void finish(uint8_t out_digest[32]);
+	std::string finish_hex();
+
+	static std::string get_hex(const void* data, size_t size);
+};
+
+std::string to_hex(const uint8_t* data, size_t size);
+
+/// <summary>
+/// The weak checksum of a block, as used by rsync: it can be rolled along a buffer one byte at a time,
+/// so that a block can be looked for at every offset at little cost.
+/// </summary>
+class rolling_checksum
+{
+private:
+	uint32_t a = 0;
+	uint32_t b = 0;
+	size_t length = 0;
+
+public:
+	rolling_checksum(const uint8_t* data, size_t size);
+
+	void roll(uint8_t removed, uint8_t added);
+	uint32_t get() const { return (a & 0xffff) | (b << 16); }
+};
@@ -0,0 +1,752 @@
+#include "header_utils.hpp"
+#include <cctype>
+#include <vector>
+#include <algorithm>
+#include "string_utils.hpp"
+
+using namespace std;
+
+// Checks whether the header contains a '#line' directive (or its '# 123' short form).
+static bool has_line_directive(const string& contents);
+
+/// <summary>
+/// Removes the comments and redundant whitespace from the contents of a header file, in a single
+/// pass over the characters.  The pass understands enough of the C++ token structure to leave
+/// string/character literals (including raw strings), header names, digit separators and line
+/// continuations intact.
+/// 
+/// Line numbers are preserved, so that __LINE__, compiler diagnostics and debug info refer to the
+/// same lines as in the original header.  Runs of blank lines are replaced by a '#line' directive
+/// whenever that is shorter, unless the header contains '#line' directives of its own or the blank
+/// lines appear before the first token (which would defeat the compiler's include guard detection).
+/// </summary>
+/// <param name="contents">The contents of the header file.</param>
+/// <param name="keep_license">Whether to keep the comments that precede the first token (typically the license).</param>
+/// <returns>The minified contents.</returns>
+string minify_header(const string& contents, bool keep_license)
+{
+	const auto& s = contents;
+	const auto n = s.size();
+
+	string out;
+	out.reserve(n);
+
+	auto allow_line_directives = !has_line_directive(contents);
+	size_t in_line = 1;           // The line number of the current position in the original header.
+	size_t pending_newlines = 0;  // Newlines that have yet to be written.
+	auto pending_space = false;   // Whitespace (or a comment) separated the previous token from the next.
+	auto line_has_content = false;
+	auto seen_token = false;
+	auto token_on_line = false;
+	auto in_directive = false;
+	auto expect_directive_name = false;
+	auto expect_header_name = false;
+	auto in_number = false;
+	string identifier;            // The identifier currently being written, used to detect raw string prefixes.
+	string directive_name;
+	int paren_depth = 0;
+	int if_depth = 0;
+	auto in_include_guard = false;
+	auto is_first_directive = false;
+
+	auto is_ident = [](char c) { return isalnum((unsigned char)c) || c == '_' || c == '$'; };
+	auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\f' || c == '\v' || c == '\r'; };
+
+	// Checks for a line continuation (backslash-newline) at position i, returning its length.
+	auto splice_length = [&](size_t i) -> size_t {
+		if (i < n && s[i] == '\\')
+		{
+			if (i + 1 < n && s[i + 1] == '\n') return 2;
+			if (i + 2 < n && s[i + 1] == '\r' && s[i + 2] == '\n') return 3;
+		}
+		return 0;
+	};
+
+	auto flush_newlines = [&]() {
+		if (pending_newlines == 0) return;
+
+		// A '#line' directive must not appear within the arguments of a macro invocation, which can
+		// only span lines when within parentheses.  It is also ignored when within a conditional
+		// section that is skipped, so it is only used outside of conditional sections (other than
+		// the include guard, as the whole header is skipped if that condition is false).
+		auto line_directive = "\n#line " + to_string(in_line) + "\n";
+		auto unconditional = if_depth == 0 || (if_depth == 1 && in_include_guard);
+		if (allow_line_directives && seen_token && paren_depth == 0 && unconditional && pending_newlines > line_directive.size())
+			out += line_directive;
+		else
+			out.append(pending_newlines, '\n');
+
+		pending_newlines = 0;
+		pending_space = false;
+		line_has_content = false;
+	};
+
+	auto begin_token = [&]() {
+		flush_newlines();
+		if (pending_space && line_has_content) out += ' ';
+		pending_space = false;
+		line_has_content = true;
+	};
+
+	size_t i = 0;
+	while (i < n)
+	{
+		auto c = s[i];
+
+		if (auto length = splice_length(i); length > 0)
+		{
+			// Line continuations are kept as they are, as they may be joining the parts of a token.
+			flush_newlines();
+			out += "\\\n";
+			in_line++;
+			i += length;
+			continue;
+		}
+
+		if (c == '\n')
+		{
+			in_line++;
+			pending_newlines++;
+			pending_space = false;
+			in_directive = expect_directive_name = expect_header_name = in_number = token_on_line = false;
+			identifier.clear();
+			i++;
+			continue;
+		}
+
+		if (is_space(c))
+		{
+			pending_space = true;
+			in_number = false;
+			identifier.clear();
+			i++;
+			continue;
+		}
+
+		if (c == '/' && i + 1 < n && (s[i + 1] == '/' || s[i + 1] == '*'))
+		{
+			auto is_block = s[i + 1] == '*';
+			auto start = i;
+			size_t newlines = 0;
+			i += 2;
+
+			while (i < n)
+			{
+				if (is_block && s[i] == '*' && i + 1 < n && s[i + 1] == '/') { i += 2; break; }
+				if (!is_block && s[i] == '\n') break; // The newline itself is not part of the comment.
+				if (!is_block && splice_length(i) > 0) { newlines++; i += splice_length(i); continue; }
+				if (s[i] == '\n') newlines++;
+				i++;
+			}
+
+			if (keep_license && !seen_token)
+			{
+				begin_token();
+				out.append(s, start, i - start);
+			}
+			else if (newlines > 0 && in_directive && is_block)
+			{
+				// The directive continues after the comment, so the lines are joined instead.
+				for (size_t l = 0; l < newlines; ++l)
+					out += "\\\n";
+				pending_space = true;
+			}
+			else
+			{
+				pending_newlines += newlines;
+				pending_space = true;
+			}
+
+			in_line += newlines;
+			in_number = false;
+			identifier.clear();
+			continue;
+		}
+
+		begin_token();
+
+		// A pound sign that is the first token on a line starts a directive.
+		if (c == '#' && !token_on_line)
+		{
+			in_directive = expect_directive_name = true;
+			is_first_directive = !seen_token;
+		}
+		token_on_line = seen_token = true;
+
+		if (expect_header_name && c != '<' && c != '"')
+			expect_header_name = false;
+
+		if (expect_header_name)
+		{
+			// Header names are not string literals, e.g. <foo//bar.h> contains no comment.
+			auto close = c == '<' ? '>' : '"';
+			auto end = s.find_first_of(string(1, close) + "\n", i + 1);
+			if (end == string::npos) end = n - 1;
+			if (s[end] == '\n') end--;
+			out.append(s, i, end - i + 1);
+			i = end + 1;
+			expect_header_name = false;
+			continue;
+		}
+
+		if (c == '"' && (identifier == "R" || identifier == "u8R" || identifier == "uR" || identifier == "UR" || identifier == "LR"))
+		{
+			// Raw string literals are copied verbatim: R"delim( ... )delim"
+			auto open = s.find('(', i + 1);
+			auto delimiter = open == string::npos ? string() : ")" + s.substr(i + 1, open - i - 1) + "\"";
+			auto end = open == string::npos ? string::npos : s.find(delimiter, open + 1);
+			end = end == string::npos ? n : end + delimiter.size();
+
+			for (auto k = i; k < end; ++k)
+				if (s[k] == '\n') in_line++;
+
+			out.append(s, i, end - i);
+			i = end;
+			identifier.clear();
+			continue;
+		}
+
+		if ((c == '"' || c == '\'') && !(c == '\'' && in_number))
+		{
+			auto start = i++;
+			while (i < n && s[i] != c && s[i] != '\n')
+			{
+				if (s[i] == '\\' && i + 1 < n)
+				{
+					if (s[i + 1] == '\n') in_line++;
+					i++;
+				}
+				i++;
+			}
+			if (i < n && s[i] == c) i++;
+
+			out.append(s, start, i - start);
+			identifier.clear();
+			in_number = false;
+			continue;
+		}
+
+		// Keep track of pp-numbers, as they may contain digit separators (1'000) and signs (1e+5).
+		if (in_number)
+		{
+			auto prev = out.empty() ? '\0' : out.back();
+			if (!(is_ident(c) || c == '.' || c == '\'' || ((c == '+' || c == '-') && (prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P'))))
+				in_number = false;
+		}
+		else if (identifier.empty() && (isdigit((unsigned char)c) || (c == '.' && i + 1 < n && isdigit((unsigned char)s[i + 1]))))
+		{
+			in_number = true;
+		}
+
+		if (is_ident(c) && !in_number)
+			identifier += c;
+		else
+			identifier.clear();
+
+		if (expect_directive_name)
+		{
+			if (is_ident(c))
+			{
+				directive_name += c;
+				auto next = i + 1 < n ? s[i + 1] : '\0';
+				if (!is_ident(next))
+				{
+					expect_directive_name = false;
+					expect_header_name = directive_name == "include" || directive_name == "include_next" || directive_name == "import";
+
+					if (directive_name == "if" || directive_name == "ifdef" || directive_name == "ifndef")
+					{
+						// An '#ifndef' as the very first token is assumed to be the include guard.
+						if (++if_depth == 1) in_include_guard = is_first_directive && directive_name == "ifndef";
+					}
+					else if ((directive_name == "elif" || directive_name == "else") && if_depth == 1)
+						in_include_guard = false;
+					else if (directive_name == "endif" && if_depth > 0)
+						if_depth--;
+
+					directive_name.clear();
+				}
+			}
+			else if (c != '#')
+			{
+				expect_directive_name = false;
+			}
+		}
+
+		if (!in_directive)
+		{
+			if (c == '(') paren_depth++;
+			else if (c == ')' && paren_depth > 0) paren_depth--;
+		}
+
+		out += c;
+		i++;
+	}
+
+	if (!out.empty() && out.back() != '\n')
+		out += '\n';
+
+	return out;
+}
+
+static bool has_line_directive(const string& contents)
+{
+	size_t pos = 0;
+	while ((pos = contents.find('#', pos)) != string::npos)
+	{
+		// The pound sign must be the first non-whitespace character on the line.
+		auto line_start = contents.find_last_of('\n', pos == 0 ? 0 : pos - 1);
+		line_start = line_start == string::npos || pos == 0 ? 0 : line_start + 1;
+		auto only_space = contents.find_first_not_of(" \t", line_start) == pos;
+
+		pos++;
+		if (!only_space) continue;
+
+		auto name = contents.find_first_not_of(" \t", pos);
+		if (name == string::npos) break;
+
+		if (isdigit((unsigned char)contents[name]))
+			return true;
+		if (contents.compare(name, 4, "line") == 0 && (name + 4 >= contents.size() || !isalnum((unsigned char)contents[name + 4])))
+			return true;
+	}
+
+	return false;
+}
+
+namespace
+{
+	// The value of a preprocessor expression, which is unknown if it depends on macros that weren't pinned.
+	struct condition_value
+	{
+		bool known;
+		long long value;
+	};
+
+	/// <summary>
+	/// Evaluates the expression of an #if/#elif directive, as far as the pinned macros allow.
+	/// </summary>
+	class condition_evaluator
+	{
+	private:
+		std::vector<std::string> tokens;
+		size_t pos = 0;
+		const std::map<std::string, std::string>& defined_macros;
+		const std::set<std::string>& undefined_macros;
+		int macro_depth = 0;
+
+		const std::string& peek() const
+		{
+			static const std::string none;
+			return pos < tokens.size() ? tokens[pos] : none;
+		}
+
+		bool accept(const char* token)
+		{
+			if (peek() != token) return false;
+			pos++;
+			return true;
+		}
+
+		static condition_value unknown() { return { false, 0 }; }
+		static condition_value known(long long value) { return { true, value }; }
+
+		static bool is_ident_start(char c) { return isalpha((unsigned char)c) || c == '_'; }
+
+		static condition_value parse_number(const std::string& token)
+		{
+			try
+			{
+				std::string digits;
+				for (auto c : token)
+					if (c != '\'') digits += c;
+
+				size_t end = 0;
+				long long value;
+				if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'b' || digits[1] == 'B'))
+				{
+					value = std::stoll(digits.substr(2), &end, 2);
+					end += 2;
+				}
+				else
+				{
+					value = std::stoll(digits, &end, 0);
+				}
+
+				// Only integer suffixes may follow.
+				for (; end < digits.size(); ++end)
+					if (std::string("uUlL").find(digits[end]) == std::string::npos) return unknown();
+
+				return known(value);
+			}
+			catch (...)
+			{
+				return unknown();
+			}
+		}
+
+		condition_value evaluate_macro(const std::string& name)
+		{
+			if (undefined_macros.count(name) > 0) return known(0);
+
+			auto it = defined_macros.find(name);
+			if (it == defined_macros.end())
+				return name == "true" ? known(1) : (name == "false" ? known(0) : unknown());
+
+			// The value of a pinned macro is itself an expression (e.g. -D VERSION=0x0601).
+			if (it->second.empty()) return known(1);
+			if (macro_depth > 8) return unknown();
+
+			condition_evaluator nested(it->second, defined_macros, undefined_macros);
+			nested.macro_depth = macro_depth + 1;
+			return nested.evaluate();
+		}
+
+		condition_value parse_primary()
+		{
+			auto token = peek();
+			if (token.empty()) return unknown();
+
+			if (accept("("))
+			{
+				auto value = parse_conditional();
+				accept(")");
+				return value;
+			}
+
+			if (accept("defined"))
+			{
+				auto has_paren = accept("(");
+				auto name = peek();
+				pos++;
+				if (has_paren) accept(")");
+
+				if (defined_macros.count(name) > 0) return known(1);
+				if (undefined_macros.count(name) > 0) return known(0);
+				return unknown();
+			}
+
+			pos++;
+
+			if (isdigit((unsigned char)token[0]))
+				return parse_number(token);
+
+			if (token[0] == '\'')
+				return token.size() == 3 ? known(token[1]) : unknown();
+
+			if (is_ident_start(token[0]))
+			{
+				// Function-like macros (e.g. __has_include(...)) can't be evaluated.
+				if (peek() == "(")
+				{
+					int depth = 0;
+					do
+					{
+						if (peek() == "(") depth++;
+						else if (peek() == ")") depth--;
+						pos++;
+					} while (depth > 0 && pos < tokens.size());
+
+					return unknown();
+				}
+
+				return evaluate_macro(token);
+			}
+
+			return unknown();
+		}
+
+		condition_value parse_unary()
+		{
+			if (accept("!")) { auto v = parse_unary(); return v.known ? known(!v.value) : v; }
+			if (accept("~")) { auto v = parse_unary(); return v.known ? known(~v.value) : v; }
+			if (accept("-")) { auto v = parse_unary(); return v.known ? known(-v.value) : v; }
+			if (accept("+")) return parse_unary();
+			return parse_primary();
+		}
+
+		// Parses the binary operators, from the lowest precedence level to the highest.
+		condition_value parse_binary(int level)
+		{
+			static const std::vector<std::vector<std::string>> levels = {
+				{ "||" }, { "&&" }, { "|" }, { "^" }, { "&" }, { "==", "!=" }, { "<", ">", "<=", ">=" }, { "<<", ">>" }, { "+", "-" }, { "*", "/", "%" }
+			};
+
+			if (level == (int)levels.size()) return parse_unary();
+
+			auto lhs = parse_binary(level + 1);
+			while (true)
+			{
+				auto& ops = levels[level];
+				auto op = peek();
+				if (find(ops.begin(), ops.end(), op) == ops.end()) return lhs;
+				pos++;
+
+				auto rhs = parse_binary(level + 1);
+
+				// Logical operators can be resolved if either side decides the result.
+				if (op == "||")
+				{
+					if ((lhs.known && lhs.value) || (rhs.known && rhs.value)) lhs = known(1);
+					else lhs = lhs.known && rhs.known ? known(0) : unknown();
+					continue;
+				}
+				if (op == "&&")
+				{
+					if ((lhs.known && !lhs.value) || (rhs.known && !rhs.value)) lhs = known(0);
+					else lhs = lhs.known && rhs.known ? known(1) : unknown();
+					continue;
+				}
+
+				if (!lhs.known || !rhs.known) { lhs = unknown(); continue; }
+
+				auto a = lhs.value, b = rhs.value;
+				if (op == "|") lhs = known(a | b);
+				else if (op == "^") lhs = known(a ^ b);
+				else if (op == "&") lhs = known(a & b);
+				else if (op == "==") lhs = known(a == b);
+				else if (op == "!=") lhs = known(a != b);
+				else if (op == "<") lhs = known(a < b);
+				else if (op == ">") lhs = known(a > b);
+				else if (op == "<=") lhs = known(a <= b);
+				else if (op == ">=") lhs = known(a >= b);
+				else if (op == "<<") lhs = b >= 0 && b < 64 ? known(a << b) : unknown();
+				else if (op == ">>") lhs = b >= 0 && b < 64 ? known(a >> b) : unknown();
+				else if (op == "+") lhs = known(a + b);
+				else if (op == "-") lhs = known(a - b);
+				else if (op == "*") lhs = known(a * b);
+				else if (op == "/") lhs = b != 0 ? known(a / b) : unknown();
+				else if (op == "%") lhs = b != 0 ? known(a % b) : unknown();
+			}
+		}
+
+		condition_value parse_conditional()
+		{
+			auto condition = parse_binary(0);
+			if (!accept("?")) return condition;
+
+			auto if_true = parse_conditional();
+			accept(":");
+			auto if_false = parse_conditional();
+
+			if (condition.known) return condition.value ? if_true : if_false;
+			if (if_true.known && if_false.known && if_true.value == if_false.value) return if_true;
+			return unknown();
+		}
+
+	public:
+		condition_evaluator(const std::string& expression, const std::map<std::string, std::string>& defined_macros, const std::set<std::string>& undefined_macros)
+			: defined_macros(defined_macros), undefined_macros(undefined_macros)
+		{
+			static const char* operators[] = { "||", "&&", "==", "!=", "<=", ">=", "<<", ">>" };
+
+			for (size_t i = 0; i < expression.size();)
+			{
+				auto c = expression[i];
+				if (isspace((unsigned char)c)) { i++; continue; }
+
+				auto start = i;
+				if (is_ident_start(c) || isdigit((unsigned char)c))
+				{
+					while (i < expression.size() && (isalnum((unsigned char)expression[i]) || expression[i] == '_' || expression[i] == '\''))
+						i++;
+				}
+				else if (c == '\'')
+				{
+					i = expression.find('\'', i + 1);
+					i = i == std::string::npos ? expression.size() : i + 1;
+				}
+				else
+				{
+					i++;
+					for (auto op : operators)
+						if (expression.compare(start, 2, op) == 0) { i = start + 2; break; }
+				}
+
+				tokens.push_back(expression.substr(start, i - start));
+			}
+		}
+
+		condition_value evaluate()
+		{
+			auto value = parse_conditional();
+			return pos == tokens.size() ? value : unknown(); // Anything left over means it wasn't understood.
+		}
+	};
+}
+
+/// <summary>
+/// Resolves the conditional sections (#if/#ifdef/#ifndef/#elif/#else/#endif) of a header file
+/// that only depend on pinned macros, similar to the 'unifdef' tool: the directives are removed,
+/// along with the branches that can never be taken.  Conditions that depend on any macro that
+/// wasn't pinned are kept as they are, although they may be rewritten (an #elif becomes an #if
+/// when the preceding branches were removed, or an #else when its condition is always true).
+/// Removed lines are replaced by empty lines so that line numbers are preserved.
+/// </summary>
+/// <param name="contents">The contents of the header file.</param>
+/// <param name="defined_macros">The pinned macros that are defined, along with their values.</param>
+/// <param name="undefined_macros">The pinned macros that are not defined.</param>
+/// <returns>The contents with the conditional sections resolved.</returns>
+string resolve_conditionals(const string& contents, const map<string, string>& defined_macros, const set<string>& undefined_macros)
+{
+	struct condition_group
+	{
+		bool ignored = false;  // Within a removed branch, so the whole group is removed.
+		bool emitted = false;  // The group's opening directive was kept.
+		bool resolved = false; // A branch that is always taken was found; the remaining branches are removed.
+		bool live = true;      // Whether the current branch is kept.
+	};
+
+	string out;
+	out.reserve(contents.size());
+
+	vector<condition_group> groups;
+	auto in_comment = false;
+	size_t pos = 0;
+
+	auto is_live = [&groups]() { return groups.empty() || (!groups.back().ignored && groups.back().live); };
+
+	while (pos < contents.size())
+	{
+		// Gather the logical line, i.e. including the lines joined by continuations.
+		auto line_start = pos;
+		size_t line_count = 0;
+		size_t line_end = 0;
+		auto append_line = [&]() {
+			line_end = contents.find('\n', line_count == 0 ? line_start : line_end + 1);
+			line_count++;
+			while (line_end != string::npos)
+			{
+				auto last = line_end;
+				while (last > line_start && contents[last - 1] == '\r') --last;
+				if (last == line_start || contents[last - 1] != '\\') break;
+				line_end = contents.find('\n', line_end + 1);
+				line_count++;
+			}
+			if (line_end == string::npos) line_end = contents.size();
+		};
+		append_line();
+
+		auto first = contents.find_first_not_of(" \t\r\f\v", line_start);
+		auto starts_in_comment = in_comment;
+		auto is_directive = !starts_in_comment && first < line_end && contents[first] == '#';
+
+		// Strip the comments (tracking block comments that span lines) and line continuations.  A directive
+		// also takes in the following lines while a block comment opened on it is still open; if the comment
+		// never ends, the directive can't be read and its condition is left unknown.
+		auto text = strip_comments(string_view(contents).substr(line_start, line_end - line_start), in_comment);
+		while (is_directive && in_comment && line_end < contents.size())
+		{
+			append_line();
+			in_comment = false;
+			text = strip_comments(string_view(contents).substr(line_start, line_end - line_start), in_comment);
+		}
+		auto is_complete = !in_comment;
+
+		pos = line_end + 1;
+		auto line = contents.substr(line_start, line_end - line_start);
+
+		auto keep_line = [&]() { out.append(line); if (line_end < contents.size()) out += '\n'; };
+		auto drop_line = [&]() { out.append(line_count - (line_end < contents.size() ? 0 : 1), '\n'); };
+		auto replace_line = [&](const string& directive) {
+			out += directive;
+			out.append(line_count - (line_end < contents.size() ? 0 : 1), '\n');
+		};
+
+		if (!is_directive)
+		{
+			if (is_live()) keep_line(); else drop_line();
+			continue;
+		}
+
+		auto directive = text.substr(text.find('#') + 1);
+		auto name_start = directive.find_first_not_of(" \t");
+		auto name_end = name_start == string::npos ? string::npos : directive.find_first_not_of("abcdefghijklmnopqrstuvwxyz", name_start);
+		auto name = name_start == string::npos ? string() : directive.substr(name_start, name_end == string::npos ? string::npos : name_end - name_start);
+		auto argument = name_end == string::npos ? string() : directive.substr(name_end);
+
+		auto evaluate = [&]() -> condition_value {
+			if (!is_complete) return { false, 0 };
+			if (name == "ifdef" || name == "ifndef")
+			{
+				auto macro_start = argument.find_first_not_of(" \t");
+				auto macro_end = argument.find_first_of(" \t", macro_start);
+				auto macro = macro_start == string::npos ? string() : argument.substr(macro_start, macro_end == string::npos ? string::npos : macro_end - macro_start);
+
+				auto is_defined = defined_macros.count(macro) > 0;
+				if (!is_defined && undefined_macros.count(macro) == 0) return { false, 0 };
+				return { true, name == "ifdef" ? is_defined : !is_defined };
+			}
+
+			return condition_evaluator(argument, defined_macros, undefined_macros).evaluate();
+		};
+
+		if (name == "if" || name == "ifdef" || name == "ifndef")
+		{
+			condition_group g;
+			if (!is_live())
+			{
+				g.ignored = true;
+				drop_line();
+			}
+			else if (auto value = evaluate(); !value.known)
+			{
+				g.emitted = true;
+				keep_line();
+			}
+			else
+			{
+				g.resolved = value.value != 0;
+				g.live = g.resolved;
+				drop_line();
+			}
+			groups.push_back(g);
+		}
+		else if (name == "elif" && !groups.empty())
+		{
+			auto& g = groups.back();
+			if (g.ignored || g.resolved)
+			{
+				g.live = false;
+				drop_line();
+			}
+			else if (auto value = evaluate(); !value.known)
+			{
+				g.live = true;
+				if (g.emitted)
+					keep_line();
+				else
+					replace_line("#if" + argument);
+				g.emitted = true;
+			}
+			else if (value.value != 0)
+			{
+				g.live = g.resolved = true;
+				if (g.emitted) replace_line("#else"); else drop_line();
+			}
+			else
+			{
+				g.live = false;
+				drop_line();
+			}
+		}
+		else if (name == "else" && !groups.empty())
+		{
+			auto& g = groups.back();
+			g.live = !g.ignored && !g.resolved;
+			if (g.live && g.emitted) keep_line(); else drop_line();
+			g.resolved = true;
+		}
+		else if (name == "endif" && !groups.empty())
+		{
+			if (groups.back().emitted) keep_line(); else drop_line();
+			groups.pop_back();
+		}
+		else
+		{
+			if (is_live()) keep_line(); else drop_line();
+		}
+	}
+
+	return out;
+}
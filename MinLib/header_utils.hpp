@@ -0,0 +1,9 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+
+std::string minify_header(const std::string& contents, bool keep_license);
+
+std::string resolve_conditionals(const std::string& contents, const std::map<std::string, std::string>& defined_macros, const std::set<std::string>& undefined_macros);
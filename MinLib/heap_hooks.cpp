@@ -0,0 +1,119 @@
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include "memory_utils.hpp"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+// The replaceable global allocation functions, so that all heap allocations can be counted,
+// including those made by the standard library (regex, filesystem, streams, etc).  The plain,
+// nothrow and aligned forms are all replaced, along with the matching (sized) deallocation
+// functions; the array forms forward to them.  Counting is off by default, which leaves a call
+// and a relaxed load on top of malloc.  These are part of the executable rather than of libminlib,
+// as replacing them is up to the program that embeds the library.
+
+static void* allocate(size_t size, size_t alignment)
+{
+	count_heap_allocation(size);
+
+	if (size == 0) size = 1;
+	while (true)
+	{
+		void* p = nullptr;
+		if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+			p = malloc(size);
+		else
+		{
+#ifdef _WIN32
+			p = _aligned_malloc(size, alignment);
+#else
+			if (posix_memalign(&p, max(alignment, sizeof(void*)), size) != 0) p = nullptr;
+#endif
+		}
+		if (p != nullptr) return p;
+
+		auto handler = get_new_handler();
+		if (handler == nullptr) throw bad_alloc();
+		handler();
+	}
+}
+
+static void deallocate_aligned(void* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+void* operator new(size_t size)
+{
+	return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	try
+	{
+		return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+	return allocate(size, (size_t)alignment);
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+	try
+	{
+		return allocate(size, (size_t)alignment);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, align_val_t alignment) noexcept
+{
+	if ((size_t)alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+		free(p);
+	else
+		deallocate_aligned(p);
+}
+
+void operator delete(void* p, size_t, align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+void operator delete(void* p, align_val_t alignment, const nothrow_t&) noexcept
+{
+	operator delete(p, alignment);
+}
\ No newline at end of file
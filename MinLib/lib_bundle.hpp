@@ -1,10 +1,23 @@
 #pragma once
 
+#include <map>
 #include <vector>
 #include <string>
+#include <functional>
+#include <memory_resource>
 
+// The file lists are allocated from the memory resource given when the bundle is created, e.g. the run's arena (see run_arena).
 struct lib_bundle
 {
-	std::vector<std::string> include_files;
-	std::vector<std::string> lib_files;
+	explicit lib_bundle(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+		: include_files(resource), lib_files(resource), include_graph(resource)
+	{
+	}
+
+	std::pmr::vector<std::pmr::string> include_files;
+	std::pmr::vector<std::pmr::string> lib_files;
+
+	// Maps each file to the files it directly includes.  Only available when the
+	// preprocessor reports when files are entered (GCC).
+	std::pmr::map<std::pmr::string, std::pmr::vector<std::pmr::string>, std::less<>> include_graph;
 };
\ No newline at end of file
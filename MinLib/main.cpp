@@ -7,12 +7,10 @@ int main(int argc, char* argv[])
 {
     try
     {
-        // Retrieve and validate the input parameters.
+        // Retrieve the input parameters, then run the command specified in them
+        // (see minlib::session for running MinLib from another program).
         auto params = parameter::get_params(argc - 1, argc > 1 ? &argv[1] : argv);
-        auto param_map = cli::process_params(params);
-        
-        // Run the command specified in the parameters.
-        return cli::run_command(param_map);
+        return cli::run_command(params);
     }
     catch (exception& ex)
     {
@@ -0,0 +1,91 @@
+#include "mapped_file.hpp"
+#include <stdexcept>
+#include <regex>
+#include <filesystem>
+#include "errors.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+using namespace minlib;
+
+/// <summary>
+/// Opens the file and maps its contents into memory.  Empty files are not mapped,
+/// in which case data() returns nullptr and size() returns zero.
+/// </summary>
+/// <param name="filename">The name of the file.</param>
+mapped_file::mapped_file(const string& filename)
+{
+#ifdef _WIN32
+	auto handle = CreateFileW(filesystem::u8path(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		throw runtime_error(regex_replace(FILE_READ_ERROR, regex("%s"), filename));
+	file_handle = handle;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size))
+	{
+		CloseHandle(handle);
+		throw runtime_error(regex_replace(FILE_READ_ERROR, regex("%s"), filename));
+	}
+
+	length = (size_t)file_size.QuadPart;
+	if (length == 0) return;
+
+	mapping_handle = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle != nullptr)
+		contents = (const char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+
+	if (contents == nullptr)
+	{
+		if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+		CloseHandle(handle);
+		throw runtime_error(regex_replace(FILE_READ_ERROR, regex("%s"), filename));
+	}
+#else
+	file_descriptor = open(filename.c_str(), O_RDONLY);
+	if (file_descriptor < 0)
+		throw runtime_error(regex_replace(FILE_READ_ERROR, regex("%s"), filename));
+
+	struct stat file_stat;
+	if (fstat(file_descriptor, &file_stat) != 0)
+	{
+		close(file_descriptor);
+		throw runtime_error(regex_replace(FILE_READ_ERROR, regex("%s"), filename));
+	}
+
+	length = (size_t)file_stat.st_size;
+	if (length == 0) return;
+
+	auto address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+	if (address == MAP_FAILED)
+	{
+		close(file_descriptor);
+		throw runtime_error(regex_replace(FILE_READ_ERROR, regex("%s"), filename));
+	}
+
+	madvise(address, length, MADV_SEQUENTIAL);
+	contents = (const char*)address;
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+#ifdef _WIN32
+	if (contents != nullptr) UnmapViewOfFile(contents);
+	if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+	if (file_handle != nullptr) CloseHandle(file_handle);
+#else
+	if (contents != nullptr) munmap((void*)contents, length);
+	if (file_descriptor >= 0) close(file_descriptor);
+#endif
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+/// <summary>
+/// Maps a file into memory (read-only) for as long as the instance exists.
+/// </summary>
+class mapped_file
+{
+private:
+	const char* contents = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+
+public:
+	explicit mapped_file(const std::string& filename);
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	const char* data() const { return contents; }
+	size_t size() const { return length; }
+};
@@ -0,0 +1,91 @@
+#include "memory_utils.hpp"
+#include <atomic>
+
+using namespace std;
+
+// The arena starts out with room for the file lists of a typical bundle, and grows geometrically.
+static const size_t INITIAL_ARENA_SIZE = 1 << 20;
+
+static atomic<bool> heap_stats_enabled{ false };
+static atomic<size_t> heap_allocation_count{ 0 };
+static atomic<size_t> heap_allocated_bytes{ 0 };
+
+run_arena::run_arena() : arena(INITIAL_ARENA_SIZE, pmr::new_delete_resource())
+{
+}
+
+/// <summary>
+/// Gets the number of allocations served by the arena so far.
+/// </summary>
+size_t run_arena::get_allocation_count() const
+{
+	return allocation_count;
+}
+
+/// <summary>
+/// Gets the number of bytes allocated from the arena so far.
+/// </summary>
+size_t run_arena::get_allocated_bytes() const
+{
+	return allocated_bytes;
+}
+
+void* run_arena::do_allocate(size_t bytes, size_t alignment)
+{
+	++allocation_count;
+	allocated_bytes += bytes;
+	return arena.allocate(bytes, alignment);
+}
+
+void run_arena::do_deallocate(void*, size_t, size_t)
+{
+	// Memory is released all at once when the arena is destroyed.
+}
+
+bool run_arena::do_is_equal(const pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+/// <summary>
+/// Starts (or stops) counting the allocations made on the heap via operator new, by any thread.
+/// The counts start from zero each time counting is enabled.
+/// </summary>
+/// <param name="enable">Whether the allocations should be counted.</param>
+void enable_heap_stats(bool enable)
+{
+	if (enable)
+	{
+		heap_allocation_count.store(0, memory_order_relaxed);
+		heap_allocated_bytes.store(0, memory_order_relaxed);
+	}
+
+	heap_stats_enabled.store(enable, memory_order_relaxed);
+}
+
+/// <summary>
+/// Gets the number of allocations made on the heap while counting was enabled.
+/// </summary>
+/// <returns>The number of allocations and the total number of bytes allocated.</returns>
+heap_stats get_heap_stats()
+{
+	heap_stats stats;
+	stats.allocation_count = heap_allocation_count.load(memory_order_relaxed);
+	stats.allocated_bytes = heap_allocated_bytes.load(memory_order_relaxed);
+	return stats;
+}
+
+/// <summary>
+/// Counts an allocation made on the heap, if counting is enabled.  Called by the replacement operator new
+/// of the executable (see heap_hooks.cpp); the library doesn't replace it, so as not to impose on the
+/// programs that embed it, which get no heap statistics unless they call this function themselves.
+/// </summary>
+/// <param name="size">The number of bytes allocated.</param>
+void count_heap_allocation(size_t size)
+{
+	if (heap_stats_enabled.load(memory_order_relaxed))
+	{
+		heap_allocation_count.fetch_add(1, memory_order_relaxed);
+		heap_allocated_bytes.fetch_add(size, memory_order_relaxed);
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+/// <summary>
+/// A monotonic arena for the strings and containers created during a run (paths, the bundle's
+/// file lists and include graph, etc).  Memory is only released when the arena is destroyed at the
+/// end of the run, so allocating is little more than bumping a pointer.  The arena is handed explicitly
+/// to the functions that build the bundle, rather than installed as the default memory resource, so
+/// that the runs of concurrent sessions each allocate from their own arena.  Only the thread that builds
+/// the bundle allocates from it (the copy workers get std::strings), so it isn't synchronized.
+/// </summary>
+class run_arena : public std::pmr::memory_resource
+{
+private:
+	std::pmr::monotonic_buffer_resource arena;
+	size_t allocation_count = 0;
+	size_t allocated_bytes = 0;
+
+public:
+	run_arena();
+
+	run_arena(const run_arena&) = delete;
+	run_arena& operator=(const run_arena&) = delete;
+
+	size_t get_allocation_count() const;
+	size_t get_allocated_bytes() const;
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void*, size_t, size_t) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+struct heap_stats
+{
+	size_t allocation_count = 0;
+	size_t allocated_bytes = 0;
+};
+
+void enable_heap_stats(bool enable);
+
+void count_heap_allocation(size_t size);
+
+heap_stats get_heap_stats();
@@ -0,0 +1,308 @@
+#include "minlib.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <regex>
+#include <filesystem>
+#include "errors.hpp"
+#include "cli.hpp"
+#include "compiler.hpp"
+#include "bundler.hpp"
+#include "dep_reader.hpp"
+#include "scanner.hpp"
+#include "delta_pack.hpp"
+#include "path_cache.hpp"
+#include "memory_utils.hpp"
+#include "file_utils.hpp"
+
+using namespace std;
+
+namespace minlib
+{
+	/// <summary>
+	/// Creates a configuration from parameters, as parsed from the command-line arguments or a config file.
+	/// </summary>
+	/// <param name="params">The parameters; an unnamed parameter is the filename of a config file.</param>
+	configuration::configuration(const vector<parameter>& params) : param_map(cli::process_params(params))
+	{
+		set_stage();
+	}
+
+	/// <summary>
+	/// Creates a configuration from the values of the parameters, keyed by name.
+	/// </summary>
+	/// <param name="values">The values of the parameters; lists of values are space-delimited.</param>
+	configuration::configuration(const parameter_map& values)
+	{
+		vector<parameter> params;
+		for (auto& [name, value] : values)
+		{
+			parameter p;
+			p.name = name;
+			p.value = value;
+			params.push_back(p);
+		}
+
+		param_map = cli::process_params(params);
+		set_stage();
+	}
+
+	/// <summary>
+	/// Picks the staging directory of the configuration's runs, unless the configuration doesn't describe
+	/// a run (e.g. '--config' or '--serve').
+	/// </summary>
+	void configuration::set_stage()
+	{
+		auto it = param_map.find(cli::WORKING_DIR_PARAM);
+		if (it == param_map.end()) return;
+
+		auto working_dir_path = filesystem::path(get_expanded_path(it->second));
+		if (working_dir_path.is_relative())
+			working_dir_path = filesystem::current_path() / working_dir_path;
+
+		stage = make_shared<stage_dir>(working_dir_path.u8string());
+		param_map[cli::STAGE_DIR_PARAM] = stage->get_path();
+	}
+
+	/// <summary>
+	/// Creates a configuration from a config file.
+	/// </summary>
+	/// <param name="filename">The name of the config file.</param>
+	configuration configuration::from_file(const string& filename)
+	{
+		parameter p;
+		p.value = filename;
+		return configuration(vector<parameter>{ p });
+	}
+
+	/// <summary>
+	/// Creates a configuration from command-line arguments, i.e. 'key=value' pairs and optionally the filename
+	/// of a config file.
+	/// </summary>
+	/// <param name="count">The number of arguments.</param>
+	/// <param name="args">The arguments, without the name of the executable.</param>
+	configuration configuration::from_args(size_t count, char* args[])
+	{
+		return configuration(parameter::get_params(count, args));
+	}
+
+	/// <summary>
+	/// Checks whether the configuration merely asks for the config template ('--config').
+	/// </summary>
+	bool configuration::is_config_template() const
+	{
+		return param_map.find(cli::CONFIG_TEMPLATE_PARAM) != param_map.end();
+	}
+
+	/// <summary>
+	/// Gets the parameters, including the default values of those that weren't set.
+	/// </summary>
+	const parameter_map& configuration::get_params() const
+	{
+		return param_map;
+	}
+
+	/// <summary>
+	/// Creates the staging directory of the configuration, if the configuration's first run is being made.
+	/// </summary>
+	/// <param name="config">The configuration of the run.</param>
+	void session::create_stage(const configuration& config)
+	{
+		if (config.stage != nullptr)
+			config.stage->create();
+	}
+
+	/// <summary>
+	/// Copies a bundle built during a call, i.e. allocated from the call's arena, so that it outlives the arena.
+	/// </summary>
+	/// <param name="bundle">The bundle to copy.</param>
+	/// <param name="resource">The memory resource to allocate the copy from.</param>
+	/// <returns>The copy of the bundle.</returns>
+	lib_bundle session::copy_bundle(const lib_bundle& bundle, pmr::memory_resource* resource)
+	{
+		lib_bundle result(resource);
+		result.include_files.assign(bundle.include_files.begin(), bundle.include_files.end());
+		result.lib_files.assign(bundle.lib_files.begin(), bundle.lib_files.end());
+		result.include_graph.insert(bundle.include_graph.begin(), bundle.include_graph.end());
+		return result;
+	}
+
+	/// <summary>
+	/// Runs the optional steps that follow the bundling: those that compile the bundled header files, then those
+	/// that describe the finished bundle (manifest, delta_pack).
+	/// </summary>
+	/// <param name="bundle">The bundle.</param>
+	/// <param name="param_map">The parameters of the run.</param>
+	void session::finish_bundle(const lib_bundle& bundle, const parameter_map& param_map)
+	{
+		// Optionally check that each of the top-level includes can be
+		// preprocessed using nothing but the bundled header files.
+		if (cli::is_flag_set(param_map, cli::VERIFY_PARAM))
+		{
+			cout << "Verifying the bundle..." << endl;
+			if (auto failure_count = compiler::verify_bundle(bundle, param_map, paths); failure_count > 0)
+				throw runtime_error(regex_replace(VERIFY_ERROR, regex("%s"), to_string(failure_count)));
+		}
+
+		// Optionally build the top-level bundled headers as importable header units.
+		if (cli::is_flag_set(param_map, cli::HEADER_UNITS_PARAM))
+			compiler::build_header_units(bundle, param_map, paths);
+
+		// Optionally precompile the bundled headers so that consumers don't
+		// have to reparse them in every translation unit.
+		if (cli::is_flag_set(param_map, cli::PRECOMPILED_HEADER_PARAM))
+			compiler::build_precompiled_header(param_map);
+
+		// Optionally describe the finished bundle in a manifest, and write the
+		// delta pack from the bundle described by a previous manifest.
+		delta_pack::write(param_map);
+	}
+
+	/// <summary>
+	/// Runs the compiler's preprocessor on the input file, generating the input file first if 'source_dir' is set.
+	/// Does nothing but the latter if the bundle is built from the project's dependency files ('compile_commands').
+	/// </summary>
+	/// <param name="config">The configuration of the run.</param>
+	void session::preprocess(const configuration& config)
+	{
+		auto& param_map = config.get_params();
+		paths.forget_missing();
+		create_stage(config);
+
+		if (auto it = param_map.find(cli::SOURCE_DIR_PARAM); it != param_map.end() && it->second != "")
+			scanner::generate_input_file(param_map);
+
+		if (param_map.find(cli::COMPILE_COMMANDS_PARAM) == param_map.end())
+			compiler::run_preprocessor(param_map);
+	}
+
+	/// <summary>
+	/// Builds the list of header and lib files to bundle from the output of the preprocessor, or from the
+	/// project's dependency files if 'compile_commands' is set.  Nothing is copied.
+	/// </summary>
+	/// <param name="config">The configuration of the run.</param>
+	/// <returns>The bundle.</returns>
+	lib_bundle session::parse(const configuration& config)
+	{
+		auto& param_map = config.get_params();
+		run_arena arena;
+		paths.forget_missing();
+		create_stage(config);
+
+		auto bundle = param_map.find(cli::COMPILE_COMMANDS_PARAM) != param_map.end()
+			? dep_reader::read_dependencies(param_map, paths, &arena)
+			: compiler::parse_preprocessor_output(param_map, paths, &arena);
+
+		return copy_bundle(bundle, pmr::get_default_resource());
+	}
+
+	/// <summary>
+	/// Narrows a bundle returned by parse() down to the header files that bundle() would copy, i.e. those within
+	/// the include directories that pass the filters (see include_classifier).  Nothing is copied.
+	/// </summary>
+	/// <param name="bundle">The bundle.</param>
+	/// <param name="config">The configuration of the run.</param>
+	/// <returns>The narrowed bundle.</returns>
+	lib_bundle session::select_includes(const lib_bundle& bundle, const configuration& config)
+	{
+		return bundler::select_includes(bundle, config.get_params(), paths);
+	}
+
+	/// <summary>
+	/// Stages the files of a bundle returned by parse() and copies them to the output directories, then runs
+	/// the optional steps that compile the bundled header files (verify, header_units, precompiled_header).
+	/// </summary>
+	/// <param name="bundle">The bundle, which is left as is.</param>
+	/// <param name="config">The configuration of the run.</param>
+	void session::bundle(const lib_bundle& bundle, const configuration& config)
+	{
+		auto& param_map = config.get_params();
+		paths.forget_missing();
+		create_stage(config);
+
+		auto output_locks = bundler::lock_output_dirs(param_map);
+		bundler::bundle_library(bundle, param_map, paths);
+		finish_bundle(bundle, param_map);
+	}
+
+	/// <summary>
+	/// Runs all the phases, as the executable does.
+	/// </summary>
+	/// <param name="config">The configuration of the run.</param>
+	/// <returns>The bundle.</returns>
+	lib_bundle session::run(const configuration& config)
+	{
+		auto& param_map = config.get_params();
+
+		// The strings and containers created during the run are allocated from the arena, which is
+		// released all at once at the end of the run.  It's declared first, so it outlives them.
+		run_arena arena;
+		paths.forget_missing();
+		create_stage(config);
+
+		auto alloc_stats = cli::is_flag_set(param_map, cli::ALLOC_STATS_PARAM);
+		if (alloc_stats)
+			enable_heap_stats(true);
+
+		// Counting is turned off again however the run ends, as the process (e.g. a server) may go on.
+		struct heap_stats_guard
+		{
+			bool enabled;
+			~heap_stats_guard() { if (enabled) enable_heap_stats(false); }
+		} stats_guard { alloc_stats };
+
+		// If the project's source directories were specified, generate the
+		// input file from the #include statements found in the source files.
+		if (auto it = param_map.find(cli::SOURCE_DIR_PARAM); it != param_map.end() && it->second != "")
+			scanner::generate_input_file(param_map);
+
+		// Invoke the compiler's preprocessor to have it evaluate all
+		// the specified header files listed in the input file, unless
+		// the bundle is built from the project's own dependency files.
+		if (param_map.find(cli::COMPILE_COMMANDS_PARAM) == param_map.end())
+			compiler::run_preprocessor(param_map);
+
+		// Comb through the output of the preprocessor, building a
+		// list of all the header and lib files to be bundled, while
+		// the header files found so far are being copied.  Then
+		// create the bundle and save to the specified output directories,
+		// which are locked until the bundle is finished.
+		auto output_locks = bundler::lock_output_dirs(param_map);
+		auto bundle = bundler::bundle_library(param_map, paths, &arena);
+
+		finish_bundle(bundle, param_map);
+
+		if (alloc_stats)
+		{
+			enable_heap_stats(false);
+			stats_guard.enabled = false;
+
+			auto heap = get_heap_stats();
+			cout << "Heap allocations: " << heap.allocation_count << " (" << heap.allocated_bytes << " bytes)." << endl;
+			cout << "Arena allocations: " << arena.get_allocation_count() << " (" << arena.get_allocated_bytes() << " bytes)." << endl;
+		}
+
+		return copy_bundle(bundle, pmr::get_default_resource());
+	}
+
+	/// <summary>
+	/// Applies the delta pack given by 'apply_delta' to the bundle in the output directories, which are locked
+	/// while they're patched.
+	/// </summary>
+	/// <param name="config">The configuration; only the output directories and the pack are used.</param>
+	void session::apply_delta(const configuration& config)
+	{
+		auto& param_map = config.get_params();
+		create_stage(config);
+
+		auto output_locks = bundler::lock_output_dirs(param_map);
+		delta_pack::apply(param_map);
+	}
+
+	/// <summary>
+	/// Forgets the paths cached by the session, e.g. after include directories have been moved or relinked.
+	/// </summary>
+	void session::clear_caches()
+	{
+		paths.clear();
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "parameter.hpp"
+#include "lib_bundle.hpp"
+#include "stage_dir.hpp"
+#include "path_cache.hpp"
+
+namespace minlib
+{
+	/// <summary>
+	/// The parameters of a run, i.e. the same key/value pairs that are passed to the executable or listed
+	/// in a config file (see the config template).  The parameters are checked and the defaults filled in
+	/// when the configuration is constructed, so a configuration can be reused across runs at no cost.  The runs
+	/// made with a configuration (and its copies) share a staging directory, created by the first run and removed
+	/// along with the last copy; runs made with different configurations can safely run concurrently.
+	/// </summary>
+	class configuration
+	{
+		friend class session;
+
+	private:
+		parameter_map param_map;
+		std::shared_ptr<stage_dir> stage;
+
+		void set_stage();
+
+	public:
+		explicit configuration(const std::vector<parameter>& params);
+		explicit configuration(const parameter_map& values);
+
+		static configuration from_file(const std::string& filename);
+		static configuration from_args(size_t count, char* args[]);
+
+		bool is_config_template() const;
+		const parameter_map& get_params() const;
+	};
+
+	/// <summary>
+	/// Runs the phases of MinLib in-process: preprocess() invokes the compiler's preprocessor (after generating
+	/// the input file, if 'source_dir' is set), parse() turns its output (or the project's dependency files) into
+	/// a bundle, select_includes() narrows it down to the header files that would be bundled, and bundle() stages
+	/// the files and copies them to the output directories, then verifies the bundle and builds the header units
+	/// and precompiled header, if enabled.  run() does all of the above, parsing and copying the header files in
+	/// a single pipelined pass, as the executable does.  apply_delta() patches the bundle in the output directories
+	/// with a delta pack written by an earlier run (see delta_pack).  The bundles handed back are allocated from
+	/// the caller's default memory resource.  Their lib_files only list the libs reported by the compiler; the libs
+	/// given by 'libs' and the shared libs that the bundled libs depend on are bundled as well, but not listed.
+	///
+	/// Each session has its own caches (see path_cache), which persist across its calls, so that the directories
+	/// looked up by a run don't have to be looked up again by the next one; call clear_caches() when the include
+	/// directories were moved or relinked.  Sessions share no state, so different sessions can make calls
+	/// concurrently (with different configurations).  bundle() and run() lock the output directories, so runs
+	/// that write to the same directories, in this process or another one, wait for each other.
+	/// </summary>
+	class session
+	{
+	private:
+		path_cache paths;
+
+		static void create_stage(const configuration& config);
+		static lib_bundle copy_bundle(const lib_bundle& bundle, std::pmr::memory_resource* resource);
+		void finish_bundle(const lib_bundle& bundle, const parameter_map& param_map);
+
+	public:
+		session() = default;
+
+		session(const session&) = delete;
+		session& operator=(const session&) = delete;
+
+		void preprocess(const configuration& config);
+		lib_bundle parse(const configuration& config);
+		lib_bundle select_includes(const lib_bundle& bundle, const configuration& config);
+		void bundle(const lib_bundle& bundle, const configuration& config);
+		lib_bundle run(const configuration& config);
+		void apply_delta(const configuration& config);
+		void clear_caches();
+	};
+}
@@ -0,0 +1,254 @@
+#include "parallel_utils.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include "string_utils.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+	// How long to wait for a token before checking whether the wait should be cancelled.
+	const int JOBSERVER_POLL_MS = 50;
+
+	/// <summary>
+	/// Gets the jobserver's address from MAKEFLAGS, e.g. 'fifo:/tmp/GMfifo123' or '3,4'.  If make was
+	/// given several, the last one applies.
+	/// </summary>
+	string get_jobserver_auth()
+	{
+		auto makeflags = getenv("MAKEFLAGS");
+		if (makeflags == nullptr) return string();
+
+		string_view auth;
+		for (auto flag : sv_split(makeflags))
+		{
+			for (string_view prefix : { "--jobserver-auth=", "--jobserver-fds=" })
+			{
+				if (flag.substr(0, prefix.size()) == prefix)
+					auth = flag.substr(prefix.size());
+			}
+		}
+
+		return string(auth);
+	}
+
+#ifndef _WIN32
+	bool is_pipe(int fd)
+	{
+		struct stat fd_stat;
+		return fd >= 0 && fcntl(fd, F_GETFD) != -1 && fstat(fd, &fd_stat) == 0 && S_ISFIFO(fd_stat.st_mode);
+	}
+#endif
+}
+
+jobserver::jobserver()
+{
+	auto auth = get_jobserver_auth();
+	if (auth.empty()) return;
+
+#ifdef _WIN32
+	semaphore = OpenSemaphoreA(SYNCHRONIZE | SEMAPHORE_MODIFY_STATE, FALSE, auth.c_str());
+	active = semaphore != nullptr;
+#else
+	if (auth.compare(0, 5, "fifo:") == 0)
+	{
+		// Our own non-blocking descriptor, which is used both to take tokens and to give them back.
+		read_fd = write_fd = open(auth.c_str() + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		owns_fds = true;
+		active = read_fd >= 0;
+		return;
+	}
+
+	auto comma = auth.find(',');
+	if (comma == string::npos) return;
+
+	auto r = atoi(auth.substr(0, comma).c_str());
+	auto w = atoi(auth.c_str() + comma + 1);
+
+	// Make closes the descriptors for recipes that aren't marked as recursive ('+'), in which case they
+	// may since have been reused for something else.
+	if (!is_pipe(r) || !is_pipe(w)) return;
+
+	// Reading has to be non-blocking, so that a token taken by another process between poll() and read()
+	// doesn't leave us stuck.  The pipe is shared with make and its other children, so rather than
+	// changing its flags (which a dup() would share) we open a description of our own.  Where that
+	// isn't possible (no /proc), the jobserver is ignored and only 'jobs' limits the parallelism.
+	read_fd = open(("/proc/self/fd/" + to_string(r)).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (read_fd < 0) return;
+
+	owns_fds = true;
+	write_fd = w;
+	active = true;
+#endif
+}
+
+jobserver::~jobserver()
+{
+#ifdef _WIN32
+	if (semaphore != nullptr) CloseHandle(semaphore);
+#else
+	if (owns_fds && read_fd >= 0) close(read_fd);
+#endif
+}
+
+/// <summary>
+/// Gets the jobserver of the make process that MinLib runs under.  MAKEFLAGS is only read the first time.
+/// </summary>
+jobserver& jobserver::get()
+{
+	static jobserver instance;
+	return instance;
+}
+
+/// <summary>
+/// Takes a token from the jobserver, waiting until one is available.
+/// </summary>
+/// <param name="is_cancelled">Checked periodically while waiting; the wait is abandoned once it returns true.</param>
+/// <returns>Returns true if a token was taken, false if there is no jobserver or the wait was cancelled.</returns>
+bool jobserver::acquire(const function<bool()>& is_cancelled)
+{
+	if (!active) return false;
+
+	while (!is_cancelled())
+	{
+#ifdef _WIN32
+		if (WaitForSingleObject(semaphore, JOBSERVER_POLL_MS) == WAIT_OBJECT_0)
+			return true;
+#else
+		pollfd fd = { read_fd, POLLIN, 0 };
+		if (poll(&fd, 1, JOBSERVER_POLL_MS) <= 0 || !(fd.revents & POLLIN))
+			continue;
+
+		char token;
+		auto n = read(read_fd, &token, 1);
+		if (n == 1)
+		{
+			lock_guard<mutex> lock(tokens_mutex);
+			tokens.push_back(token);
+			return true;
+		}
+
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		{
+			// The jobserver has gone away; carry on with the jobs we already have.
+			active = false;
+			return false;
+		}
+#endif
+	}
+
+	return false;
+}
+
+/// <summary>
+/// Gives a token taken by acquire() back to the jobserver.
+/// </summary>
+void jobserver::release()
+{
+#ifdef _WIN32
+	ReleaseSemaphore(semaphore, 1, nullptr);
+#else
+	char token = '+';
+	{
+		lock_guard<mutex> lock(tokens_mutex);
+		if (!tokens.empty())
+		{
+			token = tokens.back();
+			tokens.pop_back();
+		}
+	}
+
+	while (write(write_fd, &token, 1) < 0 && errno == EINTR) {}
+#endif
+}
+
+job_token::job_token(const function<bool()>& is_cancelled)
+{
+	auto& server = jobserver::get();
+	if (!server.is_active())
+	{
+		acquired = true;
+		return;
+	}
+
+	acquired = from_jobserver = server.acquire(is_cancelled);
+}
+
+job_token::~job_token()
+{
+	if (from_jobserver)
+		jobserver::get().release();
+}
+
+/// <summary>
+/// Invokes the function once for every index in the range [0, count), spreading the calls
+/// across up to 'jobs' threads (the calling thread being one of them).  If any of the calls
+/// throws, no further indexes are handed out and the first exception is rethrown once all
+/// threads have finished.  When run under a make jobserver, each thread besides the calling
+/// one only starts processing once it holds a token.
+/// </summary>
+/// <param name="count">The number of indexes to process.</param>
+/// <param name="jobs">The maximum number of threads to use.</param>
+/// <param name="fn">The function to invoke for each index.</param>
+void parallel_for_each(size_t count, size_t jobs, const function<void(size_t)>& fn)
+{
+	if (count == 0) return;
+	if (jobs == 0) jobs = 1;
+
+	atomic<size_t> next_index(0);
+	atomic<bool> failed(false);
+	exception_ptr first_error;
+	mutex error_mutex;
+
+	auto work = [&]() {
+		size_t i;
+		while (!failed && (i = next_index++) < count)
+		{
+			try
+			{
+				fn(i);
+			}
+			catch (...)
+			{
+				lock_guard<mutex> lock(error_mutex);
+				if (!first_error) first_error = current_exception();
+				failed = true;
+			}
+		}
+	};
+
+	auto run_with_token = [&]() {
+		job_token token([&]() { return failed || next_index >= count; });
+		if (token) work();
+	};
+
+	vector<thread> threads;
+	for (size_t t = 1; t < jobs && t < count; ++t)
+		threads.emplace_back(run_with_token);
+
+	work();
+
+	for (auto& t : threads)
+		t.join();
+
+	if (first_error)
+		rethrow_exception(first_error);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/// <summary>
+/// A client of the GNU make jobserver, so that MinLib's threads and compiler processes count against
+/// the job limit of the build that invoked it (e.g. 'make -j8').  The jobserver is found via the
+/// MAKEFLAGS environment variable: '--jobserver-auth=fifo:PATH' (make 4.4+), '--jobserver-auth=R,W' or
+/// '--jobserver-fds=R,W' (inherited pipe), or a named semaphore on Windows.  MinLib itself holds one
+/// implicit job, so a token only has to be acquired for each job that runs alongside the first one.
+/// </summary>
+class jobserver
+{
+private:
+	std::atomic<bool> active{ false };
+#ifdef _WIN32
+	void* semaphore = nullptr;
+#else
+	int read_fd = -1;
+	int write_fd = -1;
+	bool owns_fds = false;
+#endif
+	std::mutex tokens_mutex;
+	std::vector<char> tokens; // The tokens that were read, which have to be written back as-is.
+
+	jobserver();
+	~jobserver();
+
+public:
+	jobserver(const jobserver&) = delete;
+	jobserver& operator=(const jobserver&) = delete;
+
+	static jobserver& get();
+
+	bool is_active() const { return active; }
+	bool acquire(const std::function<bool()>& is_cancelled);
+	void release();
+};
+
+/// <summary>
+/// Holds a jobserver token for as long as the instance exists.  Acquiring a token waits until one is
+/// available, unless the wait is cancelled; without a jobserver, the token is granted straight away.
+/// </summary>
+class job_token
+{
+private:
+	bool acquired = false;
+	bool from_jobserver = false;
+
+public:
+	explicit job_token(const std::function<bool()>& is_cancelled);
+	~job_token();
+
+	job_token(const job_token&) = delete;
+	job_token& operator=(const job_token&) = delete;
+
+	explicit operator bool() const { return acquired; }
+};
+
+void parallel_for_each(size_t count, size_t jobs, const std::function<void(size_t)>& fn);
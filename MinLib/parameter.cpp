@@ -1,6 +1,5 @@
 #include "parameter.hpp"
 #include <fstream>
-#include <sstream>
 #include <filesystem>
 #include <regex>
 #include "string_utils.hpp"
@@ -18,26 +17,36 @@ using namespace minlib;
 bool parameter::parse_param(const char* key_value, parameter& out_param)
 {
 	if (key_value == nullptr) return false;
-	auto kv = str_trim(string(key_value));
-	if (kv.size() == 0) return false;
-	if (kv.substr(0, 1) == string("#")) return false;
+	return parse_param(string_view(key_value), out_param);
+}
 
-	if (kv.size() > 1 && kv.substr(kv.size() - 1, 1) == string("="))
-	{
-		out_param.name = kv.substr(0, kv.size() - 2);
-		return true;
-	}
+/// <summary>
+/// Parameters are expected to be in the k=v format, with spaces allowed inbetween.  The key/value
+/// is parsed in place; only the name and value that are set on the parameter are copied.
+/// </summary>
+/// <param name="key_value">The key/value.</param>
+/// <param name="out_param">The parameter instance that should be set.</param>
+/// <returns>Returns true if the key/value was successfully parsed and the 'out-param' parameter was set.</returns>
+bool parameter::parse_param(string_view key_value, parameter& out_param)
+{
+	auto kv = sv_trim(key_value);
+	if (kv.size() == 0) return false;
+	if (kv[0] == '#') return false;
 
-	auto kv_arr = str_split(kv, '=');
-	if (kv_arr.size() == 1)
+	// Only the first equal sign separates the key from the value, as values
+	// such as compiler flags and definitions may contain equal signs as well.
+	auto separator_pos = kv.find('=');
+	if (separator_pos == string_view::npos)
 	{
-		out_param.value = str_trim(kv_arr[0]);
+		out_param.value = kv;
 		return true;
 	}
-	else if (kv_arr.size() == 2)
+	else if (separator_pos > 0)
 	{
-		out_param.name = str_trim(kv_arr[0]);
-		out_param.value = str_trim(kv_arr[1]);
+		out_param.name = sv_rtrim(kv.substr(0, separator_pos));
+		// A line such as 'name =' has no value, so the value is left as is.
+		if (separator_pos + 1 < kv.size())
+			out_param.value = sv_ltrim(kv.substr(separator_pos + 1));
 		return true;
 	}
 
@@ -84,7 +93,7 @@ vector<parameter> parameter::get_params(const string& filename)
 	while (getline(config_file, line))
 	{
 		parameter p;
-		if (parse_param(line.c_str(), p))
+		if (parse_param(string_view(line), p))
 			params.push_back(p);
 	}
 
@@ -98,10 +107,25 @@ vector<parameter> parameter::get_params(const string& filename)
 /// <returns>List of values.</returns>
 vector<string> parameter::get_param_values(const string& value)
 {
-	stringstream ss;
-	ss << value;
-	string val;
+	auto tokens = sv_split(value);
+
 	vector<string> values;
-	while (ss >> val) { values.push_back(val); }
+	values.reserve(distance(tokens.begin(), tokens.end()));
+	for (auto val : tokens)
+		values.emplace_back(val);
 	return values;
-}
\ No newline at end of file
+}
+
+/// <summary>
+/// Some parameters have a value that is actually a space-delimited list of values.  The values
+/// refer to the original string, and the list is reused, so that parsing the values again doesn't
+/// allocate once the list has grown to fit them.
+/// </summary>
+/// <param name="value">The space-delimited list of values.</param>
+/// <param name="out_values">Set to the list of values.</param>
+void parameter::get_param_values(string_view value, vector<string_view>& out_values)
+{
+	out_values.clear();
+	for (auto val : sv_split(value))
+		out_values.push_back(val);
+}
@@ -1,8 +1,15 @@
 #pragma once
 
+#include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
+class parameter;
+
+// The compiled parameters, keyed by name.  Passed by const reference, as it's read by every stage of a run.
+using parameter_map = std::map<std::string, std::string>;
+
 class parameter
 {
 public:
@@ -11,7 +18,9 @@ public:
 
 public:
 	static bool parse_param(const char* key_value, parameter& out_param);
+	static bool parse_param(std::string_view key_value, parameter& out_param);
 	static std::vector<parameter> get_params(size_t count, char* key_value_array[]);
 	static std::vector<parameter> get_params(const std::string& filename);
 	static std::vector<std::string> get_param_values(const std::string& value);
+	static void get_param_values(std::string_view value, std::vector<std::string_view>& out_values);
 };
\ No newline at end of file
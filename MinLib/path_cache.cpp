@@ -0,0 +1,127 @@
+#include "path_cache.hpp"
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+/// <summary>
+/// Gets the identity of the file (or directory) that the path refers to, following symlinks.
+/// </summary>
+/// <param name="path">The path to the file.</param>
+/// <param name="out_id">The device and inode of the file.</param>
+/// <returns>Returns false if the file doesn't exist or can't be accessed.</returns>
+bool path_cache::get_file_id(const string& path, file_id& out_id)
+{
+#ifdef _WIN32
+	auto handle = CreateFileW(filesystem::u8path(path).c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+
+	BY_HANDLE_FILE_INFORMATION info;
+	auto found = GetFileInformationByHandle(handle, &info) != 0;
+	CloseHandle(handle);
+	if (!found) return false;
+
+	out_id.device = info.dwVolumeSerialNumber;
+	out_id.inode = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+#else
+	struct stat file_stat;
+	if (stat(path.c_str(), &file_stat) != 0) return false;
+
+	out_id.device = (uint64_t)file_stat.st_dev;
+	out_id.inode = (uint64_t)file_stat.st_ino;
+#endif
+	return true;
+}
+
+/// <summary>
+/// Gets the canonical path of a directory: an absolute path without symlinks or '.'/'..' segments.
+/// </summary>
+/// <param name="dir">The path to the directory, relative paths being relative to the current directory.</param>
+/// <param name="out_path">The canonical path, shared by all paths that refer to the same physical directory.</param>
+/// <returns>Returns false if the directory doesn't exist.</returns>
+bool path_cache::get_canonical_dir(const string& dir, string& out_path)
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		if (auto it = dirs.find(dir); it != dirs.end())
+		{
+			out_path = it->second.canonical_path;
+			return it->second.exists;
+		}
+	}
+
+	dir_entry entry;
+	error_code ec;
+	auto canonical_path = filesystem::canonical(filesystem::u8path(dir.empty() ? "." : dir), ec);
+	file_id id;
+
+	if (!ec && filesystem::is_directory(canonical_path, ec) && get_file_id(canonical_path.u8string(), id))
+	{
+		entry.exists = true;
+		entry.canonical_path = canonical_path.u8string();
+
+		lock_guard<std::mutex> lock(mutex);
+		entry.canonical_path = id_paths.emplace(id, entry.canonical_path).first->second;
+		dirs.emplace(dir, entry);
+	}
+	else
+	{
+		lock_guard<std::mutex> lock(mutex);
+		dirs.emplace(dir, entry);
+	}
+
+	out_path = entry.canonical_path;
+	return entry.exists;
+}
+
+/// <summary>
+/// Gets the canonical path of a file, i.e. the canonical path of the directory containing it followed by its
+/// name.  The file itself is not resolved if it's a symlink, since the name is what #include statements refer to.
+/// </summary>
+/// <param name="path">The path to the file.</param>
+/// <param name="out_path">The canonical path.</param>
+/// <returns>Returns false if the directory containing the file doesn't exist.</returns>
+bool path_cache::get_canonical_path(const string& path, string& out_path)
+{
+	auto p = filesystem::u8path(path);
+	auto filename = p.filename().u8string();
+
+	if (filename.empty() || filename == "." || filename == "..")
+		return get_canonical_dir(path, out_path);
+
+	if (!get_canonical_dir(p.parent_path().u8string(), out_path))
+		return false;
+
+	if (out_path.back() != '/' && out_path.back() != (char)filesystem::path::preferred_separator)
+		out_path += (char)filesystem::path::preferred_separator;
+	out_path += filename;
+
+	return true;
+}
+
+/// <summary>
+/// Forgets the directories that were found not to exist, so that those created since are picked up.
+/// </summary>
+void path_cache::forget_missing()
+{
+	lock_guard<std::mutex> lock(mutex);
+	for (auto it = dirs.begin(); it != dirs.end();)
+		it = it->second.exists ? next(it) : dirs.erase(it);
+}
+
+/// <summary>
+/// Forgets all cached paths, e.g. after directories have been created, removed or relinked.
+/// </summary>
+void path_cache::clear()
+{
+	lock_guard<std::mutex> lock(mutex);
+	dirs.clear();
+	id_paths.clear();
+}
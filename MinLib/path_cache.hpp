@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+/// <summary>
+/// Canonicalizes the paths of header files, so that a file reached through symlinked directories,
+/// '..' segments or mixed slashes always ends up with the same path.  Directories are identified by
+/// their (device, inode) pair (volume serial number and file index on Windows), and every spelling of
+/// a directory maps to the canonical path of the first spelling seen for that identity; that way,
+/// bind mounts and the like are merged as well.  The results of the realpath/stat calls are memoized
+/// for the whole run, as the same directories are looked up over and over again.  Each session owns
+/// a cache, which outlives its runs (see minlib::session).  Thread-safe.
+/// </summary>
+class path_cache
+{
+public:
+	struct file_id
+	{
+		uint64_t device = 0;
+		uint64_t inode = 0;
+
+		bool operator==(const file_id& other) const { return device == other.device && inode == other.inode; }
+	};
+
+private:
+	struct file_id_hash
+	{
+		size_t operator()(const file_id& id) const { return std::hash<uint64_t>()(id.device * 0x9e3779b97f4a7c15ull ^ id.inode); }
+	};
+
+	struct dir_entry
+	{
+		bool exists = false;
+		std::string canonical_path;
+	};
+
+	std::mutex mutex;
+	std::unordered_map<std::string, dir_entry> dirs;
+	std::unordered_map<file_id, std::string, file_id_hash> id_paths;
+
+	static bool get_file_id(const std::string& path, file_id& out_id);
+
+public:
+	path_cache() = default;
+
+	path_cache(const path_cache&) = delete;
+	path_cache& operator=(const path_cache&) = delete;
+
+	bool get_canonical_dir(const std::string& dir, std::string& out_path);
+	bool get_canonical_path(const std::string& path, std::string& out_path);
+	void forget_missing();
+	void clear();
+};
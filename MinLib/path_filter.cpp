@@ -0,0 +1,708 @@
+#include "path_filter.hpp"
+#include <bitset>
+#include <map>
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <regex>
+#include <mutex>
+#include <climits>
+#include "errors.hpp"
+
+using namespace std;
+using namespace minlib;
+
+namespace
+{
+	// The number of DFA states kept before the cached states are discarded.
+	const size_t MAX_DFA_STATES = 10000;
+
+	using char_set = bitset<256>;
+
+	// The syntax tree of a pattern.  Globs and regular expressions are both parsed into this form.
+	struct syntax_node
+	{
+		enum node_kind { chars, concat, alternation, repetition, empty };
+
+		node_kind kind = empty;
+		char_set set;
+		vector<size_t> children;
+		int min = 0;
+		int max = -1; // -1 for unbounded.
+	};
+
+	class pattern_parser
+	{
+	private:
+		vector<syntax_node>& nodes;
+		string_view pattern;
+		size_t pos = 0;
+
+		[[noreturn]] void fail() const
+		{
+			throw runtime_error(regex_replace(FILTER_PATTERN_ERROR, regex("%s"), string(pattern)));
+		}
+
+		size_t add(syntax_node node)
+		{
+			nodes.push_back(move(node));
+			return nodes.size() - 1;
+		}
+
+		size_t add_chars(const char_set& set)
+		{
+			syntax_node node;
+			node.kind = syntax_node::chars;
+			node.set = set;
+			return add(move(node));
+		}
+
+		size_t add_concat(vector<size_t> children)
+		{
+			syntax_node node;
+			node.kind = syntax_node::concat;
+			node.children = move(children);
+			return add(move(node));
+		}
+
+		size_t add_repetition(size_t child, int min, int max)
+		{
+			syntax_node node;
+			node.kind = syntax_node::repetition;
+			node.children.push_back(child);
+			node.min = min;
+			node.max = max;
+			return add(move(node));
+		}
+
+		static char_set single(unsigned char c)
+		{
+			char_set set;
+			set.set(c);
+			if (c == '/' || c == '\\') { set.set('/'); set.set('\\'); } // Both are separators.
+			return set;
+		}
+
+		static char_set any_char()
+		{
+			return char_set().set();
+		}
+
+		static char_set any_but_separator()
+		{
+			return char_set().set().reset('/').reset('\\');
+		}
+
+		// Parses a '[...]' class; 'pos' is just past the '['.
+		char_set parse_class(bool glob)
+		{
+			char_set set;
+			auto negate = pos < pattern.size() && (pattern[pos] == '^' || (glob && pattern[pos] == '!'));
+			if (negate) ++pos;
+
+			auto first = true;
+			while (pos < pattern.size() && (pattern[pos] != ']' || first))
+			{
+				first = false;
+				unsigned char from = pattern[pos++];
+
+				if (from == '\\' && pos < pattern.size())
+				{
+					if (!glob)
+					{
+						if (auto escape_set = parse_class_escape(pattern[pos]); escape_set.any())
+						{
+							++pos;
+							set |= escape_set;
+							continue;
+						}
+					}
+					from = pattern[pos++];
+				}
+
+				auto to = from;
+				if (pos + 1 < pattern.size() && pattern[pos] == '-' && pattern[pos + 1] != ']')
+				{
+					to = pattern[pos + 1];
+					pos += 2;
+					if (to == '\\' && pos < pattern.size()) to = pattern[pos++];
+					if (to < from) fail();
+				}
+
+				for (auto c = (unsigned)from; c <= to; ++c)
+					set |= single((unsigned char)c);
+			}
+
+			if (pos >= pattern.size()) fail();
+			++pos; // ']'
+
+			if (negate) set.flip();
+			if (glob) set.reset('/').reset('\\');
+			return set;
+		}
+
+		static char_set parse_class_escape(char c)
+		{
+			char_set set;
+			auto add_range = [&set](unsigned char from, unsigned char to) { for (auto x = (unsigned)from; x <= to; ++x) set.set(x); };
+
+			switch (tolower((unsigned char)c))
+			{
+			case 'd': add_range('0', '9'); break;
+			case 'w': add_range('0', '9'); add_range('a', 'z'); add_range('A', 'Z'); set.set('_'); break;
+			case 's': set.set(' '); set.set('\t'); set.set('\n'); set.set('\r'); set.set('\v'); set.set('\f'); break;
+			default: return set;
+			}
+
+			if (isupper((unsigned char)c)) set.flip();
+			return set;
+		}
+
+		// alternation := sequence ('|' sequence)*
+		size_t parse_alternation()
+		{
+			syntax_node node;
+			node.kind = syntax_node::alternation;
+			node.children.push_back(parse_sequence());
+
+			while (pos < pattern.size() && pattern[pos] == '|')
+			{
+				++pos;
+				node.children.push_back(parse_sequence());
+			}
+
+			return node.children.size() == 1 ? node.children[0] : add(move(node));
+		}
+
+		// sequence := (atom quantifier*)*
+		size_t parse_sequence()
+		{
+			vector<size_t> children;
+
+			while (pos < pattern.size() && pattern[pos] != '|' && pattern[pos] != ')')
+			{
+				auto atom = parse_atom();
+
+				while (pos < pattern.size())
+				{
+					auto c = pattern[pos];
+					if (c == '*') { ++pos; atom = add_repetition(atom, 0, -1); }
+					else if (c == '+') { ++pos; atom = add_repetition(atom, 1, -1); }
+					else if (c == '?') { ++pos; atom = add_repetition(atom, 0, 1); }
+					else if (c == '{' && parse_bounds(atom)) {}
+					else break;
+
+					if (pos < pattern.size() && pattern[pos] == '?') ++pos; // Lazy quantifiers match the same paths.
+				}
+
+				children.push_back(atom);
+			}
+
+			return add_concat(move(children));
+		}
+
+		// Parses '{m}', '{m,}' or '{m,n}'; a '{' that doesn't start one of these is a literal.
+		bool parse_bounds(size_t& atom)
+		{
+			auto end = pattern.find('}', pos);
+			if (end == string_view::npos) return false;
+
+			auto bounds = string(pattern.substr(pos + 1, end - pos - 1));
+			smatch match;
+			if (!regex_match(bounds, match, regex("(\\d+)(,(\\d*))?"))) return false;
+
+			auto min = stoi(match[1].str());
+			auto max = !match[2].matched ? min : match[3].length() == 0 ? -1 : stoi(match[3].str());
+			if ((max != -1 && max < min) || min > 255 || max > 255) fail();
+
+			pos = end + 1;
+			atom = add_repetition(atom, min, max);
+			return true;
+		}
+
+		size_t parse_atom()
+		{
+			auto c = pattern[pos++];
+			switch (c)
+			{
+			case '(':
+			{
+				if (pattern.substr(pos, 2) == "?:") pos += 2;
+				auto inner = parse_alternation();
+				if (pos >= pattern.size() || pattern[pos] != ')') fail();
+				++pos;
+				return inner;
+			}
+			case '[':
+				return add_chars(parse_class(false));
+			case '.':
+				return add_chars(any_char());
+			case '^':
+			case '$':
+				// The whole path has to match anyway.
+				return add(syntax_node());
+			case '\\':
+			{
+				if (pos >= pattern.size()) fail();
+				auto escaped = pattern[pos++];
+				if (auto set = parse_class_escape(escaped); set.any())
+					return add_chars(set);
+				return add_chars(single((unsigned char)escaped));
+			}
+			case '*':
+			case '+':
+			case '?':
+			case ')':
+				fail();
+			default:
+				return add_chars(single((unsigned char)c));
+			}
+		}
+
+	public:
+		pattern_parser(vector<syntax_node>& nodes, string_view pattern) : nodes(nodes), pattern(pattern) {}
+
+		size_t parse_regex()
+		{
+			auto root = parse_alternation();
+			if (pos != pattern.size()) fail();
+			return root;
+		}
+
+		size_t parse_glob()
+		{
+			vector<size_t> children;
+
+			// Unless anchored with a leading '/', the glob may match from any component onwards.
+			if (!pattern.empty() && (pattern[0] == '/' || pattern[0] == '\\'))
+				++pos;
+			else
+				children.push_back(add_repetition(add_concat({ add_repetition(add_chars(any_char()), 0, -1), add_chars(single('/')) }), 0, 1));
+
+			while (pos < pattern.size())
+			{
+				auto c = pattern[pos++];
+				auto at_component_start = pos == 1 || pattern[pos - 2] == '/' || pattern[pos - 2] == '\\';
+
+				if (c == '*' && pos < pattern.size() && pattern[pos] == '*')
+				{
+					++pos;
+					auto any = add_repetition(add_chars(any_char()), 0, -1);
+
+					if (at_component_start && pos < pattern.size() && (pattern[pos] == '/' || pattern[pos] == '\\'))
+					{
+						// '**/' matches zero or more directories.
+						++pos;
+						children.push_back(add_repetition(add_concat({ any, add_chars(single('/')) }), 0, 1));
+					}
+					else
+					{
+						children.push_back(any);
+					}
+				}
+				else if (c == '*')
+					children.push_back(add_repetition(add_chars(any_but_separator()), 0, -1));
+				else if (c == '?')
+					children.push_back(add_chars(any_but_separator()));
+				else if (c == '[')
+					children.push_back(add_chars(parse_class(true)));
+				else if (c == '\\' && pos < pattern.size() && pattern[pos] != '/' && pattern[pos] != '\\')
+					children.push_back(add_chars(single((unsigned char)pattern[pos++])));
+				else
+					children.push_back(add_chars(single((unsigned char)c)));
+			}
+
+			return add_concat(move(children));
+		}
+	};
+
+	// A Thompson NFA, built from the syntax trees of all of the patterns.
+	struct nfa
+	{
+		struct state
+		{
+			vector<uint32_t> epsilon;
+			int set_index = -1; // The characters that lead to 'next', if any.
+			uint32_t next = 0;
+			uint8_t tag = 0;
+		};
+
+		vector<state> states;
+		vector<char_set> sets;
+
+		uint32_t add_state()
+		{
+			states.emplace_back();
+			return (uint32_t)states.size() - 1;
+		}
+
+		// Builds the fragment for a node, returning its start and end states.
+		pair<uint32_t, uint32_t> build(const vector<syntax_node>& nodes, size_t index)
+		{
+			auto& node = nodes[index];
+			auto start = add_state();
+
+			switch (node.kind)
+			{
+			case syntax_node::chars:
+			{
+				auto end = add_state();
+				auto it = find(sets.begin(), sets.end(), node.set);
+				states[start].set_index = (int)(it - sets.begin());
+				if (it == sets.end()) sets.push_back(node.set);
+				states[start].next = end;
+				return { start, end };
+			}
+			case syntax_node::concat:
+			{
+				auto end = start;
+				for (auto child : node.children)
+				{
+					auto fragment = build(nodes, child);
+					states[end].epsilon.push_back(fragment.first);
+					end = fragment.second;
+				}
+				return { start, end };
+			}
+			case syntax_node::alternation:
+			{
+				auto end = add_state();
+				for (auto child : node.children)
+				{
+					auto fragment = build(nodes, child);
+					states[start].epsilon.push_back(fragment.first);
+					states[fragment.second].epsilon.push_back(end);
+				}
+				return { start, end };
+			}
+			case syntax_node::repetition:
+			{
+				auto end = start;
+				for (int i = 0; i < node.min; ++i)
+				{
+					auto fragment = build(nodes, node.children[0]);
+					states[end].epsilon.push_back(fragment.first);
+					end = fragment.second;
+				}
+
+				if (node.max == -1)
+				{
+					auto loop = add_state();
+					auto fragment = build(nodes, node.children[0]);
+					states[end].epsilon.push_back(loop);
+					states[loop].epsilon.push_back(fragment.first);
+					states[fragment.second].epsilon.push_back(loop);
+					end = loop;
+				}
+				else
+				{
+					auto optional_end = add_state();
+					for (int i = node.min; i < node.max; ++i)
+					{
+						auto fragment = build(nodes, node.children[0]);
+						states[end].epsilon.push_back(fragment.first);
+						states[end].epsilon.push_back(optional_end);
+						end = fragment.second;
+					}
+					states[end].epsilon.push_back(optional_end);
+					end = optional_end;
+				}
+				return { start, end };
+			}
+			default:
+				return { start, start };
+			}
+		}
+
+		// Adds the states reachable through epsilon transitions; the result is sorted, so it can serve as a key.
+		void close(vector<uint32_t>& set) const
+		{
+			vector<bool> included(states.size());
+			for (auto s : set) included[s] = true;
+
+			for (size_t i = 0; i < set.size(); ++i)
+			{
+				for (auto e : states[set[i]].epsilon)
+				{
+					if (!included[e])
+					{
+						included[e] = true;
+						set.push_back(e);
+					}
+				}
+			}
+
+			sort(set.begin(), set.end());
+		}
+	};
+}
+
+/// <summary>
+/// The NFA of all of the patterns, whose accepting states are tagged as include or exclude, along with the
+/// DFA states built from it so far.  Bytes that no pattern tells apart share a column of the transition table.
+/// </summary>
+struct path_filter::automaton
+{
+	static constexpr uint8_t INCLUDE_TAG = 1;
+	static constexpr uint8_t EXCLUDE_TAG = 2;
+	static constexpr uint32_t UNKNOWN_STATE = UINT32_MAX;
+	static constexpr uint32_t DEAD_STATE = 0;
+	static constexpr uint32_t START_STATE = 1;
+
+	nfa states;
+	uint32_t nfa_start = 0;
+	uint8_t byte_classes[256] = {};
+	vector<unsigned char> class_bytes; // A representative byte of each class.
+
+	mutex dfa_mutex;
+	map<vector<uint32_t>, uint32_t> dfa_ids;
+	vector<vector<uint32_t>> dfa_sets;
+	vector<uint32_t> transitions; // [state * class count + byte class]
+	vector<uint8_t> tags;
+
+	// Gets the DFA state for a set of NFA states, creating it if need be.  Should there be too many states,
+	// the cached states are discarded first, which invalidates all of the state numbers except the first two.
+	uint32_t get_state(vector<uint32_t> set)
+	{
+		states.close(set);
+		if (auto it = dfa_ids.find(set); it != dfa_ids.end())
+			return it->second;
+
+		if (tags.size() >= MAX_DFA_STATES)
+		{
+			dfa_ids.clear();
+			dfa_sets.clear();
+			transitions.clear();
+			tags.clear();
+			get_state({});
+			get_state({ nfa_start });
+		}
+
+		uint8_t tag = 0;
+		for (auto s : set) tag |= states.states[s].tag;
+
+		auto id = (uint32_t)tags.size();
+		tags.push_back(tag);
+		transitions.resize(tags.size() * class_bytes.size(), set.empty() ? DEAD_STATE : UNKNOWN_STATE);
+		if (set.empty()) fill(transitions.end() - class_bytes.size(), transitions.end(), DEAD_STATE);
+
+		dfa_ids.emplace(set, id);
+		dfa_sets.push_back(move(set));
+		return id;
+	}
+
+	uint32_t get_next_state(uint32_t state, size_t byte_class)
+	{
+		vector<uint32_t> next;
+		for (auto s : dfa_sets[state])
+		{
+			auto& nfa_state = states.states[s];
+			if (nfa_state.set_index >= 0 && states.sets[nfa_state.set_index][class_bytes[byte_class]])
+				next.push_back(nfa_state.next);
+		}
+
+		sort(next.begin(), next.end());
+		next.erase(unique(next.begin(), next.end()), next.end());
+
+		auto state_count = tags.size();
+		auto next_state = get_state(move(next));
+		if (tags.size() >= state_count) // Unless the cached states were discarded.
+			transitions[state * class_bytes.size() + byte_class] = next_state;
+
+		return next_state;
+	}
+};
+
+path_filter::path_filter() = default;
+path_filter::~path_filter() = default;
+path_filter::path_filter(path_filter&&) noexcept = default;
+path_filter& path_filter::operator=(path_filter&&) noexcept = default;
+
+/// <summary>
+/// Compiles the patterns: each is parsed into a syntax tree and the trees are combined into a single NFA,
+/// which is then turned into a DFA (by subset construction) as paths are classified.
+/// </summary>
+/// <param name="include_patterns">The patterns that paths have to match, if any.</param>
+/// <param name="exclude_patterns">The patterns that paths must not match.</param>
+path_filter::path_filter(const vector<string>& include_patterns, const vector<string>& exclude_patterns)
+	: has_include_patterns(!include_patterns.empty()), has_exclude_patterns(!exclude_patterns.empty()), compiled(make_unique<automaton>())
+{
+	vector<syntax_node> nodes;
+	auto& states = compiled->states;
+	compiled->nfa_start = states.add_state();
+
+	auto add_patterns = [&](const vector<string>& patterns, uint8_t tag) {
+		for (auto& pattern : patterns)
+		{
+			string_view p = pattern;
+			auto is_regex = p.substr(0, 3) == "re:";
+			pattern_parser parser(nodes, is_regex ? p.substr(3) : p);
+			auto root = is_regex ? parser.parse_regex() : parser.parse_glob();
+
+			auto fragment = states.build(nodes, root);
+			states.states[compiled->nfa_start].epsilon.push_back(fragment.first);
+			states.states[fragment.second].tag |= tag;
+		}
+	};
+
+	add_patterns(include_patterns, automaton::INCLUDE_TAG);
+	add_patterns(exclude_patterns, automaton::EXCLUDE_TAG);
+
+	// Bytes that belong to exactly the same character sets are interchangeable.
+	map<vector<bool>, uint8_t> signatures;
+	for (unsigned b = 0; b < 256; ++b)
+	{
+		vector<bool> signature(states.sets.size());
+		for (size_t i = 0; i < states.sets.size(); ++i)
+			signature[i] = states.sets[i][b];
+
+		auto it = signatures.find(signature);
+		if (it == signatures.end())
+		{
+			it = signatures.emplace(move(signature), (uint8_t)compiled->class_bytes.size()).first;
+			compiled->class_bytes.push_back((unsigned char)b);
+		}
+		compiled->byte_classes[b] = it->second;
+	}
+
+	compiled->get_state({});
+	compiled->get_state({ compiled->nfa_start });
+}
+
+/// <summary>
+/// Checks whether a path passes the filter, i.e. matches one of the include patterns (if there are any)
+/// and none of the exclude patterns.
+/// </summary>
+/// <param name="path">The path, relative to the include directory.</param>
+/// <returns>Returns true if the path passes the filter.</returns>
+bool path_filter::matches(string_view path) const
+{
+	if (!has_include_patterns && !has_exclude_patterns)
+		return true;
+
+	auto& dfa = *compiled;
+	auto class_count = dfa.class_bytes.size();
+
+	// Transitions are added as they are first taken, so the DFA is shared by the copy workers under a lock.
+	lock_guard<mutex> lock(dfa.dfa_mutex);
+
+	auto state = automaton::START_STATE;
+	for (auto c : path)
+	{
+		auto byte_class = dfa.byte_classes[(unsigned char)c];
+		auto next_state = dfa.transitions[state * class_count + byte_class];
+		state = next_state != automaton::UNKNOWN_STATE ? next_state : dfa.get_next_state(state, byte_class);
+		if (state == automaton::DEAD_STATE) break;
+	}
+
+	auto tag = dfa.tags[state];
+	return (!has_include_patterns || (tag & automaton::INCLUDE_TAG)) && !(tag & automaton::EXCLUDE_TAG);
+}
+
+/// <summary>
+/// Adds an include directory to the trie.
+/// </summary>
+/// <param name="dir">The canonical path to the include directory.</param>
+/// <param name="dir_index">The index of the include directory, reported by find().</param>
+void include_dir_trie::add(string_view dir, size_t dir_index)
+{
+	size_t current = 0;
+	size_t start = 0;
+
+	while (start < dir.size())
+	{
+		auto end = dir.find_first_of("/\\", start);
+		if (end == string_view::npos) end = dir.size();
+
+		if (end > start)
+		{
+			auto component = string(dir.substr(start, end - start));
+			auto it = nodes[current].children.find(component);
+			if (it == nodes[current].children.end())
+			{
+				nodes.emplace_back();
+				it = nodes[current].children.emplace(component, nodes.size() - 1).first;
+			}
+			current = it->second;
+		}
+
+		start = end + 1;
+	}
+
+	nodes[current].dir_index = min(nodes[current].dir_index, dir_index);
+}
+
+/// <summary>
+/// Finds the include directory that a path is within.
+/// </summary>
+/// <param name="path">The canonical path to the file.</param>
+/// <param name="out_dir_index">The index of the include directory.</param>
+/// <param name="out_prefix_length">The length of the include directory's path within 'path', including the separator after it.</param>
+/// <returns>Returns false if the path isn't within any of the include directories.</returns>
+bool include_dir_trie::find(string_view path, size_t& out_dir_index, size_t& out_prefix_length) const
+{
+	size_t current = 0;
+	size_t start = 0;
+	out_dir_index = nodes[0].dir_index; // The root directory.
+	out_prefix_length = !path.empty() && (path[0] == '/' || path[0] == '\\') ? 1 : 0;
+
+	while (start < path.size())
+	{
+		auto end = path.find_first_of("/\\", start);
+		if (end == string_view::npos) break; // The file name; the file has to be within the directory.
+
+		if (end > start)
+		{
+			auto& children = nodes[current].children;
+			auto it = children.find(string(path.substr(start, end - start)));
+			if (it == children.end()) break;
+
+			current = it->second;
+			if (nodes[current].dir_index < out_dir_index)
+			{
+				out_dir_index = nodes[current].dir_index;
+				out_prefix_length = end + 1;
+			}
+		}
+
+		start = end + 1;
+	}
+
+	return out_dir_index != SIZE_MAX;
+}
+
+/// <summary>
+/// Compiles the include directories and the filter patterns.
+/// </summary>
+/// <param name="paths">The cache used to canonicalize the include directories and header files.</param>
+/// <param name="include_dirs">The include directories; those that don't exist are ignored.</param>
+/// <param name="include_patterns">The 'include_filter' patterns.</param>
+/// <param name="exclude_patterns">The 'exclude_filter' patterns.</param>
+include_classifier::include_classifier(path_cache& paths, const vector<string>& include_dirs, const vector<string>& include_patterns, const vector<string>& exclude_patterns)
+	: paths(paths), filter(include_patterns, exclude_patterns)
+{
+	for (size_t i = 0; i < include_dirs.size(); ++i)
+	{
+		string canonical_dir;
+		if (paths.get_canonical_dir(include_dirs[i], canonical_dir))
+			trie.add(canonical_dir, i);
+	}
+}
+
+/// <summary>
+/// Checks whether a header file should be bundled.
+/// </summary>
+/// <param name="path">The path to the header file.</param>
+/// <param name="out_dir_index">The index of the include directory the header file is within.</param>
+/// <param name="out_relative_path">The path to the header file, relative to that include directory.</param>
+/// <returns>Returns true if the header file is within one of the include directories and passes the filter.</returns>
+bool include_classifier::classify(const string& path, size_t& out_dir_index, string& out_relative_path) const
+{
+	string canonical_path;
+	size_t prefix_length;
+	if (!paths.get_canonical_path(path, canonical_path) || !trie.find(canonical_path, out_dir_index, prefix_length))
+		return false;
+
+	out_relative_path = canonical_path.substr(prefix_length);
+	return filter.matches(out_relative_path);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "path_cache.hpp"
+
+/// <summary>
+/// A set of include and exclude patterns, compiled into a single DFA so that a path is classified
+/// in one pass over its characters, however many patterns there are.  Patterns are globs by default,
+/// where '*' and '?' match within a path component, '**' matches across components and '[...]' is
+/// a character class; a glob matches the end of a path at a component boundary, unless it begins
+/// with '/', in which case it has to match the whole path.  Patterns prefixed with 're:' are
+/// regular expressions (ECMAScript-like syntax without backreferences or lookarounds), which have
+/// to match the whole path.  Paths use '/' as the separator; '\' is treated the same way.  The DFA
+/// is built lazily, so that only the states that paths actually reach are created.
+/// </summary>
+class path_filter
+{
+private:
+	struct automaton;
+
+	bool has_include_patterns = false;
+	bool has_exclude_patterns = false;
+	std::unique_ptr<automaton> compiled;
+
+public:
+	path_filter();
+	path_filter(const std::vector<std::string>& include_patterns, const std::vector<std::string>& exclude_patterns);
+	~path_filter();
+
+	path_filter(path_filter&&) noexcept;
+	path_filter& operator=(path_filter&&) noexcept;
+
+	bool matches(std::string_view path) const;
+};
+
+/// <summary>
+/// A trie of the components of the (canonical) include directories, which finds the include directory
+/// a path belongs to in a single pass over the path.  If the path is within several of the directories,
+/// the one that was added first wins, as with the compiler's include search order.
+/// </summary>
+class include_dir_trie
+{
+private:
+	struct node
+	{
+		std::unordered_map<std::string, size_t> children;
+		size_t dir_index = SIZE_MAX;
+	};
+
+	std::vector<node> nodes{ node() };
+
+public:
+	void add(std::string_view dir, size_t dir_index);
+	bool find(std::string_view path, size_t& out_dir_index, size_t& out_prefix_length) const;
+};
+
+/// <summary>
+/// Decides which header files are bundled: those within one of the include directories (after
+/// canonicalization, see path_cache) whose path relative to that directory passes the filter.
+/// </summary>
+class include_classifier
+{
+private:
+	path_cache& paths;
+	include_dir_trie trie;
+	path_filter filter;
+
+public:
+	include_classifier(path_cache& paths, const std::vector<std::string>& include_dirs, const std::vector<std::string>& include_patterns, const std::vector<std::string>& exclude_patterns);
+
+	bool classify(const std::string& path, size_t& out_dir_index, std::string& out_relative_path) const;
+};
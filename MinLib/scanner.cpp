@@ -0,0 +1,319 @@
+#include "scanner.hpp"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <set>
+#include <regex>
+#include "mapped_file.hpp"
+#include "string_utils.hpp"
+#include "file_utils.hpp"
+#include "parallel_utils.hpp"
+#include "cli.hpp"
+#include "errors.hpp"
+#include "stage_dir.hpp"
+
+using namespace std;
+using namespace minlib;
+
+const char* scanner::source_extensions[] = { ".c", ".cc", ".cpp", ".cxx", ".c++", ".h", ".hh", ".hpp", ".hxx", ".h++", ".inl", ".ipp", ".tpp" };
+
+/// <summary>
+/// Finds all source files within the source directories, skipping MinLib's own output.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <returns>The paths to the source files, sorted so that the generated input file is deterministic.</returns>
+vector<string> scanner::get_source_files(const parameter_map& param_map)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = filesystem::current_path() / working_dir_path;
+
+	auto get_full_path = [&](const string& path) {
+		filesystem::path p(get_expanded_path(path));
+		return (p.is_relative() ? working_dir_path / p : p).lexically_normal();
+	};
+
+	// The bundle may well be stored within the project, in which case it must not be scanned.
+	vector<filesystem::path> skipped_dirs{ stage_dir::get_root(working_dir_path) };
+	if (auto it = param_map.find(cli::INCLUDE_OUT_DIR_PARAM); it != param_map.end())
+		skipped_dirs.push_back(get_full_path(it->second));
+
+	vector<string> result;
+
+	for (auto& source_dir : parameter::get_param_values(param_map.at(cli::SOURCE_DIR_PARAM)))
+	{
+		auto source_path = get_full_path(source_dir);
+		auto options = filesystem::directory_options::skip_permission_denied;
+
+		for (auto it = filesystem::recursive_directory_iterator(source_path, options); it != filesystem::recursive_directory_iterator(); ++it)
+		{
+			if (it->is_directory())
+			{
+				auto dir = it->path().lexically_normal();
+				if (find(skipped_dirs.begin(), skipped_dirs.end(), dir) != skipped_dirs.end())
+					it.disable_recursion_pending();
+				continue;
+			}
+
+			if (!it->is_regular_file()) continue;
+
+			auto extension = it->path().extension().u8string();
+			transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+
+			for (auto ext : source_extensions)
+			{
+				if (extension == ext)
+				{
+					result.push_back(it->path().u8string());
+					break;
+				}
+			}
+		}
+	}
+
+	sort(result.begin(), result.end());
+	result.erase(unique(result.begin(), result.end()), result.end());
+
+	return result;
+}
+
+/// <summary>
+/// Finds the #include statements in a source file that refer to the target library.  Rather than
+/// tokenizing the file, only the lines that start with a pound sign are looked at, while keeping
+/// track of block comments so that commented-out statements are ignored.
+/// </summary>
+/// <param name="filename">The source file.</param>
+/// <param name="include_prefixes">The prefixes of the header names belonging to the target library.  If empty, all '#include &lt;...&gt;' statements are returned.</param>
+/// <param name="keep_conditions">Whether to record the preprocessor conditions the #include statements depend on.</param>
+/// <returns>The #include statements found in the file.</returns>
+vector<scanner::scanned_include> scanner::scan_file(const string& filename, const vector<string>& include_prefixes, bool keep_conditions)
+{
+	struct condition_group
+	{
+		vector<string> previous; // The conditions of the preceding #if/#elif branches.
+		string current;          // The condition of the current branch (empty for #else).
+		bool is_guard = false;   // Whether this is the header's include guard.
+	};
+
+	vector<scanned_include> result;
+	mapped_file file(filename);
+
+	const char* p = file.data();
+	const char* end = p + file.size();
+	auto in_comment = false;
+	auto is_first_directive = true;
+	string guard_macro;
+	vector<condition_group> groups;
+
+	auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v'; };
+
+	auto get_condition = [&groups]() {
+		// Simple conditions such as 'defined(X)' don't need to be parenthesized.
+		auto group = [](const string& c) {
+			return all_of(c.begin(), c.end(), [](unsigned char ch) { return isalnum(ch) || ch == '_' || ch == '(' || ch == ')'; }) ? c : "(" + c + ")";
+		};
+
+		string condition;
+		for (auto& g : groups)
+		{
+			if (g.is_guard) continue;
+			for (auto& prev : g.previous)
+				condition += (condition.empty() ? "" : " && ") + ("!" + group(prev));
+			if (!g.current.empty())
+				condition += (condition.empty() ? "" : " && ") + group(g.current);
+		}
+		return condition;
+	};
+
+	while (p < end)
+	{
+		auto line_end = (const char*)memchr(p, '\n', end - p);
+		if (line_end == nullptr) line_end = end;
+
+		auto q = p;
+		if (!in_comment)
+			while (q < line_end && is_space(*q)) ++q;
+
+		if (in_comment || q >= line_end || *q != '#')
+		{
+			// Not a directive, but it may open or close a block comment.
+			if (in_comment || memchr(q, '/', line_end - q) != nullptr)
+				strip_comments(string_view(q, line_end - q), in_comment);
+			p = line_end + 1;
+			continue;
+		}
+
+		// Directives continue onto the next line if the line ends with a backslash, or if a block comment
+		// opened on the line is still open at its end.
+		string text;
+		while (true)
+		{
+			while (line_end < end)
+			{
+				auto last = line_end;
+				while (last > q && (last[-1] == '\r')) --last;
+				if (last == q || last[-1] != '\\') break;
+
+				auto next_end = (const char*)memchr(line_end + 1, '\n', end - line_end - 1);
+				line_end = next_end == nullptr ? end : next_end;
+			}
+
+			in_comment = false;
+			text = strip_comments(string_view(q + 1, line_end - q - 1), in_comment);
+			if (!in_comment || line_end >= end) break;
+
+			auto next_end = (const char*)memchr(line_end + 1, '\n', end - line_end - 1);
+			line_end = next_end == nullptr ? end : next_end;
+		}
+
+		auto directive = sv_trim(text);
+		p = line_end + 1;
+
+		auto name_end = find_if(directive.begin(), directive.end(), [](unsigned char c) { return !isalnum(c) && c != '_'; });
+		auto name = directive.substr(0, name_end - directive.begin());
+		auto argument = sv_trim(directive.substr(name.size()));
+		auto was_first_directive = is_first_directive;
+		is_first_directive = false;
+
+		if (name == "include")
+		{
+			if (argument.size() < 3) continue;
+
+			auto close = argument[0] == '<' ? '>' : (argument[0] == '"' ? '"' : '\0');
+			auto close_pos = argument.find(close, 1);
+			if (close == '\0' || close_pos == string_view::npos) continue; // Computed includes can't be resolved.
+
+			auto header = string(argument.substr(1, close_pos - 1));
+			auto matches = include_prefixes.empty() ? close == '>' : any_of(include_prefixes.begin(), include_prefixes.end(),
+				[&header](const string& prefix) { return header.compare(0, prefix.size(), prefix) == 0; });
+
+			if (matches)
+				result.push_back({ header, keep_conditions ? get_condition() : string() });
+		}
+		else if (name == "if" || name == "ifdef" || name == "ifndef")
+		{
+			condition_group g;
+			if (name == "ifdef") g.current = "defined(" + string(argument) + ")";
+			else if (name == "ifndef") g.current = "!defined(" + string(argument) + ")";
+			else g.current = string(argument);
+
+			// '#ifndef X' followed by '#define X' as the first directives is an include guard.
+			if (was_first_directive && name == "ifndef") guard_macro = string(argument);
+			groups.push_back(g);
+		}
+		else if (name == "define")
+		{
+			if (!guard_macro.empty() && groups.size() == 1 && argument == guard_macro)
+				groups.back().is_guard = true;
+		}
+		else if ((name == "elif" || name == "else") && !groups.empty())
+		{
+			auto& g = groups.back();
+			g.previous.push_back(g.current);
+			g.current = name == "elif" ? string(argument) : string();
+		}
+		else if (name == "endif" && !groups.empty())
+		{
+			groups.pop_back();
+		}
+
+		if (!was_first_directive || name != "ifndef") guard_macro.clear();
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Scans the source files of the project for #include statements that refer to the target library
+/// and writes the deduplicated list of statements to the input file.  The source files are scanned
+/// in parallel.  If 'scan_conditionals' is set, #include statements that only appear within
+/// conditional sections are written within an equivalent #if/#endif block.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+void scanner::generate_input_file(const parameter_map& param_map)
+{
+	auto start_time = chrono::steady_clock::now();
+
+	vector<string> include_prefixes;
+	if (auto it = param_map.find(cli::INCLUDE_PREFIXES_PARAM); it != param_map.end())
+		include_prefixes = parameter::get_param_values(it->second);
+
+	auto keep_conditions = cli::is_flag_set(param_map, cli::SCAN_CONDITIONALS_PARAM);
+	auto source_files = get_source_files(param_map);
+
+	vector<vector<scanned_include>> file_includes(source_files.size());
+	atomic<uintmax_t> total_bytes(0);
+
+	parallel_for_each(source_files.size(), cli::get_job_count(param_map), [&](size_t i) {
+		file_includes[i] = scan_file(source_files[i], include_prefixes, keep_conditions);
+		total_bytes += filesystem::file_size(source_files[i]);
+	});
+
+	// Merge the results in file order, keeping the first occurrence of each statement.
+	vector<string> includes;
+	set<string> seen_includes;
+	vector<pair<string, vector<string>>> conditional_includes;
+	set<pair<string, string>> seen_conditional_includes;
+
+	for (auto& fi : file_includes)
+	{
+		for (auto& si : fi)
+		{
+			if (si.condition.empty())
+			{
+				if (seen_includes.insert(si.header).second)
+					includes.push_back(si.header);
+			}
+			else if (seen_conditional_includes.insert({ si.condition, si.header }).second)
+			{
+				auto it = find_if(conditional_includes.begin(), conditional_includes.end(), [&si](auto& ci) { return ci.first == si.condition; });
+				if (it == conditional_includes.end())
+					it = conditional_includes.insert(conditional_includes.end(), { si.condition, {} });
+				it->second.push_back(si.header);
+			}
+		}
+	}
+
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	auto input_file = filesystem::path(get_expanded_path(param_map.at(cli::INPUT_FILE_PARAM)));
+	if (input_file.is_relative())
+		input_file = working_dir_path / input_file;
+
+	filesystem::create_directories(input_file.parent_path());
+	ofstream out(input_file);
+	if (!out)
+		throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), input_file.u8string()));
+
+	out << "// Generated by MinLib from the #include statements found in " << source_files.size() << " source files." << endl;
+
+	auto include_count = includes.size();
+	for (auto& header : includes)
+		out << "#include <" << header << ">" << endl;
+
+	for (auto& ci : conditional_includes)
+	{
+		// Headers that are also included unconditionally are already covered.
+		vector<string> headers;
+		copy_if(ci.second.begin(), ci.second.end(), back_inserter(headers), [&](const string& h) { return seen_includes.count(h) == 0; });
+		if (headers.empty()) continue;
+
+		out << endl << "#if " << ci.first << endl;
+		for (auto& header : headers)
+			out << "#include <" << header << ">" << endl;
+		out << "#endif" << endl;
+		include_count += headers.size();
+	}
+
+	out.close();
+	if (!out)
+		throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), input_file.u8string()));
+
+	auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+	cout << "Scanned " << source_files.size() << " source files (" << total_bytes / 1024 << " KB) in "
+		<< (int)(seconds * 1000) << " ms (" << (int)(source_files.size() / max(seconds, 0.001)) << " files/s), found "
+		<< include_count << " #include statements." << endl;
+}
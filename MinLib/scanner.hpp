@@ -0,0 +1,25 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include "parameter.hpp"
+
+class scanner
+{
+private:
+	struct scanned_include
+	{
+		std::string header;
+		std::string condition; // Empty if the #include statement is not within a conditional section.
+	};
+
+	static const char* source_extensions[];
+
+private:
+	static std::vector<std::string> get_source_files(const parameter_map& param_map);
+	static std::vector<scanned_include> scan_file(const std::string& filename, const std::vector<std::string>& include_prefixes, bool keep_conditions);
+
+public:
+	static void generate_input_file(const parameter_map& param_map);
+};
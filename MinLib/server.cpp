@@ -0,0 +1,652 @@
+#include "server.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <regex>
+#include <set>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include "errors.hpp"
+#include "cli.hpp"
+#include "dep_reader.hpp"
+#include "file_utils.hpp"
+#include "string_utils.hpp"
+#include "stage_dir.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <WinSock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+using namespace std;
+using namespace minlib;
+
+const char* server::RESOLVE_COMMAND = "resolve";
+const char* server::BUNDLE_COMMAND = "bundle";
+const char* server::CLEAR_COMMAND = "clear";
+const char* server::STOP_COMMAND = "stop";
+
+// The parameters that only affect what is done with a bundle, not which files it's made of.
+const char* server::OUTPUT_PARAMS[] = {
+	cli::INCLUDE_OUT_DIR_PARAM, cli::LIB_OUT_DIR_PARAM, cli::COPY_FILES_PARAM, cli::PRECOMPILED_HEADER_PARAM,
+	cli::PCH_FLAGS_PARAM, cli::HEADER_UNITS_PARAM, cli::HEADER_UNIT_FLAGS_PARAM, cli::JOBS_PARAM, cli::MINIFY_HEADERS_PARAM,
+	cli::KEEP_LICENSE_PARAM, cli::PIN_DEFS_PARAM, cli::ALLOC_STATS_PARAM, cli::STRIP_LIBS_PARAM, cli::VERIFY_PARAM,
+	cli::MANIFEST_PARAM, cli::DELTA_BASE_PARAM, cli::DELTA_PACK_PARAM
+};
+
+// How long the server waits for a connection before checking whether it was asked to stop.
+static const int ACCEPT_INTERVAL_MS = 100;
+
+// Requests and responses larger than this are rejected, as no legitimate one comes close.
+static const size_t MAX_REQUEST_SIZE = 1 << 20;
+
+// The cached bundles are dropped all at once when there are this many, which a single build never gets to.
+static const size_t MAX_CACHED_RESULTS = 256;
+
+// File timestamps lag behind the clock by up to a timer tick, so a file whose timestamp is this close to the
+// start of a run may have changed after the run read it.
+static const chrono::milliseconds TIMESTAMP_GRANULARITY(10);
+
+namespace
+{
+#ifdef _WIN32
+	using socket_handle = SOCKET;
+	const socket_handle NO_SOCKET = INVALID_SOCKET;
+	const int SEND_FLAGS = 0;
+
+	void start_sockets()
+	{
+		static WSADATA data;
+		static auto result = WSAStartup(MAKEWORD(2, 2), &data);
+		(void)result;
+	}
+
+	void close_socket(socket_handle s) { closesocket(s); }
+
+	int poll_socket(socket_handle s, int timeout_ms)
+	{
+		WSAPOLLFD pfd{ s, POLLRDNORM, 0 };
+		return WSAPoll(&pfd, 1, timeout_ms);
+	}
+#else
+	using socket_handle = int;
+	const socket_handle NO_SOCKET = -1;
+#ifdef MSG_NOSIGNAL
+	const int SEND_FLAGS = MSG_NOSIGNAL; // A client that hangs up mustn't kill the server with SIGPIPE.
+#else
+	const int SEND_FLAGS = 0;
+#endif
+
+	void start_sockets() {}
+
+	void close_socket(socket_handle s) { close(s); }
+
+	int poll_socket(socket_handle s, int timeout_ms)
+	{
+		pollfd pfd{ s, POLLIN, 0 };
+		return poll(&pfd, 1, timeout_ms);
+	}
+#endif
+
+	sockaddr_un get_address(const string& path)
+	{
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+			throw runtime_error(regex_replace(SOCKET_PATH_ERROR, regex("%s"), path));
+
+		memcpy(address.sun_path, path.c_str(), path.size() + 1);
+		return address;
+	}
+
+	socket_handle connect_to(const string& path)
+	{
+		auto address = get_address(path);
+		auto s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (s == NO_SOCKET) return NO_SOCKET;
+
+		if (connect(s, (const sockaddr*)&address, sizeof(address)) != 0)
+		{
+			close_socket(s);
+			return NO_SOCKET;
+		}
+
+		return s;
+	}
+
+	bool send_all(socket_handle s, const string& data)
+	{
+		size_t sent = 0;
+		while (sent < data.size())
+		{
+			auto count = send(s, data.data() + sent, (int)(data.size() - sent), SEND_FLAGS);
+			if (count <= 0) return false;
+			sent += (size_t)count;
+		}
+		return true;
+	}
+
+	// Reads a message, i.e. up to and including the empty line that ends it, or up to the end of the stream.
+	bool receive_message(socket_handle s, string& out_message, size_t max_size)
+	{
+		char buffer[16 * 1024];
+		size_t scanned = 0;
+
+		while (out_message.find("\n\n", scanned) == string::npos)
+		{
+			scanned = out_message.empty() ? 0 : out_message.size() - 1;
+			if (out_message.size() > max_size) return false;
+
+			auto count = recv(s, buffer, sizeof(buffer), 0);
+			if (count < 0) return false;
+			if (count == 0) break;
+			out_message.append(buffer, (size_t)count);
+		}
+
+		return true;
+	}
+
+	// The directory containing a file, the same way as file_watcher::has_changed() works it out.
+	string get_parent_dir(const string& path)
+	{
+		auto separator = path.find_last_of('/');
+		if (separator == string::npos) return ".";
+		return separator == 0 ? "/" : path.substr(0, separator);
+	}
+}
+
+/// <summary>
+/// Creates the server; it doesn't listen until run() is called.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+server::server(const parameter_map& param_map) : socket_path(get_socket_path(param_map)), watcher(stage_dir::ROOT_DIR_NAME)
+{
+}
+
+/// <summary>
+/// Gets the path to the server's socket: the value of the 'socket' parameter, or by default a path of the user's own,
+/// so that the servers of different users don't collide: 'minlib.sock' in $XDG_RUNTIME_DIR if it's set, otherwise
+/// 'minlib-&lt;uid&gt;.sock' in the temp directory (which is already per-user on Windows).
+/// </summary>
+/// <param name="param_map">The parameters passed into the program.</param>
+/// <returns>The absolute path to the socket.</returns>
+string server::get_socket_path(const parameter_map& param_map)
+{
+	if (auto it = param_map.find(cli::SOCKET_PARAM); it != param_map.end() && it->second != "")
+	{
+		filesystem::path path(get_expanded_path(it->second));
+		return (path.is_relative() ? filesystem::current_path() / path : path).u8string();
+	}
+
+#ifdef _WIN32
+	return (filesystem::temp_directory_path() / "minlib.sock").u8string();
+#else
+	if (auto runtime_dir = getenv("XDG_RUNTIME_DIR"); runtime_dir != nullptr && runtime_dir[0] == '/')
+		return (filesystem::path(runtime_dir) / "minlib.sock").u8string();
+
+	return (filesystem::temp_directory_path() / ("minlib-" + to_string(getuid()) + ".sock")).u8string();
+#endif
+}
+
+/// <summary>
+/// Gets the key under which a bundle is cached: the parameters that decide which files it's made of.
+/// </summary>
+/// <param name="param_map">The parameters of the request.</param>
+/// <returns>The key.</returns>
+string server::get_resolve_key(const parameter_map& param_map)
+{
+	string key;
+	for (auto& [name, value] : param_map)
+	{
+		auto is_output_param = false;
+		for (auto output_param : OUTPUT_PARAMS)
+			is_output_param = is_output_param || name == output_param;
+
+		if (!is_output_param)
+			key += name + '=' + value + '\n';
+	}
+
+	return key;
+}
+
+/// <summary>
+/// Gets the files and directories that a bundle is derived from, such that the bundle may be different once
+/// any of the files changes, or any file is added to or removed from any of the directories.
+/// </summary>
+/// <param name="param_map">The parameters of the request.</param>
+/// <param name="result">The resolved bundle, whose list of files and directories are set.</param>
+void server::get_dependencies(const parameter_map& param_map, resolve_result& result)
+{
+	auto working_dir_path = filesystem::path(get_expanded_path(param_map.at(cli::WORKING_DIR_PARAM)));
+	if (working_dir_path.is_relative())
+		working_dir_path = filesystem::current_path() / working_dir_path;
+
+	auto get_full_path = [&](const string& path) {
+		filesystem::path p(get_expanded_path(path));
+		return (p.is_relative() ? working_dir_path / p : p).lexically_normal().u8string();
+	};
+
+	auto get_values = [&param_map](const char* param_name) {
+		auto it = param_map.find(param_name);
+		return it == param_map.end() ? vector<string>() : parameter::get_param_values(it->second);
+	};
+
+	set<string> dirs, files;
+	for (auto& dir : get_values(cli::INCLUDE_DIR_PARAM)) dirs.insert(get_full_path(dir));
+	for (auto& dir : get_values(cli::LIB_DIR_PARAM)) dirs.insert(get_full_path(dir));
+
+	// When the input file is generated from the project's sources, the sources take its place.
+	auto source_dirs = get_values(cli::SOURCE_DIR_PARAM);
+	for (auto& source_dir : source_dirs)
+	{
+		auto dir = get_full_path(source_dir);
+		dirs.insert(dir);
+
+		error_code ec;
+		for (filesystem::recursive_directory_iterator it(dir, filesystem::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec))
+		{
+			if (it->is_directory(ec)) dirs.insert(it->path().u8string());
+			else files.insert(it->path().u8string());
+		}
+	}
+
+	if (param_map.find(cli::COMPILE_COMMANDS_PARAM) != param_map.end())
+	{
+		for (auto& dep_file : dep_reader::get_dep_files(param_map))
+			files.insert(dep_file);
+	}
+	else if (source_dirs.empty())
+	{
+		files.insert(get_full_path(param_map.at(cli::INPUT_FILE_PARAM)));
+	}
+
+	// Quoted #include statements are looked up in the including file's directory first.  The preprocessor
+	// also reports its copy of the input file in the staging directories, and pseudo-files such as <built-in>.
+	auto stage_prefix = stage_dir::get_root(working_dir_path).lexically_normal().u8string() + '/';
+	for (auto& include_file : result.bundle.include_files)
+	{
+		string path(include_file);
+		if (!filesystem::path(path).is_absolute() || path.compare(0, stage_prefix.size(), stage_prefix) == 0)
+			continue;
+
+		dirs.insert(get_parent_dir(path));
+		files.insert(move(path));
+	}
+
+	for (auto& lib_file : result.bundle.lib_files)
+		files.insert(get_full_path(string(lib_file)));
+
+	result.working_dir = working_dir_path.lexically_normal().u8string();
+	result.dirs.assign(dirs.begin(), dirs.end());
+	result.files.assign(files.begin(), files.end());
+}
+
+/// <summary>
+/// Formats the files of a bundle and its include graph, as sent back to the client.
+/// </summary>
+/// <param name="bundle">The bundle.</param>
+/// <returns>The 'include', 'lib' and 'edge' lines.</returns>
+string server::format_bundle(const lib_bundle& bundle)
+{
+	string result;
+
+	for (auto& include_file : bundle.include_files)
+		result.append("include\t").append(include_file).append("\n");
+
+	for (auto& lib_file : bundle.lib_files)
+		result.append("lib\t").append(lib_file).append("\n");
+
+	for (auto& [file, includes] : bundle.include_graph)
+	{
+		for (auto& include : includes)
+			result.append("edge\t").append(file).append("\t").append(include).append("\n");
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Gets the configuration for the parameters of a request, which is only checked and completed the first
+/// time the parameters are seen.
+/// </summary>
+/// <param name="values">The parameters of the request.</param>
+/// <returns>The configuration.</returns>
+shared_ptr<const configuration> server::get_configuration(const parameter_map& values)
+{
+	string key;
+	for (auto& [name, value] : values)
+		key += name + '=' + value + '\n';
+
+	{
+		shared_lock<shared_mutex> lock(cache_mutex);
+		if (auto it = configs.find(key); it != configs.end())
+			return it->second;
+	}
+
+	auto config = make_shared<const configuration>(values);
+
+	unique_lock<shared_mutex> lock(cache_mutex);
+	return configs.emplace(key, config).first->second;
+}
+
+/// <summary>
+/// Checks whether a cached bundle is still current, i.e. none of the files it's derived from changed since.
+/// </summary>
+/// <param name="result">The cached bundle.</param>
+bool server::is_current(const resolve_result& result)
+{
+	if (watcher.is_active())
+		return !watcher.has_changed(result.dirs, result.files, result.sequence);
+
+	for (auto& [path, time] : result.timestamps)
+	{
+		error_code ec;
+		auto current_time = filesystem::last_write_time(path, ec);
+		if (ec) current_time = filesystem::file_time_type::min();
+		if (current_time != time) return false;
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Gets the bundle for a configuration, from the cache if it's still current, otherwise by running the
+/// preprocessor and parsing its output (or reading the project's dependency files).
+/// </summary>
+/// <param name="config">The configuration.</param>
+/// <param name="out_cached">Whether the bundle came from the cache.</param>
+/// <returns>The bundle, along with the files it's derived from.</returns>
+shared_ptr<const server::resolve_result> server::resolve(const configuration& config, bool& out_cached)
+{
+	auto key = get_resolve_key(config.get_params());
+	auto find_current = [&]() -> shared_ptr<const resolve_result> {
+		shared_lock<shared_mutex> lock(cache_mutex);
+		auto it = results.find(key);
+		return it != results.end() && is_current(*it->second) ? it->second : nullptr;
+	};
+
+	out_cached = true;
+	if (auto cached = find_current())
+		return cached;
+
+	// Only one request runs the compiler at a time; by the time this one gets to,
+	// another may have resolved the same bundle.
+	lock_guard<mutex> run_lock(run_mutex);
+	if (auto cached = find_current())
+		return cached;
+
+	out_cached = false;
+	if (!watcher.is_active() || watcher.take_dirs_changed())
+		session.clear_caches();
+
+	auto result = make_shared<resolve_result>();
+	result->sequence = watcher.get_sequence();
+	auto start_time = filesystem::file_time_type::clock::now();
+
+	// The bundle is derived from all the files the preprocessor read (system headers included), but
+	// only the files that would be bundled are kept and sent back.
+	session.preprocess(config);
+	result->bundle = session.parse(config);
+	get_dependencies(config.get_params(), *result);
+	result->bundle = session.select_includes(result->bundle, config);
+
+	// The directories are watched before the timestamps are taken, so that no change goes unnoticed:
+	// a file that changed after the run read it, but before its directory was watched, has a timestamp
+	// later than the start of the run, and the bundle isn't cached.
+	auto cacheable = true;
+	if (watcher.is_active())
+	{
+		set<string> watched_dirs(result->dirs.begin(), result->dirs.end());
+		for (auto& file : result->files)
+			watched_dirs.insert(get_parent_dir(file));
+
+		for (auto& dir : watched_dirs)
+			cacheable = watcher.watch(dir) && cacheable;
+	}
+
+	// The working directory's timestamp changes whenever the staging directory is created in it, so it's
+	// left out; changes to its other entries are only noticed by the watcher.
+	for (auto paths : { &result->dirs, &result->files })
+	{
+		for (auto& path : *paths)
+		{
+			if (path == result->working_dir)
+				continue;
+
+			error_code ec;
+			auto time = filesystem::last_write_time(path, ec);
+			if (ec) time = filesystem::file_time_type::min();
+			cacheable = cacheable && time < start_time - TIMESTAMP_GRANULARITY;
+			result->timestamps.emplace_back(path, time);
+		}
+	}
+
+	if (cacheable)
+	{
+		unique_lock<shared_mutex> lock(cache_mutex);
+		if (results.size() >= MAX_CACHED_RESULTS)
+			results.clear();
+		results[key] = result;
+
+		// The changes that predate all the cached results can't make any of them stale.  No other result is
+		// being resolved, as the run lock is held.
+		auto oldest_sequence = result->sequence;
+		for (auto& [result_key, cached_result] : results)
+			oldest_sequence = min(oldest_sequence, cached_result->sequence);
+		watcher.forget_changes(oldest_sequence);
+	}
+
+	return result;
+}
+
+/// <summary>
+/// Handles a request.
+/// </summary>
+/// <param name="request">The request: the command, the parameters and an empty line.</param>
+/// <returns>The response.</returns>
+string server::handle_request(const string& request)
+{
+	try
+	{
+		auto lines = sv_split(request, "\n");
+		string_view first_line;
+		lines.next(first_line);
+		auto command = string(sv_trim(first_line));
+
+		parameter_map values;
+		for (auto line : sv_split(lines.rest(), "\n"))
+		{
+			parameter p;
+			if (parameter::parse_param(line, p) && !p.name.empty())
+				values[p.name] = p.value;
+		}
+
+		if (command == STOP_COMMAND)
+		{
+			stopping = true;
+			return "ok\n\n";
+		}
+
+		if (command == CLEAR_COMMAND)
+		{
+			lock_guard<mutex> run_lock(run_mutex);
+			unique_lock<shared_mutex> lock(cache_mutex);
+			configs.clear();
+			results.clear();
+			watcher.forget_changes(watcher.get_sequence());
+			session.clear_caches();
+			return "ok\n\n";
+		}
+
+		if (command != RESOLVE_COMMAND && command != BUNDLE_COMMAND)
+			throw runtime_error(regex_replace(QUERY_ARG_ERROR, regex("%s"), command));
+
+		auto start_time = chrono::steady_clock::now();
+		auto config = get_configuration(values);
+		auto cached = false;
+		auto result = resolve(*config, cached);
+
+		string files;
+		if (command == BUNDLE_COMMAND)
+		{
+			lock_guard<mutex> run_lock(run_mutex);
+			session.bundle(result->bundle, *config);
+			files = format_bundle(result->bundle);
+		}
+		else
+		{
+			files = format_bundle(result->bundle);
+		}
+
+		auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start_time).count();
+		return string("ok\t") + (cached ? "cached" : "resolved") + "\t" + to_string(elapsed) + " ms\n" + files + "\n";
+	}
+	catch (exception& ex)
+	{
+		auto message = regex_replace(string(ex.what()), regex("[\r\n]+"), " ");
+		return "error\t" + message + "\n\n";
+	}
+}
+
+/// <summary>
+/// Reads a request from a client, then sends back the response and closes the connection.
+/// Runs on a thread of its own.
+/// </summary>
+/// <param name="connection">The client's socket.</param>
+void server::handle_connection(uintptr_t connection)
+{
+	auto s = (socket_handle)connection;
+
+	string request;
+	if (receive_message(s, request, MAX_REQUEST_SIZE))
+		send_all(s, handle_request(request));
+
+	close_socket(s);
+}
+
+/// <summary>
+/// Listens on the socket and handles requests until a 'stop' request is received.
+/// </summary>
+/// <returns>The exit code.</returns>
+int server::run()
+{
+	start_sockets();
+	auto address = get_address(socket_path);
+
+	// A socket left behind by a server that didn't shut down cleanly is replaced,
+	// but not one that a server is still listening on.
+	if (auto existing = connect_to(socket_path); existing != NO_SOCKET)
+	{
+		close_socket(existing);
+		throw runtime_error(regex_replace(SERVER_RUNNING_ERROR, regex("%s"), socket_path));
+	}
+
+	error_code ec;
+	filesystem::remove(filesystem::u8path(socket_path), ec);
+
+	auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == NO_SOCKET || ::bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+	{
+		if (listener != NO_SOCKET) close_socket(listener);
+		throw runtime_error(regex_replace(SERVER_LISTEN_ERROR, regex("%s"), socket_path));
+	}
+
+	cout << "MinLib is serving on '" << socket_path << "'..." << endl;
+
+	while (!stopping)
+	{
+		if (poll_socket(listener, ACCEPT_INTERVAL_MS) <= 0)
+			continue;
+
+		auto connection = accept(listener, nullptr, nullptr);
+		if (connection == NO_SOCKET)
+			continue;
+
+		{
+			lock_guard<mutex> lock(connections_mutex);
+			++connection_count;
+		}
+
+		thread([this, connection]() {
+			handle_connection((uintptr_t)connection);
+
+			lock_guard<mutex> lock(connections_mutex);
+			if (--connection_count == 0)
+				connections_done.notify_all();
+		}).detach();
+	}
+
+	close_socket(listener);
+	filesystem::remove(filesystem::u8path(socket_path), ec);
+
+	// The requests in progress are finished before the caches go away.
+	unique_lock<mutex> lock(connections_mutex);
+	connections_done.wait(lock, [this]() { return connection_count == 0; });
+
+	cout << "MinLib server stopped." << endl;
+
+	return 0;
+}
+
+/// <summary>
+/// Sends a request to a running server ('query' parameter) and prints the response.
+/// </summary>
+/// <param name="param_map">The parameters passed into the program; those of a 'resolve' or 'bundle' request are sent along.</param>
+/// <returns>The exit code.</returns>
+int server::query(const parameter_map& param_map)
+{
+	auto command = param_map.at(cli::QUERY_PARAM);
+	if (command != RESOLVE_COMMAND && command != BUNDLE_COMMAND && command != CLEAR_COMMAND && command != STOP_COMMAND)
+		throw runtime_error(regex_replace(QUERY_ARG_ERROR, regex("%s"), command));
+
+	// The parameters are sent with the defaults filled in, and with the working directory and the vcvars32.bat
+	// file made absolute, so that relative paths are relative to the client's directory rather than the server's
+	// (the other paths are relative to the working directory).
+	auto get_client_path = [](const string& value) {
+		filesystem::path path(get_expanded_path(value));
+		return path.is_relative() ? (filesystem::current_path() / path).lexically_normal().u8string() : value;
+	};
+
+	auto request = command + "\n";
+	if (command == RESOLVE_COMMAND || command == BUNDLE_COMMAND)
+	{
+		for (auto& [name, value] : param_map)
+		{
+			if (name == cli::QUERY_PARAM || name == cli::SOCKET_PARAM || name.compare(0, 2, "__") == 0)
+				continue;
+
+			auto is_client_path = name == cli::WORKING_DIR_PARAM || name == cli::MSVC_BAT_PARAM;
+			request += name + "=" + (is_client_path ? get_client_path(value) : value) + "\n";
+		}
+	}
+	request += "\n";
+
+	start_sockets();
+	auto path = get_socket_path(param_map);
+	auto s = connect_to(path);
+	if (s == NO_SOCKET)
+		throw runtime_error(regex_replace(SERVER_CONNECT_ERROR, regex("%s"), path));
+
+	string response;
+	auto received = send_all(s, request) && receive_message(s, response, SIZE_MAX);
+	close_socket(s);
+
+	if (received && response.compare(0, 6, "error\t") == 0)
+		throw runtime_error(response.substr(6, response.find('\n') - 6));
+	if (!received || response.compare(0, 2, "ok") != 0 || response.find("\n\n") == string::npos)
+		throw runtime_error(SERVER_RESPONSE_ERROR);
+
+	// Printed as is, minus the empty line that ends the response.
+	cout << response.substr(0, response.find("\n\n") + 1) << flush;
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <filesystem>
+#include "parameter.hpp"
+#include "lib_bundle.hpp"
+#include "file_watcher.hpp"
+#include "minlib.hpp"
+
+/// <summary>
+/// A resident MinLib ('--serve') that answers queries over a local (Unix domain) socket, keeping the parsed
+/// configurations, the cached directories and the bundles resolved so far in memory.  A bundle is resolved
+/// again once any of the files it was derived from changes (see file_watcher), so warm queries don't touch
+/// the compiler or, on Linux, the file system.  Each connection carries one request, made of the command
+/// ('resolve', 'bundle', 'clear' or 'stop') on the first line, followed by the parameters as 'key=value'
+/// lines and an empty line.  The response starts with 'ok' or 'error', followed by the bundle's files
+/// ('include', 'lib' and 'edge' lines, tab-separated) and an empty line.  The 'lib' lines only list the libs reported
+/// by the compiler, not those given by 'libs' or the shared libs they depend on, which 'bundle' copies as well.  Requests are handled concurrently,
+/// but those that run the compiler or copy files run one at a time, as the requests made with the same parameters
+/// share a staging directory (see stage_dir).
+/// </summary>
+class server
+{
+private:
+	struct resolve_result
+	{
+		lib_bundle bundle;
+		std::string working_dir;
+		std::vector<std::string> dirs;
+		std::vector<std::string> files;
+		std::vector<std::pair<std::string, std::filesystem::file_time_type>> timestamps;
+		uint64_t sequence = 0;
+	};
+
+	static const char* RESOLVE_COMMAND;
+	static const char* BUNDLE_COMMAND;
+	static const char* CLEAR_COMMAND;
+	static const char* STOP_COMMAND;
+	static const char* OUTPUT_PARAMS[];
+
+	std::string socket_path;
+	minlib::session session;
+	file_watcher watcher;
+
+	std::mutex run_mutex;
+	std::shared_mutex cache_mutex;
+	std::unordered_map<std::string, std::shared_ptr<const minlib::configuration>> configs;
+	std::unordered_map<std::string, std::shared_ptr<const resolve_result>> results;
+
+	std::atomic<bool> stopping{ false };
+	std::mutex connections_mutex;
+	std::condition_variable connections_done;
+	size_t connection_count = 0;
+
+private:
+	static std::string get_resolve_key(const parameter_map& param_map);
+	static void get_dependencies(const parameter_map& param_map, resolve_result& result);
+	static std::string format_bundle(const lib_bundle& bundle);
+
+	std::shared_ptr<const minlib::configuration> get_configuration(const parameter_map& values);
+	bool is_current(const resolve_result& result);
+	std::shared_ptr<const resolve_result> resolve(const minlib::configuration& config, bool& out_cached);
+	std::string handle_request(const std::string& request);
+	void handle_connection(std::uintptr_t connection);
+
+public:
+	explicit server(const parameter_map& param_map);
+
+	server(const server&) = delete;
+	server& operator=(const server&) = delete;
+
+	int run();
+
+	static std::string get_socket_path(const parameter_map& param_map);
+	static int query(const parameter_map& param_map);
+};
@@ -0,0 +1,87 @@
+#include "stage_dir.hpp"
+#include <atomic>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char* LOCK_FILENAME = "minlib.lock";
+
+const char* stage_dir::ROOT_DIR_NAME = "minlib_stage";
+
+/// <summary>
+/// Gets the directory within which the staging directories of the runs made in a working directory are created.
+/// </summary>
+/// <param name="working_dir_path">The absolute path to the working directory.</param>
+filesystem::path stage_dir::get_root(const filesystem::path& working_dir_path)
+{
+	return working_dir_path / ROOT_DIR_NAME;
+}
+
+/// <summary>
+/// Picks the name of the staging directory; nothing is created until create() is called.
+/// </summary>
+/// <param name="working_dir_path">The absolute path to the working directory.</param>
+stage_dir::stage_dir(const string& working_dir_path)
+{
+	static atomic<unsigned> counter{ 0 };
+
+	auto root = get_root(filesystem::u8path(working_dir_path));
+	root_path = root.u8string();
+	path = (root / (to_string(getpid()) + "-" + to_string(++counter))).u8string();
+}
+
+stage_dir::~stage_dir()
+{
+	if (root_lock == nullptr) return;
+
+	error_code ec;
+	filesystem::remove_all(filesystem::u8path(path), ec);
+}
+
+/// <summary>
+/// Creates the staging directory, unless it already exists, first removing the directories left behind
+/// by other runs if none is in progress.
+/// </summary>
+void stage_dir::create()
+{
+	lock_guard<std::mutex> lock(mutex);
+	if (root_lock != nullptr) return;
+
+	filesystem::create_directories(filesystem::u8path(root_path));
+	auto new_lock = make_unique<file_lock>((filesystem::u8path(root_path) / LOCK_FILENAME).u8string());
+
+	// Holding the exclusive lock means that no other run has a staging directory.
+	if (new_lock->try_lock())
+		remove_stale_dirs();
+	new_lock->lock_shared();
+
+	// A directory of the same name can only have been left behind by a process that had the same ID.
+	auto stage_path = filesystem::u8path(path);
+	if (filesystem::exists(stage_path))
+		filesystem::remove_all(stage_path);
+	filesystem::create_directory(stage_path);
+
+	root_lock = move(new_lock);
+}
+
+/// <summary>
+/// Removes everything within 'minlib_stage' but the lock file.  Entries that can't be removed are skipped.
+/// </summary>
+void stage_dir::remove_stale_dirs()
+{
+	error_code ec;
+	for (auto& entry : filesystem::directory_iterator(filesystem::u8path(root_path), ec))
+	{
+		if (entry.path().filename() == LOCK_FILENAME) continue;
+
+		error_code remove_ec;
+		filesystem::remove_all(entry.path(), remove_ec);
+	}
+}
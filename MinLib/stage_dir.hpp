@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include "file_lock.hpp"
+
+/// <summary>
+/// The staging directory of a configuration, i.e. of the runs made with it: a directory within
+/// 'working_dir/minlib_stage' named after the process and a counter, so that runs sharing the working
+/// directory don't wipe each other's files.  The directory is created by the first run and removed when
+/// the instance is destroyed.  While it exists, a shared lock is held on 'minlib_stage/minlib.lock'; the
+/// directories left behind by runs that were killed are removed by the next run that finds no lock held.
+/// Thread-safe.
+/// </summary>
+class stage_dir
+{
+public:
+	static const char* ROOT_DIR_NAME;
+
+private:
+	std::mutex mutex;
+	std::string root_path;
+	std::string path;
+	std::unique_ptr<file_lock> root_lock;
+
+	void remove_stale_dirs();
+
+public:
+	explicit stage_dir(const std::string& working_dir_path);
+	~stage_dir();
+
+	stage_dir(const stage_dir&) = delete;
+	stage_dir& operator=(const stage_dir&) = delete;
+
+	static std::filesystem::path get_root(const std::filesystem::path& working_dir_path);
+
+	void create();
+	const std::string& get_path() const { return path; }
+};
@@ -1,20 +1,7 @@
 #include "string_utils.hpp"
-#include <algorithm> 
-#include <cctype>
-#include <locale>
 
 using namespace std;
 
-// These three functions should not have external linkage.  Only the safer
-// versions that do not alter the input string are made accessible.
-// This approach may be opposed in favor of using the more performant
-// versions that don't make a copy of the input string.  MinLib has yet
-// to be optimized...
-void ltrim(string& s);
-void rtrim(string& s);
-void trim(string& s);
-
-
 /// <summary>
 /// Splits a string into a vector based on a char delimiter.
 /// </summary>
@@ -24,17 +11,11 @@ void trim(string& s);
 vector<string> str_split(const string& str, char delimeter = ',')
 {
 	vector<string> result;
-	size_t start;
-	size_t end = 0;
-
-	while ((start = str.find_first_not_of(delimeter, end)) != string::npos)
-	{
-		end = str.find(delimeter, start);
-		result.push_back(str.substr(start, end - start));
-	}
+	for (auto token : sv_split(str, string_view(&delimeter, 1)))
+		result.emplace_back(token);
 
-    if (result.size() == 0)
-        result.push_back(str);
+	if (result.size() == 0)
+		result.push_back(str);
 
 	return result;
 }
@@ -46,9 +27,7 @@ vector<string> str_split(const string& str, char delimeter = ',')
 /// <returns>Returns a new string instance with the leading whitespace characters removed.</returns>
 string str_ltrim(const string& str)
 {
-    string s(str);
-    ltrim(s);
-    return s;
+    return string(sv_ltrim(str));
 }
 
 /// <summary>
@@ -58,9 +37,7 @@ string str_ltrim(const string& str)
 /// <returns>Returns a new string instance with the trailing whitespace characters removed.</returns>
 string str_rtrim(const string& str)
 {
-    string s(str);
-    rtrim(s);
-    return s;
+    return string(sv_rtrim(str));
 }
 
 /// <summary>
@@ -70,42 +47,85 @@ string str_rtrim(const string& str)
 /// <returns>Returns a new string instance with the leading and trailing whitespace characters removed.</returns>
 string str_trim(const string& str)
 {
-    string s(str);
-    trim(s);
-    return s;
+    return string(sv_trim(str));
 }
 
 /// <summary>
-/// Removes all leading whitespace characters.
+/// Removes all leading whitespace characters, without copying the string.
 /// </summary>
-/// <param name="s">The input string to be trimmed.  The reference passed in will be modified.</param>
-void ltrim(string& s)
+/// <param name="str">The input string to be trimmed.</param>
+/// <returns>Returns a view of the input string with the leading whitespace characters removed.</returns>
+string_view sv_ltrim(string_view str)
 {
-    s.erase(s.begin(), find_if(s.begin(), s.end(), [](unsigned char ch)
-        {
-            return !isspace(ch);
-        }));
+	auto start = str.find_first_not_of(SV_WHITESPACE);
+	return start == string_view::npos ? string_view() : str.substr(start);
 }
 
 /// <summary>
-/// Removes all trailing whitespace characters.
+/// Removes all trailing whitespace characters, without copying the string.
 /// </summary>
-/// <param name="s">The input string to be trimmed.  The reference passed in will be modified.</param>
-void rtrim(string& s)
+/// <param name="str">The input string to be trimmed.</param>
+/// <returns>Returns a view of the input string with the trailing whitespace characters removed.</returns>
+string_view sv_rtrim(string_view str)
 {
-    s.erase(find_if(s.rbegin(), s.rend(), [](unsigned char ch)
-        {
-            return !isspace(ch);
-        }).base(), s.end());
+	auto end = str.find_last_not_of(SV_WHITESPACE);
+	return end == string_view::npos ? string_view() : str.substr(0, end + 1);
 }
 
 /// <summary>
-/// Removes all leading and trailing whitespace characters.
+/// Removes all leading and trailing whitespace characters, without copying the string.
 /// </summary>
-/// <param name="s">The input string to be trimmed.  The reference passed in will be modified.</param>
-void trim(string& s)
+/// <param name="str">The input string to be trimmed.</param>
+/// <returns>Returns a view of the input string with the leading and trailing whitespace characters removed.</returns>
+string_view sv_trim(string_view str)
 {
-    ltrim(s);
-    rtrim(s);
+	return sv_rtrim(sv_ltrim(str));
 }
 
+/// <summary>
+/// Splits a string into tokens separated by any of the delimiter characters, without allocating.
+/// </summary>
+/// <param name="str">The string to be split.  It must outlive the returned tokenizer and its tokens.</param>
+/// <param name="delimiters">The delimiter characters; whitespace by default.</param>
+/// <returns>A tokenizer that can be iterated over to get the tokens.</returns>
+sv_tokenizer sv_split(string_view str, string_view delimiters)
+{
+	return sv_tokenizer(str, delimiters);
+}
+
+/// <summary>
+/// Removes the comments and line continuations from a line of C/C++ source code, as the preprocessor would
+/// see it.  Block comments may span several lines, hence the state carried from one line to the next.
+/// Literals are kept as they are, so that '/*' within a string isn't mistaken for a comment.
+/// </summary>
+/// <param name="line">The line (or logical line, including the lines joined by continuations).</param>
+/// <param name="in_comment">Whether a block comment is open; updated for the next line.</param>
+/// <returns>The text of the line, where each comment and continuation is replaced by a space.</returns>
+string strip_comments(string_view line, bool& in_comment)
+{
+	string text;
+	for (size_t i = 0; i < line.size(); ++i)
+	{
+		auto c = line[i];
+		if (in_comment)
+		{
+			if (c == '*' && i + 1 < line.size() && line[i + 1] == '/') { in_comment = false; i++; text += ' '; }
+		}
+		else if (c == '/' && i + 1 < line.size() && line[i + 1] == '*') { in_comment = true; i++; }
+		else if (c == '/' && i + 1 < line.size() && line[i + 1] == '/') break;
+		else if (c == '"' || c == '\'')
+		{
+			auto quote = c;
+			text += c;
+			for (++i; i < line.size() && line[i] != quote; ++i)
+			{
+				text += line[i];
+				if (line[i] == '\\' && i + 1 < line.size()) text += line[++i];
+			}
+			if (i < line.size()) text += line[i];
+		}
+		else if (c == '\\' && (i + 1 == line.size() || line[i + 1] == '\n' || line[i + 1] == '\r')) text += ' ';
+		else if (c != '\n' && c != '\r') text += c;
+	}
+	return text;
+}
\ No newline at end of file
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <iterator>
+#include <cstddef>
 
 std::vector<std::string> str_split(const std::string& str, char delimeter);
 
@@ -9,4 +12,102 @@ std::string str_ltrim(const std::string& str);
 
 std::string str_rtrim(const std::string& str);
 
-std::string str_trim(const std::string& str);
\ No newline at end of file
+std::string str_trim(const std::string& str);
+
+// The whitespace characters, as classified by 'isspace' in the "C" locale.
+constexpr std::string_view SV_WHITESPACE = " \t\n\v\f\r";
+
+std::string_view sv_ltrim(std::string_view str);
+
+std::string_view sv_rtrim(std::string_view str);
+
+std::string_view sv_trim(std::string_view str);
+
+/// <summary>
+/// A non-allocating view over the tokens of a string, where the tokens are separated by any
+/// of the delimiter characters.  Empty tokens are skipped.  The tokens refer to the original
+/// string, so the string must outlive the tokenizer and any of the tokens being used.
+/// </summary>
+class sv_tokenizer
+{
+public:
+	class iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::string_view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const std::string_view*;
+		using reference = const std::string_view&;
+
+		iterator() = default;
+		iterator(std::string_view str, std::string_view delimiters, size_t pos) : str_(str), delimiters_(delimiters) { next(pos); }
+
+		reference operator*() const { return token_; }
+		pointer operator->() const { return &token_; }
+		iterator& operator++() { next(end_); return *this; }
+		iterator operator++(int) { auto it = *this; next(end_); return it; }
+		bool operator==(const iterator& other) const { return start_ == other.start_; }
+		bool operator!=(const iterator& other) const { return start_ != other.start_; }
+
+	private:
+		void next(size_t pos)
+		{
+			start_ = str_.find_first_not_of(delimiters_, pos);
+			if (start_ == std::string_view::npos)
+			{
+				token_ = std::string_view();
+				end_ = start_;
+				return;
+			}
+
+			end_ = str_.find_first_of(delimiters_, start_);
+			if (end_ == std::string_view::npos) end_ = str_.size();
+			token_ = str_.substr(start_, end_ - start_);
+		}
+
+		std::string_view str_;
+		std::string_view delimiters_;
+		std::string_view token_;
+		size_t start_ = std::string_view::npos;
+		size_t end_ = std::string_view::npos;
+	};
+
+	sv_tokenizer(std::string_view str, std::string_view delimiters = SV_WHITESPACE) : str_(str), delimiters_(delimiters) {}
+
+	iterator begin() const { return iterator(str_, delimiters_, 0); }
+	iterator end() const { return iterator(); }
+
+	/// <summary>
+	/// Gets the next token and moves past it, for parsing tokens one at a time.
+	/// </summary>
+	/// <param name="out_token">Set to the token, or to an empty view if there are no more tokens.</param>
+	/// <returns>Returns true if a token was found.</returns>
+	bool next(std::string_view& out_token)
+	{
+		auto it = begin();
+		if (it == end())
+		{
+			out_token = std::string_view();
+			str_ = std::string_view();
+			return false;
+		}
+
+		out_token = *it;
+		str_.remove_prefix(out_token.data() + out_token.size() - str_.data());
+		return true;
+	}
+
+	/// <summary>
+	/// Gets the part of the string that hasn't been consumed by 'next' yet.
+	/// </summary>
+	std::string_view rest() const { return str_; }
+
+private:
+	std::string_view str_;
+	std::string_view delimiters_;
+};
+
+sv_tokenizer sv_split(std::string_view str, std::string_view delimiters = SV_WHITESPACE);
+
+std::string strip_comments(std::string_view line, bool& in_comment);
@@ -0,0 +1,199 @@
+#include "strip_utils.hpp"
+#include <fstream>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <regex>
+#include "elf_utils.hpp"
+#include "mapped_file.hpp"
+#include "errors.hpp"
+
+using namespace std;
+using namespace minlib;
+
+namespace
+{
+	const char AR_MAGIC[] = "!<arch>\n";
+	const size_t AR_MAGIC_SIZE = 8;
+	const size_t AR_HEADER_SIZE = 60;
+
+	struct archive_member
+	{
+		uint64_t header_offset;
+		uint64_t data_offset;    // Where the ELF object starts, after the BSD-style name if there is one.
+		uint64_t size;           // The size of the member's data, including the BSD-style name.
+		uint64_t new_size;
+		bool has_plan = false;
+		elf_strip_plan plan;
+	};
+
+	// Symbol tables of GNU/SysV archives: '/' has 32-bit big-endian offsets, '/SYM64/' 64-bit ones.
+	bool is_symbol_table(const char* header, size_t& out_word_size)
+	{
+		if (memcmp(header, "/               ", 16) == 0) { out_word_size = 4; return true; }
+		if (memcmp(header, "/SYM64/         ", 16) == 0) { out_word_size = 8; return true; }
+		return false;
+	}
+
+	uint64_t read_big_endian(const char* p, size_t length)
+	{
+		uint64_t value = 0;
+		for (size_t i = 0; i < length; ++i)
+			value = (value << 8) | (unsigned char)p[i];
+		return value;
+	}
+
+	void write_big_endian(char* p, size_t length, uint64_t value)
+	{
+		for (size_t i = 0; i < length; ++i)
+		{
+			p[length - 1 - i] = (char)(value & 0xff);
+			value >>= 8;
+		}
+	}
+
+	uint64_t read_decimal(const char* p, size_t length)
+	{
+		string field(p, length);
+		return strtoull(field.c_str(), nullptr, 10);
+	}
+
+	/// <summary>
+	/// Strips the ELF objects within a GNU/SysV 'ar' archive.  The new size of every member is worked out
+	/// up front, so that the offsets in the archive's symbol table can be updated before the members are
+	/// streamed to the output one by one.
+	/// </summary>
+	bool strip_archive(const string& from, const string& to, const char* data, size_t size)
+	{
+		vector<archive_member> members;
+		auto has_changes = false;
+
+		for (uint64_t offset = AR_MAGIC_SIZE; offset + AR_HEADER_SIZE <= size; )
+		{
+			auto header = data + offset;
+			if (memcmp(header + 58, "`\n", 2) != 0)
+				throw runtime_error(regex_replace(LIB_STRIP_FORMAT_ERROR, regex("%s"), from));
+
+			// BSD-style symbol tables use a different (host-dependent) layout; leave those archives as they are.
+			if (memcmp(header, "__.SYMDEF", 9) == 0) return false;
+
+			archive_member m;
+			m.header_offset = offset;
+			m.size = read_decimal(header + 48, 10);
+			m.data_offset = offset + AR_HEADER_SIZE;
+			if (m.size > size - m.data_offset)
+				throw runtime_error(regex_replace(LIB_STRIP_FORMAT_ERROR, regex("%s"), from));
+
+			uint64_t name_length = 0;
+			if (memcmp(header, "#1/", 3) == 0)
+				name_length = read_decimal(header + 3, 13);
+
+			size_t word_size;
+			if (!is_symbol_table(header, word_size) && name_length <= m.size)
+			{
+				m.has_plan = get_elf_strip_plan(data + m.data_offset + name_length, (size_t)(m.size - name_length), m.plan);
+				has_changes |= m.has_plan;
+			}
+
+			m.data_offset += name_length;
+			m.new_size = m.has_plan ? name_length + m.plan.size : m.size;
+			members.push_back(move(m));
+
+			offset += AR_HEADER_SIZE + members.back().size + (members.back().size & 1);
+		}
+
+		if (!has_changes) return false;
+
+		map<uint64_t, uint64_t> new_offsets;
+		uint64_t position = AR_MAGIC_SIZE;
+		for (auto& m : members)
+		{
+			new_offsets[m.header_offset] = position;
+			position += AR_HEADER_SIZE + m.new_size + (m.new_size & 1);
+		}
+
+		ofstream out(to, ios::out | ios::binary);
+		if (out.fail())
+			throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), to));
+
+		out.write(AR_MAGIC, AR_MAGIC_SIZE);
+		for (auto& m : members)
+		{
+			auto header = data + m.header_offset;
+			string new_header(header, AR_HEADER_SIZE);
+			auto name_length = m.data_offset - m.header_offset - AR_HEADER_SIZE;
+
+			size_t word_size;
+			if (is_symbol_table(header, word_size))
+			{
+				// The symbol table is a count, followed by the offset of the member defining each symbol.
+				string table(data + m.data_offset, (size_t)m.size);
+				auto count = m.size >= word_size ? read_big_endian(table.data(), word_size) : 0;
+				for (uint64_t i = 0; i < count && (i + 2) * word_size <= m.size; ++i)
+				{
+					auto entry = &table[(size_t)((i + 1) * word_size)];
+					auto it = new_offsets.find(read_big_endian(entry, word_size));
+					if (it != new_offsets.end()) write_big_endian(entry, word_size, it->second);
+				}
+
+				out.write(new_header.data(), AR_HEADER_SIZE);
+				out.write(table.data(), (streamsize)table.size());
+			}
+			else if (m.has_plan)
+			{
+				auto size_field = to_string(m.new_size);
+				size_field.resize(10, ' ');
+				new_header.replace(48, 10, size_field);
+
+				out.write(new_header.data(), AR_HEADER_SIZE);
+				out.write(data + m.header_offset + AR_HEADER_SIZE, (streamsize)name_length);
+				write_elf_strip_plan(data + m.data_offset, m.plan, out);
+			}
+			else
+			{
+				out.write(header, (streamsize)(AR_HEADER_SIZE + m.size));
+			}
+
+			if (m.new_size & 1) out.put('\n');
+		}
+
+		if (out.fail())
+			throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), to));
+
+		return true;
+	}
+}
+
+/// <summary>
+/// Writes a copy of a lib file without its debug sections.  Both static libs ('ar' archives of ELF
+/// objects) and ELF shared objects are supported; the symbols needed for linking are kept.
+/// </summary>
+/// <param name="from">The path to the lib file.</param>
+/// <param name="to">The path to write the stripped lib file to.</param>
+/// <returns>Returns false, without writing anything, if the file isn't an ELF lib or has no debug sections.</returns>
+bool strip_debug_info(const string& from, const string& to)
+{
+	mapped_file file(from);
+	auto data = file.data();
+	auto size = file.size();
+
+	if (size >= AR_MAGIC_SIZE && memcmp(data, AR_MAGIC, AR_MAGIC_SIZE) == 0)
+		return strip_archive(from, to, data, size);
+
+	elf_strip_plan plan;
+	if (!get_elf_strip_plan(data, size, plan))
+		return false;
+
+	ofstream out(to, ios::out | ios::binary);
+	if (out.fail())
+		throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), to));
+
+	write_elf_strip_plan(data, plan, out);
+
+	if (out.fail())
+		throw runtime_error(regex_replace(FILE_WRITE_ERROR, regex("%s"), to));
+
+	return true;
+}
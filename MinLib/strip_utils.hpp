@@ -0,0 +1,5 @@
+#pragma once
+
+#include <string>
+
+bool strip_debug_info(const std::string& from, const std::string& to);